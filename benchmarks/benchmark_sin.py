@@ -33,6 +33,25 @@ def execute_for_timing(dburl, func, cnt):
     conn.close()
     return ((n2-n1).seconds*1e6 + (n2-n1).microseconds) / 1e6
 
+def execute_batch_for_timing(dburl, func, batch):
+    conn = dbconn.connect(dburl)
+    # Execute dummy command to bring up container
+    cursor = dbconn.execSQL(conn, "select %s(id) from testdata limit 10" % func)
+    cursor.fetchall()
+    if batch > 0:
+        dbconn.execSQL(conn, "set plcontainer.batch_size = %d" % batch)
+        query = ("select sum(v) from plcontainer_call_batch('%s(float8)', "
+                 "'select id::float8 from testdata') as t(v float8)" % func)
+    else:
+        query = "select sum(%s(id)) from testdata" % func
+    n1 = dt.datetime.now()
+    cursor = dbconn.execSQL(conn, query)
+    cursor.fetchall()
+    n2 = dt.datetime.now()
+    cursor.close()
+    conn.close()
+    return ((n2-n1).seconds*1e6 + (n2-n1).microseconds) / 1e6
+
 def main():
     dbURL = dbconn.DbURL(hostname = '127.0.0.1',
                          port     = 5432,
@@ -48,5 +67,17 @@ def main():
                 s += execute_for_timing (dbURL, func, cnt*1000)
             s /= 5.0
             print '%s %d %f' % (func, cnt, s)
+    # Per-row overhead of the function called row by row (batch 0) and in batches
+    execute_noret(dbURL, """create or replace function pysin(x float8) returns float8 as $$
+# container: plc_python
+import math
+return math.sin(x)
+$$ language plcontainer""")
+    for batch in [0, 1, 10, 100, 1000]:
+        s = 0.0
+        for i in range(5):
+            s += execute_batch_for_timing (dbURL, 'pysin', batch)
+        s /= 5.0
+        print 'pysin batch %d %f us/row' % (batch, s * 1e6 / 10000)
 
 main()
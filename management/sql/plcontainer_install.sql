@@ -30,4 +30,28 @@ $$ LANGUAGE SQL VOLATILE;
 
 CREATE OR REPLACE FUNCTION plcontainer_read_config() RETURNS SETOF plcontainer_status AS $$
     select plcontainer_read_config(false);
-$$ LANGUAGE SQL VOLATILE;
\ No newline at end of file
+$$ LANGUAGE SQL VOLATILE;
+
+-- Function cache statistics of the current session
+
+CREATE OR REPLACE FUNCTION plcontainer_function_cache_stats(OUT hits bigint, OUT misses bigint,
+        OUT evictions bigint, OUT invalidations bigint, OUT entries int, OUT capacity int)
+RETURNS record
+AS '$libdir/plcontainer', 'function_cache_stats'
+LANGUAGE C VOLATILE;
+
+-- Compression statistics of the current session
+
+CREATE OR REPLACE FUNCTION plcontainer_compression_stats(OUT compressed bigint, OUT skipped bigint,
+        OUT compress_in bigint, OUT compress_out bigint, OUT compress_ms float8,
+        OUT decompressed bigint, OUT decompress_in bigint, OUT decompress_out bigint,
+        OUT decompress_ms float8, OUT ratio float8)
+RETURNS record
+AS '$libdir/plcontainer', 'compression_stats'
+LANGUAGE C VOLATILE;
+
+-- Calling the function for each row of the query in batches
+
+CREATE OR REPLACE FUNCTION plcontainer_call_batch(func regprocedure, query text) RETURNS SETOF record
+AS '$libdir/plcontainer', 'plcontainer_call_batch'
+LANGUAGE C VOLATILE;
\ No newline at end of file
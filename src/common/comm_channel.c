@@ -29,11 +29,21 @@ interpreted as representing official policies, either expressed or implied, of t
 #include "comm_channel.h"
 #include "comm_utils.h"
 #include "comm_connectivity.h"
+#include "comm_lz4.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/time.h>
+
+/* Values of this size and larger are compressed if both sides support it */
+#define PLC_COMPRESS_MIN_SIZE 1024
+/* Sent in place of the length of the compressed text and bytea values */
+#define PLC_COMPRESSED_LENGTH -2
+
+plcCompressionStats plc_compression_stats;
 
 static int message_start(plcConn *conn, char msgType);
 static int message_end(plcConn *conn);
@@ -47,11 +57,19 @@ static int send_float4(plcConn *conn, float f);
 static int send_float8(plcConn *conn, double f);
 static int send_cstring(plcConn *conn, char *s);
 static int send_bytea(plcConn *conn, char *s);
+static int send_compressed(plcConn *conn, char *s, int len);
+static int send_numeric(plcConn *conn, plcNumeric *num);
+static double numeric_to_float8(plcNumeric *num);
+static plcDatatype wire_type(plcConn *conn, plcDatatype type);
+static char *compress_value(char *data, int len, int *compLen);
 static int send_raw_object(plcConn *conn, plcType *type, rawdata *obj);
 static int send_raw_array_iter(plcConn *conn, plcType *type, plcIterator *iter);
+static int send_packed_array(plcConn *conn, plcType *type, plcIterator *iter);
+static int send_packed_data(plcConn *conn, char *data, int len, char *bitmap, int bitmaplen);
 static int send_type(plcConn *conn, plcType *type);
 static int send_udt(plcConn *conn, plcType *type, plcUDT *udt);
 
+static void *receive_alloc(plcConn *conn, size_t bytes);
 static int receive_message_type(plcConn *conn, char *c);
 static int receive_char(plcConn *conn, char *c);
 static int receive_int16(plcConn *conn, short *i);
@@ -63,26 +81,44 @@ static int receive_float8(plcConn *conn, double *f);
 static int receive_raw(plcConn *conn, char *s, size_t len);
 static int receive_cstring(plcConn *conn, char **s);
 static int receive_bytea(plcConn *conn, char **s);
+static int receive_compressed(plcConn *conn, char *dst, int len);
+static int receive_numeric(plcConn *conn, char **s);
+static long long elapsed_usec(struct timeval *start);
 static int receive_raw_object(plcConn *conn, plcType *type, rawdata *obj);
 static int receive_array(plcConn *conn, plcType *type, rawdata *obj);
+static int receive_packed_array(plcConn *conn, plcArray *arr, int entrylen);
+static int is_fixed_width_type(plcDatatype type);
 static int receive_type(plcConn *conn, plcType *type);
 static int receive_udt(plcConn *conn, plcType *type, char **resdata);
 
+static plcProcHandle *find_proc_handle(plcConn *conn, unsigned int objectid);
+static plcProcHandle *add_proc_handle(plcConn *conn, unsigned int objectid);
+static char *copy_string(plcArena *arena, char *src);
+static void copy_type(plcArena *arena, plcType *dst, plcType *src);
+static plcMsgCallreq *copy_call_header(plcArena *arena, plcMsgCallreq *src);
+static plcProcDef *copy_proc_def(plcMsgCallreq *src);
+
 static int send_argument(plcConn *conn, plcArgument *arg);
-static int send_ping(plcConn *conn);
+static int send_ping(plcConn *conn, plcMsgPing *mping);
+static int send_call_header(plcConn *conn, plcMsgCallreq *call);
 static int send_call(plcConn *conn, plcMsgCallreq *call);
+static int send_call_batch(plcConn *conn, plcMsgCallreqBatch *batch);
 static int send_result(plcConn *conn, plcMsgResult *res);
 static int send_log(plcConn *conn, plcMsgLog *mlog);
 static int send_exception(plcConn *conn, plcMsgError *err);
 static int send_sql(plcConn *conn, plcMsgSQL *msg);
 
 static int receive_exception(plcConn *conn, plcMessage **mExc);
-static int receive_result(plcConn *conn, plcMessage **mRes);
+static int send_result_next(plcConn *conn, plcMsgResultNext *next);
+static int receive_result(plcConn *conn, plcMessage **mRes, char msgType);
+static int receive_result_next(plcConn *conn, plcMessage **mNext);
 static int receive_log(plcConn *conn, plcMessage **mLog);
 static int receive_sql_statement(plcConn *conn, plcMessage **mStmt);
 static int receive_argument(plcConn *conn, plcArgument *arg);
 static int receive_ping(plcConn *conn, plcMessage **mPing);
+static int receive_call_header(plcConn *conn, plcMsgCallreq *req);
 static int receive_call(plcConn *conn, plcMessage **mCall);
+static int receive_call_batch(plcConn *conn, plcMessage **mCall);
 static int receive_sql(plcConn *conn, plcMessage **mSql);
 
 /* Public API Functions */
@@ -91,14 +127,21 @@ int plcontainer_channel_send(plcConn *conn, plcMessage *msg) {
     int res;
     switch (msg->msgtype) {
         case MT_PING:
-            res = send_ping(conn);
+            res = send_ping(conn, (plcMsgPing*)msg);
             break;
         case MT_CALLREQ:
             res = send_call(conn, (plcMsgCallreq*)msg);
             break;
+        case MT_CALLREQ_BATCH:
+            res = send_call_batch(conn, (plcMsgCallreqBatch*)msg);
+            break;
         case MT_RESULT:
+        case MT_RESULT_CHUNK:
             res = send_result(conn, (plcMsgResult*)msg);
             break;
+        case MT_RESULT_NEXT:
+            res = send_result_next(conn, (plcMsgResultNext*)msg);
+            break;
         case MT_EXCEPTION:
             res = send_exception(conn, (plcMsgError*)msg);
             break;
@@ -116,14 +159,25 @@ int plcontainer_channel_send(plcConn *conn, plcMessage *msg) {
     return res;
 }
 
+/*
+ * Messages of unknown types and the fields added to the end of the known
+ * ones by the newer peers are skipped using the message framing
+ */
 int plcontainer_channel_receive(plcConn *conn, plcMessage **msg) {
     int  res;
     char cType;
 
-    res = receive_message_type(conn, &cType);
-    if (res < 0) {
-        res = -3;
-    } else {
+    *msg = NULL;
+    while (*msg == NULL) {
+        res = receive_message_type(conn, &cType);
+        if (res < 0) {
+            return -3;
+        }
+
+        /* Reference left by the receive interrupted with an error */
+        plcBufferUnpin(conn->pin);
+        conn->pin = NULL;
+        conn->arena = plc_arena_create();
         switch (cType) {
             case MT_PING:
                 res = receive_ping(conn, msg);
@@ -131,8 +185,15 @@ int plcontainer_channel_receive(plcConn *conn, plcMessage **msg) {
             case MT_CALLREQ:
                 res = receive_call(conn, msg);
                 break;
+            case MT_CALLREQ_BATCH:
+                res = receive_call_batch(conn, msg);
+                break;
             case MT_RESULT:
-                res = receive_result(conn, msg);
+            case MT_RESULT_CHUNK:
+                res = receive_result(conn, msg, cType);
+                break;
+            case MT_RESULT_NEXT:
+                res = receive_result_next(conn, msg);
                 break;
             case MT_EXCEPTION:
                 res = receive_exception(conn, msg);
@@ -144,15 +205,59 @@ int plcontainer_channel_receive(plcConn *conn, plcMessage **msg) {
                 res = receive_sql(conn, msg);
                 break;
             default:
-                lprintf(ERROR, "message type unknown %d / '%c'", (int)cType, cType);
-                *msg = NULL;
-                res = -1;
+                lprintf(LOG, "Skipping message of unknown type %d / '%c'", (int)cType, cType);
                 break;
         }
+        if (res == 0) {
+            res = plcBufferSkipMessage(conn);
+        }
+
+        if (res == 0 && *msg != NULL) {
+            (*msg)->arena = conn->arena;
+            (*msg)->pin   = conn->pin;
+            /* Compact call keeps the function definition until it is released */
+            if ((*msg)->msgtype == MT_CALLREQ && ((plcMsgCallreq*)*msg)->def != NULL) {
+                ((plcMsgCallreq*)*msg)->def->refs++;
+            }
+        } else {
+            plc_arena_delete(conn->arena);
+            plcBufferUnpin(conn->pin);
+            *msg = NULL;
+        }
+        conn->arena = NULL;
+        conn->pin   = NULL;
+        if (res < 0) {
+            break;
+        }
     }
     return res;
 }
 
+/*
+ * Everything decoded from the message is allocated in its arena or references
+ * the pinned input buffer, so the message is released in one operation
+ * regardless of its content
+ */
+void plcontainer_channel_release(plcMessage *msg) {
+    if (msg != NULL) {
+        plcBufferUnpin(msg->pin);
+        if (msg->msgtype == MT_CALLREQ && ((plcMsgCallreq*)msg)->def != NULL) {
+            release_proc_def(((plcMsgCallreq*)msg)->def);
+        }
+        plc_arena_delete(msg->arena);
+    }
+}
+
+/*
+ * Keeps the features supported by both sides after receiving the ping of the
+ * peer. Peer of any version is accepted: everything added to the baseline
+ * encoding has its feature bit, so an older peer gets the encoding it knows
+ */
+void plcontainer_channel_negotiate(plcConn *conn, plcMsgPing *ping) {
+    conn->features       = PLC_FEATURES & ping->features;
+    conn->peerMaxMessage = ping->maxMessage;
+}
+
 /* Send-Receive for Primitive Datatypes */
 
 static int message_start(plcConn *conn, char msgType) {
@@ -207,7 +312,18 @@ static int send_cstring(plcConn *conn, char *s) {
     } else {
         int cnt = strlen(s);
 
+        if (cnt >= PLC_COMPRESS_MIN_SIZE && (conn->features & PLC_FEATURE_COMPRESSION)) {
+            res = send_compressed(conn, s, cnt);
+            if (res <= 0) {
+                return res;
+            }
+            res = 0;
+        }
         res |= send_int32(conn, cnt);
+        /* Terminating zero lets the peer use the string in its buffer */
+        if (conn->features & PLC_FEATURE_TEXT_NUL) {
+            cnt += 1;
+        }
         if (res == 0 && cnt > 0) {
             res = plcBufferAppend(conn, s, cnt);
         }
@@ -220,11 +336,121 @@ static int send_bytea(plcConn *conn, char *s) {
     int res = 0;
 
     debug_print(WARNING, "    ===> sending bytea of size '%d'", *((int*)s));
+    if (*((int*)s) >= PLC_COMPRESS_MIN_SIZE && (conn->features & PLC_FEATURE_COMPRESSION)) {
+        res = send_compressed(conn, s + 4, *((int*)s));
+        if (res <= 0) {
+            return res;
+        }
+        res = 0;
+    }
     res |= send_int32(conn, *((int*)s));
     res |= plcBufferAppend(conn, s + 4, *((int*)s));
     return res;
 }
 
+/*
+ * Text and bytea value is sent as PLC_COMPRESSED_LENGTH followed by the
+ * length of the value, the length of the compressed block and the block
+ * itself. Value that does not compress well is left to the caller to be sent
+ * as is
+ *
+ * Returns 0 on success, 1 if the value is not sent, -1 on failure
+ */
+static int send_compressed(plcConn *conn, char *s, int len) {
+    int res = 0;
+    int compLen;
+    char *comp;
+
+    comp = compress_value(s, len, &compLen);
+    if (comp == NULL) {
+        return 1;
+    }
+    res |= send_int32(conn, PLC_COMPRESSED_LENGTH);
+    res |= send_int32(conn, len);
+    res |= send_int32(conn, compLen);
+    res |= plcBufferAppend(conn, comp, compLen);
+    pfree(comp);
+    return res;
+}
+
+static int send_numeric(plcConn *conn, plcNumeric *num) {
+    int res = 0;
+
+    debug_print(WARNING, "    ===> sending numeric with %d digits", (int)num->ndigits);
+    res |= send_int16(conn, num->ndigits);
+    res |= send_int16(conn, num->weight);
+    res |= send_int16(conn, (short)num->sign);
+    res |= send_int16(conn, num->dscale);
+    if (num->ndigits > 0) {
+        res |= plcBufferAppend(conn, (char*)num->digits, num->ndigits * sizeof(unsigned short));
+    }
+    return res;
+}
+
+/*
+ * Peer without PLC_FEATURE_NUMERIC receives numeric as float8, the value is
+ * converted from its decimal digits like the text form would be
+ */
+static double numeric_to_float8(plcNumeric *num) {
+    char  *buf;
+    char  *p;
+    double res;
+    int    i;
+
+    if (num->sign == PLC_NUMERIC_NAN) {
+        return NAN;
+    }
+    buf = (char*)pmalloc(num->ndigits * 4 + 32);
+    p = buf + sprintf(buf, "%s0.", num->sign == PLC_NUMERIC_NEG ? "-" : "");
+    for (i = 0; i < num->ndigits; i++) {
+        p += sprintf(p, "%04u", (unsigned int)num->digits[i]);
+    }
+    sprintf(p, "0e%d", (num->weight + 1) * 4);
+    res = strtod(buf, NULL);
+    pfree(buf);
+    return res;
+}
+
+/* Type the value of the given type is sent as */
+static plcDatatype wire_type(plcConn *conn, plcDatatype type) {
+    if (type == PLC_DATA_NUMERIC && !(conn->features & PLC_FEATURE_NUMERIC)) {
+        return PLC_DATA_FLOAT8;
+    }
+    return type;
+}
+
+/*
+ * Returns the compressed copy of the value or NULL if compression saves less
+ * than 1/8 of its size. Compressor stops as soon as the output reaches that
+ * size, so incompressible values are rejected early
+ */
+static char *compress_value(char *data, int len, int *compLen) {
+    struct timeval start;
+    char *comp;
+    int cap = len - len / 8;
+
+    gettimeofday(&start, NULL);
+    comp = (char*)pmalloc(cap);
+    *compLen = plc_lz_compress(data, len, comp, cap);
+    plc_compression_stats.compressUsec += elapsed_usec(&start);
+    if (*compLen == 0) {
+        pfree(comp);
+        plc_compression_stats.skippedValues += 1;
+        return NULL;
+    }
+    plc_compression_stats.compressedValues += 1;
+    plc_compression_stats.compressedIn += len;
+    plc_compression_stats.compressedOut += *compLen;
+    return comp;
+}
+
+static long long elapsed_usec(struct timeval *start) {
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) * 1000000LL + (now.tv_usec - start->tv_usec);
+}
+
 static int send_raw_object(plcConn *conn, plcType *type, rawdata *obj) {
     int res = 0;
     if (obj->isnull) {
@@ -235,22 +461,22 @@ static int send_raw_object(plcConn *conn, plcType *type, rawdata *obj) {
         debug_print(WARNING, "Object type is '%s' and value is:", plc_get_type_name(type->type));
         switch (type->type) {
             case PLC_DATA_INT1:
-                res |= send_char(conn, *((char*)obj->value));
+                res |= send_char(conn, *((char*)plc_raw_value(obj)));
                 break;
             case PLC_DATA_INT2:
-                res |= send_int16(conn, *((short*)obj->value));
+                res |= send_int16(conn, *((short*)plc_raw_value(obj)));
                 break;
             case PLC_DATA_INT4:
-                res |= send_int32(conn, *((int*)obj->value));
+                res |= send_int32(conn, *((int*)plc_raw_value(obj)));
                 break;
             case PLC_DATA_INT8:
-                res |= send_int64(conn, *((long long*)obj->value));
+                res |= send_int64(conn, *((long long*)plc_raw_value(obj)));
                 break;
             case PLC_DATA_FLOAT4:
-                res |= send_float4(conn, *((float*)obj->value));
+                res |= send_float4(conn, *((float*)plc_raw_value(obj)));
                 break;
             case PLC_DATA_FLOAT8:
-                res |= send_float8(conn, *((double*)obj->value));
+                res |= send_float8(conn, *((double*)plc_raw_value(obj)));
                 break;
             case PLC_DATA_TEXT:
                 res |= send_cstring(conn, obj->value);
@@ -258,6 +484,13 @@ static int send_raw_object(plcConn *conn, plcType *type, rawdata *obj) {
             case PLC_DATA_BYTEA:
                 res |= send_bytea(conn, obj->value);
                 break;
+            case PLC_DATA_NUMERIC:
+                if (wire_type(conn, type->type) == PLC_DATA_FLOAT8) {
+                    res |= send_float8(conn, numeric_to_float8((plcNumeric*)obj->value));
+                } else {
+                    res |= send_numeric(conn, (plcNumeric*)obj->value);
+                }
+                break;
             case PLC_DATA_ARRAY:
                 res |= send_raw_array_iter(conn, &type->subTypes[0], (plcIterator*)obj->value);
                 break;
@@ -282,16 +515,21 @@ static int send_raw_array_iter(plcConn *conn, plcType *type, plcIterator *iter)
     for (i = 0; i < meta->ndims; i++) {
         res |= send_int32(conn, meta->dims[i]);
     }
-    for (i = 0; i < meta->size && res == 0; i++) {
-        rawdata* raw_object = iter->next(iter);
-        res |= send_raw_object(conn, type, raw_object);
-        if (!raw_object->isnull) {
-            if (type->type == PLC_DATA_UDT) {
-                plc_free_udt((plcUDT*)raw_object->value, type, true);
+    if (is_fixed_width_type(wire_type(conn, type->type))
+            && (conn->features & PLC_FEATURE_PACKED_ARRAYS)) {
+        res |= send_packed_array(conn, type, iter);
+    } else {
+        for (i = 0; i < meta->size && res == 0; i++) {
+            rawdata* raw_object = iter->next(iter);
+            res |= send_raw_object(conn, type, raw_object);
+            if (!raw_object->isnull && raw_object->value != NULL) {
+                if (type->type == PLC_DATA_UDT) {
+                    plc_free_udt((plcUDT*)raw_object->value, type, true);
+                }
+                pfree(raw_object->value);
             }
-            pfree(raw_object->value);
+            pfree(raw_object);
         }
-        pfree(raw_object);
     }
     if (iter->cleanup != NULL) {
     	iter->cleanup(iter);
@@ -299,13 +537,97 @@ static int send_raw_array_iter(plcConn *conn, plcType *type, plcIterator *iter)
     return res;
 }
 
+/*
+ * Arrays of fixed-width elements are sent as a single block of values if both
+ * sides support it. It is preceded by 'N' and a bitmap with bits set for NULL
+ * elements or by 'D' if the array has no NULLs
+ */
+static int send_packed_array(plcConn *conn, plcType *type, plcIterator *iter) {
+    int res = 0;
+    int i = 0;
+    int hasnulls = 0;
+    int entrylen = plc_get_type_length(wire_type(conn, type->type));
+    int bitmaplen;
+    char *bitmap;
+    char *data;
+    plcArrayMeta *meta = (plcArrayMeta*)iter->meta;
+
+    if (meta->size == 0) {
+        return 0;
+    }
+
+    /* Elements are already stored as a contiguous block without NULLs */
+    if (iter->packed != NULL) {
+        return send_packed_data(conn, iter->packed, meta->size * entrylen, NULL, 0);
+    }
+
+    bitmaplen = (meta->size + 7) / 8;
+    bitmap = (char*)pmalloc(bitmaplen);
+    data = (char*)pmalloc(meta->size * entrylen);
+    memset(bitmap, 0, bitmaplen);
+    memset(data, 0, meta->size * entrylen);
+    for (i = 0; i < meta->size; i++) {
+        rawdata* raw_object = iter->next(iter);
+        if (raw_object->isnull) {
+            bitmap[i / 8] |= 1 << (i % 8);
+            hasnulls = 1;
+        } else {
+            if (type->type == PLC_DATA_NUMERIC) {
+                double value = numeric_to_float8((plcNumeric*)raw_object->value);
+                memcpy(data + i * entrylen, &value, entrylen);
+            } else {
+                memcpy(data + i * entrylen, plc_raw_value(raw_object), entrylen);
+            }
+            if (raw_object->value != NULL) {
+                pfree(raw_object->value);
+            }
+        }
+        pfree(raw_object);
+    }
+
+    res |= send_packed_data(conn, data, meta->size * entrylen,
+                            hasnulls ? bitmap : NULL, bitmaplen);
+
+    pfree(bitmap);
+    pfree(data);
+    return res;
+}
+
+/*
+ * Block of the elements is compressed if both sides support it, the markers
+ * are then sent in lower case and the block is preceded by its length
+ */
+static int send_packed_data(plcConn *conn, char *data, int len, char *bitmap, int bitmaplen) {
+    int res = 0;
+    int compLen = 0;
+    char *comp = NULL;
+
+    if (len >= PLC_COMPRESS_MIN_SIZE && (conn->features & PLC_FEATURE_COMPRESSION)) {
+        comp = compress_value(data, len, &compLen);
+    }
+    if (bitmap != NULL) {
+        res |= send_char(conn, comp != NULL ? 'n' : 'N');
+        res |= plcBufferAppend(conn, bitmap, bitmaplen);
+    } else {
+        res |= send_char(conn, comp != NULL ? 'd' : 'D');
+    }
+    if (comp != NULL) {
+        res |= send_int32(conn, compLen);
+        res |= plcBufferAppend(conn, comp, compLen);
+        pfree(comp);
+    } else {
+        res |= plcBufferAppend(conn, data, len);
+    }
+    return res;
+}
+
 static int send_type(plcConn *conn, plcType *type) {
     int res = 0;
     int i = 0;
 
     debug_print(WARNING, "VVVVVVVVVVVVVVV");
     debug_print(WARNING, "    Type '%s' with name '%s'", plc_get_type_name(type->type), type->typeName);
-    res |= send_char(conn, (char)type->type);
+    res |= send_char(conn, (char)wire_type(conn, type->type));
     res |= send_cstring(conn, type->typeName);
     if (type->type == PLC_DATA_ARRAY || type->type == PLC_DATA_UDT) {
         res |= send_int16(conn, type->nSubTypes);
@@ -330,6 +652,10 @@ static int send_udt(plcConn *conn, plcType *type, plcUDT *udt) {
     return res;
 }
 
+static void *receive_alloc(plcConn *conn, size_t bytes) {
+    return plc_arena_alloc(conn->arena, bytes);
+}
+
 static int receive_message_type(plcConn *conn, char *c) {
     *c = '@';
     int res = plcBufferReceive(conn, 1);
@@ -396,9 +722,26 @@ static int receive_cstring(plcConn *conn, char **s) {
 
     if (cnt == -1) {
         *s = NULL;
+    } else if (cnt == PLC_COMPRESSED_LENGTH) {
+        if (receive_int32(conn, &cnt) < 0 || cnt < 0 || cnt > PLC_MAX_MESSAGE_SIZE) {
+            return -1;
+        }
+        *s  = receive_alloc(conn, cnt + 1);
+        res = receive_compressed(conn, *s, cnt);
+        (*s)[cnt] = 0;
+    } else if (cnt < 0 || cnt > PLC_MAX_MESSAGE_SIZE) {
+        return -1;
+    } else if ((conn->features & PLC_FEATURE_TEXT_NUL) && cnt + 1 < PLC_BUFFER_DIRECT_READ) {
+        /* String is referenced in the input buffer until the release */
+        res = plcBufferBorrow(conn, s, cnt + 1);
+        if (res == 0 && (*s)[cnt] != 0) {
+            return -1;
+        }
     } else {
-        *s   = pmalloc(cnt + 1);
-        if (cnt > 0) {
+        *s   = receive_alloc(conn, cnt + 1);
+        if (conn->features & PLC_FEATURE_TEXT_NUL) {
+            res = plcBufferRead(conn, *s, cnt + 1);
+        } else if (cnt > 0) {
             res = plcBufferRead(conn, *s, cnt);
         }
         (*s)[cnt] = 0;
@@ -412,15 +755,37 @@ static int receive_bytea(plcConn *conn, char **s) {
     int res = 0;
     int len = 0;
 
+    int compressed = 0;
+
+    /* Length followed by the data is the layout of the value, so it is
+     * referenced in the input buffer until the release */
+    if (plcBufferPeek(conn, (char*)&len, 4) < 0) {
+        return -1;
+    }
+    if (len >= 0 && len + 4 < PLC_BUFFER_DIRECT_READ) {
+        return plcBufferBorrow(conn, s, len + 4);
+    }
+
     if (receive_int32(conn, &len) < 0) {
         return -1;
     }
+    if (len == PLC_COMPRESSED_LENGTH) {
+        compressed = 1;
+        if (receive_int32(conn, &len) < 0) {
+            return -1;
+        }
+    }
+    if (len < 0 || len > PLC_MAX_MESSAGE_SIZE - 4) {
+        return -1;
+    }
 
-    *s = pmalloc(len + 4);
+    *s = receive_alloc(conn, len + 4);
     debug_print(WARNING, "    ===> receiving bytea of size '%d' at %p for %p", len, *s, s);
 
     *((int*)*s) = len;
-    if (len > 0) {
+    if (compressed) {
+        res = receive_compressed(conn, *s + 4, len);
+    } else if (len > 0) {
         res = plcBufferRead(conn, *s + 4, len);
     }
     debug_print(WARNING, "    ===> receiving bytea '%s'", strndup(*s + 4, len));
@@ -428,6 +793,73 @@ static int receive_bytea(plcConn *conn, char **s) {
     return res;
 }
 
+/*
+ * Receives the compressed block and decompresses it into the len bytes of
+ * dst, the block is checked to produce exactly that much data
+ */
+static int receive_compressed(plcConn *conn, char *dst, int len) {
+    struct timeval start;
+    int res = 0;
+    int compLen;
+    char *comp;
+
+    if (receive_int32(conn, &compLen) < 0 || compLen <= 0 || compLen > PLC_MAX_MESSAGE_SIZE) {
+        return -1;
+    }
+    comp = (char*)pmalloc(compLen);
+    res = plcBufferRead(conn, comp, compLen);
+    if (res == 0) {
+        gettimeofday(&start, NULL);
+        if (plc_lz_decompress(comp, compLen, dst, len) < 0) {
+            lprintf(LOG, "Received malformed compressed value");
+            res = -1;
+        }
+        plc_compression_stats.decompressUsec += elapsed_usec(&start);
+        plc_compression_stats.decompressedValues += 1;
+        plc_compression_stats.decompressedIn += compLen;
+        plc_compression_stats.decompressedOut += len;
+    }
+    pfree(comp);
+    return res;
+}
+
+static int receive_numeric(plcConn *conn, char **s) {
+    int res = 0;
+    int i;
+    short ndigits;
+    plcNumeric *num;
+
+    if (receive_int16(conn, &ndigits) < 0 || ndigits < 0) {
+        return -1;
+    }
+    num = (plcNumeric*)receive_alloc(conn, PLC_NUMERIC_SIZE(ndigits));
+    num->ndigits = ndigits;
+    res |= receive_int16(conn, &num->weight);
+    res |= receive_int16(conn, (short*)&num->sign);
+    res |= receive_int16(conn, &num->dscale);
+    if (res == 0 && ndigits > 0) {
+        res = receive_raw(conn, (char*)num->digits, ndigits * sizeof(unsigned short));
+    }
+    debug_print(WARNING, "    <=== receiving numeric with %d digits", (int)ndigits);
+
+    /* Both sides build the value from the digits without further checks */
+    if (num->sign != PLC_NUMERIC_POS && num->sign != PLC_NUMERIC_NEG
+            && num->sign != PLC_NUMERIC_NAN) {
+        res = -1;
+    }
+    if (num->dscale < 0) {
+        res = -1;
+    }
+    for (i = 0; i < ndigits && res == 0; i++) {
+        if (num->digits[i] >= PLC_NUMERIC_NBASE) {
+            res = -1;
+        }
+    }
+
+    *s = (char*)num;
+    return res;
+}
+
 static int receive_raw_object(plcConn *conn, plcType *type, rawdata *obj)  {
     int res = 0;
     char isn;
@@ -441,31 +873,26 @@ static int receive_raw_object(plcConn *conn, plcType *type, rawdata *obj)  {
         debug_print(WARNING, "Object is null");
     } else {
         obj->isnull = 0;
+        obj->value  = NULL;
         debug_print(WARNING, "Object value is:");
         switch (type->type) {
             case PLC_DATA_INT1:
-                obj->value = (char*)pmalloc(1);
-                res |= receive_char(conn, (char*)obj->value);
+                res |= receive_char(conn, &obj->inlined.int1);
                 break;
             case PLC_DATA_INT2:
-                obj->value = (char*)pmalloc(2);
-                res |= receive_int16(conn, (short*)obj->value);
+                res |= receive_int16(conn, &obj->inlined.int2);
                 break;
             case PLC_DATA_INT4:
-                obj->value = (char*)pmalloc(4);
-                res |= receive_int32(conn, (int*)obj->value);
+                res |= receive_int32(conn, &obj->inlined.int4);
                 break;
             case PLC_DATA_INT8:
-                obj->value = (char*)pmalloc(8);
-                res |= receive_int64(conn, (long long*)obj->value);
+                res |= receive_int64(conn, &obj->inlined.int8);
                 break;
             case PLC_DATA_FLOAT4:
-                obj->value = (char*)pmalloc(4);
-                res |= receive_float4(conn, (float*)obj->value);
+                res |= receive_float4(conn, &obj->inlined.float4);
                 break;
             case PLC_DATA_FLOAT8:
-                obj->value = (char*)pmalloc(8);
-                res |= receive_float8(conn, (double*)obj->value);
+                res |= receive_float8(conn, &obj->inlined.float8);
                 break;
             case PLC_DATA_TEXT:
                 res |= receive_cstring(conn, &obj->value);
@@ -473,6 +900,9 @@ static int receive_raw_object(plcConn *conn, plcType *type, rawdata *obj)  {
             case PLC_DATA_BYTEA:
                 res |= receive_bytea(conn, &obj->value);
                 break;
+            case PLC_DATA_NUMERIC:
+                res |= receive_numeric(conn, &obj->value);
+                break;
             case PLC_DATA_ARRAY:
                 res |= receive_array(conn, &type->subTypes[0], obj);
                 break;
@@ -497,7 +927,10 @@ static int receive_array(plcConn *conn, plcType *type, rawdata *obj) {
     plcArray *arr;
 
     res |= receive_int32(conn, &ndims);
-    arr = plc_alloc_array(ndims);
+    arr = receive_alloc(conn, sizeof(plcArray));
+    arr->meta = receive_alloc(conn, sizeof(plcArrayMeta));
+    arr->meta->ndims = ndims;
+    arr->meta->dims  = ndims > 0 ? receive_alloc(conn, ndims * sizeof(int)) : NULL;
     obj->value = (char*)arr;
     arr->meta->type = (plcDatatype)((int)type->type);
     arr->meta->size = ndims > 0 ? 1 : 0;
@@ -507,10 +940,15 @@ static int receive_array(plcConn *conn, plcType *type, rawdata *obj) {
     }
     if (arr->meta->size > 0) {
         entrylen = plc_get_type_length(arr->meta->type);
-        arr->nulls = (char*)pmalloc(arr->meta->size * 1);
-        arr->data = (char*)pmalloc(arr->meta->size * entrylen);
+        arr->nulls = (char*)receive_alloc(conn, arr->meta->size * 1);
+        arr->data = (char*)receive_alloc(conn, arr->meta->size * entrylen);
         memset(arr->data, 0, arr->meta->size * entrylen);
 
+        if (is_fixed_width_type(arr->meta->type)
+                && (conn->features & PLC_FEATURE_PACKED_ARRAYS)) {
+            return res | receive_packed_array(conn, arr, entrylen);
+        }
+
         for (i = 0; i < arr->meta->size && res == 0; i++) {
             res |= receive_char(conn, &isnull);
             if (isnull == 'N') {
@@ -532,6 +970,9 @@ static int receive_array(plcConn *conn, plcType *type, rawdata *obj) {
                     case PLC_DATA_BYTEA:
                         res |= receive_bytea(conn, &((char**)arr->data)[i]);
                         break;
+                    case PLC_DATA_NUMERIC:
+                        res |= receive_numeric(conn, &((char**)arr->data)[i]);
+                        break;
                     case PLC_DATA_UDT:
                         res |= receive_udt(conn, type, &((char**)arr->data)[i]);
                         break;
@@ -545,6 +986,33 @@ static int receive_array(plcConn *conn, plcType *type, rawdata *obj) {
     return res;
 }
 
+static int receive_packed_array(plcConn *conn, plcArray *arr, int entrylen) {
+    int res = 0;
+    int i = 0;
+    char hasnulls;
+    char *bitmap;
+    int bitmaplen;
+
+    res |= receive_char(conn, &hasnulls);
+    if (hasnulls == 'N' || hasnulls == 'n') {
+        bitmaplen = (arr->meta->size + 7) / 8;
+        bitmap = (char*)receive_alloc(conn, bitmaplen);
+        res |= receive_raw(conn, bitmap, bitmaplen);
+        for (i = 0; i < arr->meta->size; i++) {
+            arr->nulls[i] = (bitmap[i / 8] >> (i % 8)) & 1;
+        }
+    } else {
+        memset(arr->nulls, 0, arr->meta->size);
+    }
+    if (hasnulls == 'n' || hasnulls == 'd') {
+        res |= receive_compressed(conn, arr->data, arr->meta->size * entrylen);
+    } else {
+        res |= receive_raw(conn, arr->data, arr->meta->size * entrylen);
+    }
+
+    return res;
+}
+
 static int receive_type(plcConn *conn, plcType *type) {
     int res = 0;
     int i = 0;
@@ -559,7 +1027,7 @@ static int receive_type(plcConn *conn, plcType *type) {
     if (type->type == PLC_DATA_ARRAY || type->type == PLC_DATA_UDT) {
         res |= receive_int16(conn, &type->nSubTypes);
         if (type->nSubTypes > 0) {
-            type->subTypes = (plcType*)pmalloc(type->nSubTypes * sizeof(plcType));
+            type->subTypes = (plcType*)receive_alloc(conn, type->nSubTypes * sizeof(plcType));
             for (i = 0; i < type->nSubTypes && res == 0; i++)
                 res |= receive_type(conn, &type->subTypes[i]);
         }
@@ -579,7 +1047,8 @@ static int receive_udt(plcConn *conn, plcType *type, char **resdata) {
 
     debug_print(WARNING, "Receiving user-defined type with %d members", type->nSubTypes);
 
-    udt = plc_alloc_udt(type->nSubTypes);
+    udt = receive_alloc(conn, sizeof(plcUDT));
+    udt->data = receive_alloc(conn, type->nSubTypes * sizeof(rawdata));
     for (i = 0; i < type->nSubTypes && res == 0; i++) {
         res |= receive_raw_object(conn, &type->subTypes[i], &udt->data[i]);
     }
@@ -588,6 +1057,113 @@ static int receive_udt(plcConn *conn, plcType *type, char **resdata) {
     return res;
 }
 
+/* Functions registered over the connection */
+
+static int is_fixed_width_type(plcDatatype type) {
+    switch (type) {
+        case PLC_DATA_INT1:
+        case PLC_DATA_INT2:
+        case PLC_DATA_INT4:
+        case PLC_DATA_INT8:
+        case PLC_DATA_FLOAT4:
+        case PLC_DATA_FLOAT8:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static plcProcHandle *find_proc_handle(plcConn *conn, unsigned int objectid) {
+    plcProcHandle *handle;
+
+    for (handle = conn->procs; handle != NULL; handle = handle->next) {
+        if (handle->objectid == objectid) {
+            return handle;
+        }
+    }
+    return NULL;
+}
+
+static plcProcHandle *add_proc_handle(plcConn *conn, unsigned int objectid) {
+    plcProcHandle *handle;
+
+    /* Handle lives as long as the connection does */
+    handle = (plcProcHandle*)plc_top_alloc(sizeof(plcProcHandle));
+    handle->objectid = objectid;
+    handle->version  = 0;
+    handle->def      = NULL;
+    handle->next     = conn->procs;
+    conn->procs      = handle;
+    return handle;
+}
+
+static char *copy_string(plcArena *arena, char *src) {
+    char *dst = NULL;
+
+    if (src != NULL) {
+        size_t len = strlen(src);
+        dst = plc_arena_alloc(arena, len + 1);
+        memcpy(dst, src, len + 1);
+    }
+    return dst;
+}
+
+static void copy_type(plcArena *arena, plcType *dst, plcType *src) {
+    int i;
+
+    dst->type      = src->type;
+    dst->nSubTypes = src->nSubTypes;
+    dst->typeName  = copy_string(arena, src->typeName);
+    dst->subTypes  = NULL;
+    if (src->nSubTypes > 0) {
+        dst->subTypes = (plcType*)plc_arena_alloc(arena, src->nSubTypes * sizeof(plcType));
+        for (i = 0; i < src->nSubTypes; i++)
+            copy_type(arena, &dst->subTypes[i], &src->subTypes[i]);
+    }
+}
+
+/*
+ * Copy the call request without argument values into the arena, which is
+ * owned by the copy. Call requests are received only by the client
+ */
+static plcMsgCallreq *copy_call_header(plcArena *arena, plcMsgCallreq *src) {
+    int            i;
+    plcMsgCallreq *req;
+
+    req             = plc_arena_alloc(arena, sizeof(plcMsgCallreq));
+    req->msgtype    = MT_CALLREQ;
+    req->arena      = arena;
+    req->objectid   = src->objectid;
+    req->version    = src->version;
+    req->seq        = src->seq;
+    req->hasChanged = 0;
+    req->proc.name  = copy_string(arena, src->proc.name);
+    req->proc.src   = copy_string(arena, src->proc.src);
+    req->retset     = src->retset;
+    req->nargs      = src->nargs;
+    req->def        = NULL;
+    copy_type(arena, &req->retType, &src->retType);
+    req->args = plc_arena_alloc(arena, sizeof(*req->args) * (src->nargs + 1));
+    for (i = 0; i < src->nargs; i++) {
+        req->args[i].name = copy_string(arena, src->args[i].name);
+        copy_type(arena, &req->args[i].type, &src->args[i].type);
+        req->args[i].data.isnull = 1;
+        req->args[i].data.value  = NULL;
+    }
+    return req;
+}
+
+/* Definition of the registered function referenced only by its handle */
+static plcProcDef *copy_proc_def(plcMsgCallreq *src) {
+    plcArena   *arena = plc_arena_create();
+    plcProcDef *def;
+
+    def       = plc_arena_alloc(arena, sizeof(plcProcDef));
+    def->call = copy_call_header(arena, src);
+    def->refs = 1;
+    return def;
+}
+
 /* Send Functions for the Main Engine */
 
 static int send_argument(plcConn *conn, plcArgument *arg) {
@@ -600,24 +1176,31 @@ static int send_argument(plcConn *conn, plcArgument *arg) {
     return res;
 }
 
-static int send_ping(plcConn *conn) {
-    int res = 0;
-    char *ping = "ping";
+/*
+ * Version, features and message size limit of this side and the timings
+ * follow the "ping" word in the same string, as the older peers check only
+ * the word itself: "ping/<version>:<features>:<max message>[ <timings>]"
+ */
+static int send_ping(plcConn *conn, plcMsgPing *mping) {
+    int   res = 0;
+    char *ping;
 
     debug_print(WARNING, "Sending ping message");
+    ping = pmalloc(40 + (mping->timings != NULL ? strlen(mping->timings) : 0));
+    sprintf(ping, "ping/%u:%x:%u%s%s", PLC_PROTOCOL_VERSION, PLC_FEATURES,
+            PLC_MAX_MESSAGE_SIZE, mping->timings != NULL ? " " : "",
+            mping->timings != NULL ? mping->timings : "");
     res |= message_start(conn, MT_PING);
     res |= send_cstring(conn, ping);
     res |= message_end(conn);
+    pfree(ping);
     debug_print(WARNING, "Finished ping message");
     return res;
 }
 
-static int send_call(plcConn *conn, plcMsgCallreq *call) {
+static int send_call_header(plcConn *conn, plcMsgCallreq *call) {
     int res = 0;
-    int i;
 
-    debug_print(WARNING, "Sending call request for function '%s'", call->proc.name);
-    res |= message_start(conn, MT_CALLREQ);
     res |= send_cstring(conn, call->proc.name);
     debug_print(WARNING, "Function source code:");
     debug_print(WARNING, "%s", call->proc.src);
@@ -632,21 +1215,98 @@ static int send_call(plcConn *conn, plcMsgCallreq *call) {
     res |= send_int32(conn, call->retset);
     debug_print(WARNING, "Function number of arguments is '%d'", call->nargs);
     res |= send_int32(conn, call->nargs);
+    return res;
+}
+
+/*
+ * Function definition is sent only once per connection and function version,
+ * after that the call carries only the function OID and argument values.
+ * Peer without PLC_FEATURE_PROC_HANDLES receives the definition every time
+ */
+static int send_call(plcConn *conn, plcMsgCallreq *call) {
+    int res = 0;
+    int i;
+    int compact = 0;
+    plcProcHandle *handle = NULL;
 
-    for (i = 0; i < call->nargs; i++)
-        res |= send_argument(conn, &call->args[i]);
+    debug_print(WARNING, "Sending call request for function '%s'", call->proc.name);
+    res |= message_start(conn, MT_CALLREQ);
+
+    if (conn->features & PLC_FEATURE_PROC_HANDLES) {
+        handle  = find_proc_handle(conn, call->objectid);
+        compact = handle != NULL && handle->version == call->version && !call->hasChanged;
+        res |= send_char(conn, compact ? 'H' : 'F');
+    }
+    if (conn->features & PLC_FEATURE_CALL_SEQ) {
+        res |= send_uint32(conn, call->seq);
+    }
+    if (compact) {
+        debug_print(WARNING, "Function '%u' is registered, sending handle", call->objectid);
+        res |= send_uint32(conn, call->objectid);
+        res |= send_int32(conn, call->nargs);
+        for (i = 0; i < call->nargs; i++)
+            res |= send_raw_object(conn, &call->args[i].type, &call->args[i].data);
+    } else {
+        res |= send_call_header(conn, call);
+        for (i = 0; i < call->nargs; i++)
+            res |= send_argument(conn, &call->args[i]);
+    }
 
     res |= message_end(conn);
+
+    /* Peer knows the definition only if the whole message has been sent */
+    if (res == 0 && !compact && (conn->features & PLC_FEATURE_PROC_HANDLES)) {
+        if (handle == NULL) {
+            handle = add_proc_handle(conn, call->objectid);
+        }
+        handle->version = call->version;
+    }
     debug_print(WARNING, "Finished call request for function '%s'", call->proc.name);
     return res;
 }
 
+/*
+ * Batch call sends the call header and the names and types of the arguments
+ * once, followed by the argument values for each of the rows
+ */
+static int send_call_batch(plcConn *conn, plcMsgCallreqBatch *batch) {
+    int res = 0;
+    int i, j;
+    plcMsgCallreq *call = &batch->call;
+
+    debug_print(WARNING, "Sending batch of %d calls for function '%s'", batch->nrows, call->proc.name);
+    res |= message_start(conn, MT_CALLREQ_BATCH);
+    if (conn->features & PLC_FEATURE_CALL_SEQ) {
+        res |= send_uint32(conn, call->seq);
+    }
+    if (conn->features & PLC_FEATURE_PIPELINE) {
+        res |= send_char(conn, batch->ahead ? 1 : 0);
+    }
+    res |= send_call_header(conn, call);
+
+    for (i = 0; i < call->nargs; i++) {
+        res |= send_cstring(conn, call->args[i].name);
+        res |= send_type(conn, &call->args[i].type);
+    }
+
+    res |= send_int32(conn, batch->nrows);
+    for (i = 0; i < batch->nrows && res == 0; i++)
+        for (j = 0; j < call->nargs; j++) {
+            debug_print(WARNING, "Sending row %d argument %d", i, j);
+            res |= send_raw_object(conn, &call->args[j].type, &batch->rows[i][j]);
+        }
+
+    res |= message_end(conn);
+    debug_print(WARNING, "Finished batch call request for function '%s'", call->proc.name);
+    return res;
+}
+
 static int send_result(plcConn *conn, plcMsgResult *ret) {
     int res = 0;
     int i, j;
     plcMsgError *msg = NULL;
 
-    res |= message_start(conn, MT_RESULT);
+    res |= message_start(conn, ret->msgtype);
     debug_print(WARNING, "Sending result of %d rows and %d columns", ret->rows, ret->cols);
     res |= send_int32(conn, ret->rows);
     res |= send_int32(conn, ret->cols);
@@ -684,6 +1344,18 @@ static int send_result(plcConn *conn, plcMsgResult *ret) {
     return res;
 }
 
+static int send_result_next(plcConn *conn, plcMsgResultNext *next) {
+    int res = 0;
+
+    res |= message_start(conn, MT_RESULT_NEXT);
+    res |= send_int32(conn, next->cancel);
+    if (conn->features & PLC_FEATURE_CALL_SEQ) {
+        res |= send_uint32(conn, next->seq);
+    }
+    res |= message_end(conn);
+    return res;
+}
+
 static int send_log(plcConn *conn, plcMsgLog *mlog) {
     int res = 0;
 
@@ -726,7 +1398,7 @@ static int receive_exception(plcConn *conn, plcMessage **mExc) {
     int res = 0;
     plcMsgError *ret;
 
-    *mExc = pmalloc(sizeof(plcMsgError));
+    *mExc = receive_alloc(conn, sizeof(plcMsgError));
     ret = (plcMsgError*) *mExc;
     ret->msgtype = MT_EXCEPTION;
     res |= receive_cstring(conn, &ret->message);
@@ -735,15 +1407,15 @@ static int receive_exception(plcConn *conn, plcMessage **mExc) {
     return res;
 }
 
-static int receive_result(plcConn *conn, plcMessage **mRes) {
+static int receive_result(plcConn *conn, plcMessage **mRes, char msgType) {
     int  i, j;
     int  res = 0;
     char exc;
     plcMsgResult *ret;
 
-    *mRes = pmalloc(sizeof(plcMsgResult));
+    *mRes = receive_alloc(conn, sizeof(plcMsgResult));
     ret = (plcMsgResult*) *mRes;
-    ret->msgtype = MT_RESULT;
+    ret->msgtype = msgType;
     res |= receive_int32(conn, &ret->rows);
     res |= receive_int32(conn, &ret->cols);
     debug_print(WARNING, "Receiving function result of %d rows and %d columns",
@@ -751,7 +1423,7 @@ static int receive_result(plcConn *conn, plcMessage **mRes) {
 
     if (res == 0) {
         if (ret->rows > 0) {
-            ret->data = pmalloc((ret->rows) * sizeof(rawdata*));
+            ret->data = receive_alloc(conn, (ret->rows) * sizeof(rawdata*));
         } else {
             ret->data  = NULL;
             ret->types = NULL;
@@ -759,8 +1431,8 @@ static int receive_result(plcConn *conn, plcMessage **mRes) {
 
         /* Read column names and column types of result set */
         debug_print(WARNING, "Receiving types and names of %d columns", ret->cols);
-        ret->types = pmalloc(ret->cols * sizeof(plcType));
-        ret->names = pmalloc(ret->cols * sizeof(*ret->names));
+        ret->types = receive_alloc(conn, ret->cols * sizeof(plcType));
+        ret->names = receive_alloc(conn, ret->cols * sizeof(*ret->names));
         for (i = 0; i < ret->cols; i++) {
              res |= receive_type(conn, &ret->types[i]);
              res |= receive_cstring(conn, &ret->names[i]);
@@ -770,7 +1442,7 @@ static int receive_result(plcConn *conn, plcMessage **mRes) {
         /* Receive data */
         for (i = 0; i < ret->rows && res == 0; i++) {
             if (ret->cols > 0) {
-                ret->data[i] = pmalloc((ret->cols) * sizeof(*ret->data[i]));
+                ret->data[i] = receive_alloc(conn, (ret->cols) * sizeof(*ret->data[i]));
                 for (j = 0; j < ret->cols; j++) {
                     debug_print(WARNING, "Receiving row %d column %d", i, j);
                     res |= receive_raw_object(conn, &ret->types[j], &ret->data[i][j]);
@@ -781,22 +1453,37 @@ static int receive_result(plcConn *conn, plcMessage **mRes) {
         }
     }
 
+    /* The result received so far is released together with the exception */
     res |= receive_char(conn, &exc);
     if (exc == MT_EXCEPTION) {
         res |= receive_exception(conn, mRes);
-        free_result(ret, false);
     }
 
     debug_print(WARNING, "Finished receiving function result");
     return res;
 }
 
+static int receive_result_next(plcConn *conn, plcMessage **mNext) {
+    int res = 0;
+    plcMsgResultNext *ret;
+
+    *mNext = receive_alloc(conn, sizeof(plcMsgResultNext));
+    ret = (plcMsgResultNext*) *mNext;
+    ret->msgtype = MT_RESULT_NEXT;
+    res |= receive_int32(conn, &ret->cancel);
+    ret->seq = 0;
+    if (conn->features & PLC_FEATURE_CALL_SEQ) {
+        res |= receive_uint32(conn, &ret->seq);
+    }
+    return res;
+}
+
 static int receive_log(plcConn *conn, plcMessage **mLog) {
     int res = 0;
     plcMsgLog *ret;
 
     debug_print(WARNING, "Receiving log message from client");
-    *mLog = pmalloc(sizeof(plcMsgLog));
+    *mLog = receive_alloc(conn, sizeof(plcMsgLog));
     ret   = (plcMsgLog*) *mLog;
     ret->msgtype = MT_LOG;
     res |= receive_int32(conn, &ret->level);
@@ -810,7 +1497,7 @@ static int receive_sql_statement(plcConn *conn, plcMessage **mStmt) {
     int res = 0;
     plcMsgSQL *ret;
 
-    *mStmt       = pmalloc(sizeof(plcMsgSQL));
+    *mStmt       = receive_alloc(conn, sizeof(plcMsgSQL));
     ret          = (plcMsgSQL*) *mStmt;
     ret->msgtype = MT_SQL;
     ret->sqltype = SQL_TYPE_STATEMENT;
@@ -829,11 +1516,17 @@ static int receive_argument(plcConn *conn, plcArgument *arg) {
 }
 
 static int receive_ping(plcConn *conn, plcMessage **mPing) {
-    int   res = 0;
-    char *ping;
-
-    *mPing = (plcMessage*)pmalloc(sizeof(plcMsgPing));
-    ((plcMsgPing*)*mPing)->msgtype = MT_PING;
+    int         res = 0;
+    char       *ping;
+    plcMsgPing *mping;
+
+    mping = (plcMsgPing*)receive_alloc(conn, sizeof(plcMsgPing));
+    mping->msgtype    = MT_PING;
+    mping->version    = 0;
+    mping->features   = 0;
+    mping->maxMessage = PLC_MAX_MESSAGE_SIZE;
+    mping->timings    = NULL;
+    *mPing = (plcMessage*)mping;
 
     debug_print(WARNING, "Receiving ping message");
     res |= receive_cstring(conn, &ping);
@@ -841,22 +1534,27 @@ static int receive_ping(plcConn *conn, plcMessage **mPing) {
         if (strncmp(ping, "ping", 4) != 0) {
             debug_print(WARNING, "Ping message receive failed");
             res = -1;
+        } else {
+            char *rest = ping + 4;
+            int   len = 0;
+
+            if (*rest == '/' && sscanf(rest, "/%u:%x:%u%n", &mping->version,
+                        &mping->features, &mping->maxMessage, &len) == 3) {
+                rest += len;
+            }
+            if (*rest == ' ') {
+                mping->timings = rest + 1;
+            }
         }
-        pfree(ping);
     }
 
     debug_print(WARNING, "Finished receiving ping message");
     return res;
 }
 
-static int receive_call(plcConn *conn, plcMessage **mCall) {
+static int receive_call_header(plcConn *conn, plcMsgCallreq *req) {
     int res = 0;
-    int i;
-    plcMsgCallreq *req;
 
-    *mCall         = pmalloc(sizeof(plcMsgCallreq));
-    req            = (plcMsgCallreq*) *mCall;
-    req->msgtype   = MT_CALLREQ;
     res |= receive_cstring(conn, &req->proc.name);
     debug_print(WARNING, "Receiving call request for function '%s'", req->proc.name);
     res |= receive_cstring(conn, &req->proc.src);
@@ -866,21 +1564,143 @@ static int receive_call(plcConn *conn, plcMessage **mCall) {
     debug_print(WARNING, "Function OID is '%u'", req->objectid);
     res |= receive_int32(conn, &req->hasChanged);
     debug_print(WARNING, "Function has changed is '%d'", req->hasChanged);
+    /* Function version is tracked only by the sender */
+    req->version = 0;
     res |= receive_type(conn, &req->retType);
     debug_print(WARNING, "Function return type is '%s'", plc_get_type_name(req->retType.type));
     res |= receive_int32(conn, &req->retset);
     debug_print(WARNING, "Function is set-returning: %d", (int)req->retset);
     res |= receive_int32(conn, &req->nargs);
     debug_print(WARNING, "Function number of arguments is '%d'", req->nargs);
+    return res;
+}
+
+static int receive_call(plcConn *conn, plcMessage **mCall) {
+    int            res = 0;
+    int            i;
+    char           form = 'F';
+    unsigned int   seq = 0;
+    unsigned int   objectid;
+    int            nargs;
+    plcMsgCallreq *req;
+    plcMsgCallreq *def;
+    plcProcHandle *handle;
+
+    if (conn->features & PLC_FEATURE_PROC_HANDLES) {
+        res |= receive_char(conn, &form);
+    }
+    if (conn->features & PLC_FEATURE_CALL_SEQ) {
+        res |= receive_uint32(conn, &seq);
+    }
+    if (res == 0 && form == 'H') {
+        /* Compact call, the definition is taken from the registered function */
+        res |= receive_uint32(conn, &objectid);
+        handle = find_proc_handle(conn, objectid);
+        if (handle == NULL) {
+            lprintf(ERROR, "Received call of unregistered function '%u'", objectid);
+            return -1;
+        }
+        def = handle->def->call;
+        res |= receive_int32(conn, &nargs);
+        if (res == 0 && nargs != def->nargs) {
+            lprintf(ERROR, "Function '%u' is registered with %d arguments, received %d",
+                           objectid, def->nargs, nargs);
+            return -1;
+        }
+
+        /* Definition is referenced, only the argument values are received */
+        *mCall = receive_alloc(conn, sizeof(plcMsgCallreq));
+        req    = (plcMsgCallreq*) *mCall;
+        *req   = *def;
+        req->seq  = seq;
+        req->def  = handle->def;
+        req->args = receive_alloc(conn, sizeof(*req->args) * (nargs + 1));
+        for (i = 0; i < nargs && res == 0; i++) {
+            req->args[i] = def->args[i];
+            res |= receive_raw_object(conn, &req->args[i].type, &req->args[i].data);
+        }
+        return res;
+    }
+
+    *mCall         = receive_alloc(conn, sizeof(plcMsgCallreq));
+    req            = (plcMsgCallreq*) *mCall;
+    req->msgtype   = MT_CALLREQ;
+    req->seq       = seq;
+    req->def       = NULL;
+    res |= receive_call_header(conn, req);
     if (res == 0) {
-        req->args = pmalloc(sizeof(*req->args) * req->nargs);
+        req->args = receive_alloc(conn, sizeof(*req->args) * req->nargs);
         for (i = 0; i < req->nargs && res == 0; i++)
             res |= receive_argument(conn, &req->args[i]);
     }
+
+    /* Remember the function definition for the subsequent compact calls.
+     * Calls being processed may still reference the previous definition,
+     * it is freed when the last of them is released */
+    if (res == 0 && (conn->features & PLC_FEATURE_PROC_HANDLES)) {
+        handle = find_proc_handle(conn, req->objectid);
+        if (handle == NULL) {
+            handle = add_proc_handle(conn, req->objectid);
+        } else {
+            release_proc_def(handle->def);
+        }
+        handle->def = copy_proc_def(req);
+    }
     debug_print(WARNING, "Finished call request for function '%s'", req->proc.name);
     return res;
 }
 
+static int receive_call_batch(plcConn *conn, plcMessage **mCall) {
+    int res = 0;
+    int i, j;
+    plcMsgCallreqBatch *batch;
+    plcMsgCallreq      *req;
+
+    *mCall         = receive_alloc(conn, sizeof(plcMsgCallreqBatch));
+    batch          = (plcMsgCallreqBatch*) *mCall;
+    req            = &batch->call;
+    req->msgtype   = MT_CALLREQ_BATCH;
+    req->seq       = 0;
+    batch->ahead   = 0;
+    batch->nrows   = 0;
+    batch->rows    = NULL;
+    if (conn->features & PLC_FEATURE_CALL_SEQ) {
+        res |= receive_uint32(conn, &req->seq);
+    }
+    if (conn->features & PLC_FEATURE_PIPELINE) {
+        char ahead = 0;
+        res |= receive_char(conn, &ahead);
+        batch->ahead = ahead;
+    }
+    res |= receive_call_header(conn, req);
+    if (res == 0) {
+        /* Argument values are kept in the rows, header arguments stay empty */
+        req->args = receive_alloc(conn, sizeof(*req->args) * req->nargs);
+        for (i = 0; i < req->nargs && res == 0; i++) {
+            res |= receive_cstring(conn, &req->args[i].name);
+            res |= receive_type(conn, &req->args[i].type);
+            req->args[i].data.isnull = 1;
+            req->args[i].data.value  = NULL;
+        }
+        res |= receive_int32(conn, &batch->nrows);
+        debug_print(WARNING, "Receiving batch of %d calls", batch->nrows);
+    }
+    if (res == 0 && batch->nrows > 0) {
+        batch->rows = receive_alloc(conn, batch->nrows * sizeof(rawdata*));
+        memset(batch->rows, 0, batch->nrows * sizeof(rawdata*));
+        for (i = 0; i < batch->nrows && res == 0; i++) {
+            batch->rows[i] = receive_alloc(conn, (req->nargs + 1) * sizeof(rawdata));
+            memset(batch->rows[i], 0, (req->nargs + 1) * sizeof(rawdata));
+            for (j = 0; j < req->nargs; j++) {
+                debug_print(WARNING, "Receiving row %d argument %d", i, j);
+                res |= receive_raw_object(conn, &req->args[j].type, &batch->rows[i][j]);
+            }
+        }
+    }
+    debug_print(WARNING, "Finished batch call request for function '%s'", req->proc.name);
+    return res;
+}
+
 static int receive_sql(plcConn *conn, plcMessage **mSql) {
     int res = 0;
     int sqlType;
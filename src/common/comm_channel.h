@@ -40,7 +40,24 @@ interpreted as representing official policies, either expressed or implied, of t
     #define debug_print(...)
 #endif
 
+/* Values compressed and decompressed by the process, sizes are in bytes */
+typedef struct plcCompressionStats {
+    long long compressedValues;   // values sent compressed
+    long long skippedValues;      // values not compressed well enough
+    long long compressedIn;
+    long long compressedOut;
+    long long compressUsec;       // spent compressing, including skipped values
+    long long decompressedValues;
+    long long decompressedIn;
+    long long decompressedOut;
+    long long decompressUsec;
+} plcCompressionStats;
+
+extern plcCompressionStats plc_compression_stats;
+
 int plcontainer_channel_send(plcConn *conn, plcMessage *msg);
 int plcontainer_channel_receive(plcConn *conn, plcMessage **msg);
+void plcontainer_channel_release(plcMessage *msg);
+void plcontainer_channel_negotiate(plcConn *conn, plcMsgPing *ping);
 
 #endif /* PLC_COMM_CHANNEL_H */
@@ -14,18 +14,32 @@
 #include <stdio.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
 #include "comm_utils.h"
 #include "comm_connectivity.h"
+#include "comm_shm.h"
+#include "messages/messages.h"
+
+/* Messages are framed once both sides have agreed on it in the ping */
+#define plcIsFramed(conn) (((conn)->features & PLC_FEATURE_FRAMING) != 0)
 
 static ssize_t plcSocketRecv(plcConn *conn, void *ptr, size_t len);
 static ssize_t plcSocketSend(plcConn *conn, const void *ptr, size_t len);
 static int plcBufferMaybeFlush (plcConn *conn, bool isForse);
 static int plcBufferMaybeReset (plcConn *conn, int bufType);
 static int plcBufferMaybeResize (plcConn *conn, int bufType, size_t bufAppend);
+static int plcBufferReadDirect (plcConn *conn, char *resBuffer, size_t nBytes);
+static int plcBufferAppendDirect (plcConn *conn, char *srcBuffer, size_t nBytes);
+static void plcBufferCloseFrame (plcConn *conn, bool isLast);
+static int plcBufferNextFrame (plcConn *conn);
+static int plcBufferFill (plcConn *conn, size_t nBytes);
+static void plcBufferFreeData (plcBuffer *buf);
 
 /*
  *  Read data from the socket
@@ -33,6 +47,11 @@ static int plcBufferMaybeResize (plcConn *conn, int bufType, size_t bufAppend);
 static ssize_t plcSocketRecv(plcConn *conn, void *ptr, size_t len) {
     ssize_t sz = 0;
 
+    /* With shared memory the socket is used only for wakeups */
+    if (conn->shm != NULL) {
+        return plcShmRecv(conn, ptr, len);
+    }
+
     while (sz <= 0) {
         sz = recv(conn->sock, ptr, len, 0);
 
@@ -54,7 +73,13 @@ static ssize_t plcSocketRecv(plcConn *conn, void *ptr, size_t len) {
  *  Write data to the socket
  */
 static ssize_t plcSocketSend(plcConn *conn, const void *ptr, size_t len) {
-    ssize_t sz = send(conn->sock, ptr, len, 0);
+    ssize_t sz;
+
+    if (conn->shm != NULL) {
+        return plcShmSend(conn, ptr, len);
+    }
+
+    sz = send(conn->sock, ptr, len, 0);
 
     /* If receive command is terminated by SIGINT */
     if (sz < 0 && errno == EINTR) {
@@ -82,6 +107,9 @@ static int plcBufferMaybeFlush (plcConn *conn, bool isForse) {
     if (buf->bufSize - buf->pEnd < PLC_BUFFER_MIN_FREE
             || buf->pEnd - buf->pStart > PLC_BUFFER_SIZE
             || isForse) {
+        // Message continues in the next frame unless it has been ended
+        plcBufferCloseFrame(conn, false);
+
         // Flushing the data into channel
         while (buf->pStart < buf->pEnd) {
             int sent = 0;
@@ -117,6 +145,12 @@ static int plcBufferMaybeFlush (plcConn *conn, bool isForse) {
 static int plcBufferMaybeReset (plcConn *conn, int bufType) {
     plcBuffer *buf = conn->buffer[bufType];
 
+    // Data referenced by the messages stays in place, the buffer moves on to
+    // a new block when it runs out of space
+    if (buf->pin != NULL && buf->pin->refs > 0) {
+        return 0;
+    }
+
     // If the buffer has no data we can reset both pointers to 0
     if (buf->pStart == buf->pEnd) {
         buf->pStart = 0;
@@ -189,7 +223,7 @@ static int plcBufferMaybeResize (plcConn *conn, int bufType, size_t bufAppend) {
         memcpy(newBuffer,
                buf->data + buf->pStart,
                (size_t)(buf->pEnd - buf->pStart));
-        pfree(buf->data);
+        plcBufferFreeData(buf);
         buf->data = newBuffer;
         buf->pEnd = buf->pEnd - buf->pStart;
         buf->pStart = 0;
@@ -210,8 +244,13 @@ int plcBufferAppend (plcConn *conn, char *srcBuffer, size_t nBytes) {
     int res = 0;
     plcBuffer *buf = conn->buffer[PLC_OUTPUT_BUFFER];
 
-    // If we don't have enough space in the buffer to hold the data
-    if (buf->bufSize - buf->pEnd < (int)nBytes) {
+    if (nBytes >= PLC_BUFFER_DIRECT_WRITE) {
+        return plcBufferAppendDirect(conn, srcBuffer, nBytes);
+    }
+
+    // If we don't have enough space in the buffer to hold the data and the
+    // header of the new frame
+    if (buf->bufSize - buf->pEnd < (int)nBytes + PLC_FRAME_HEADER_SIZE) {
 
         // First thing to check - whether we can reset the data to the beginning
         // of the buffer, freeing up some space in the end of it
@@ -227,11 +266,17 @@ int plcBufferAppend (plcConn *conn, char *srcBuffer, size_t nBytes) {
         // Third check - whether we need to resize our buffer after these manipulations
         res = plcBufferMaybeResize(conn,
                                    PLC_OUTPUT_BUFFER,
-                                   nBytes);
+                                   nBytes + PLC_FRAME_HEADER_SIZE);
         if (res < 0)
             return res;
     }
 
+    // Header of the new frame is written when the frame is closed
+    if (buf->frameStart < 0 && plcIsFramed(conn)) {
+        buf->frameStart = buf->pEnd;
+        buf->pEnd += PLC_FRAME_HEADER_SIZE;
+    }
+
     // Appending data to the buffer
     memcpy(buf->data + buf->pEnd, srcBuffer, nBytes);
     buf->pEnd = buf->pEnd + nBytes;
@@ -239,6 +284,106 @@ int plcBufferAppend (plcConn *conn, char *srcBuffer, size_t nBytes) {
     return 0;
 }
 
+/*
+ * Large values are sent right away together with the buffered data in a
+ * single writev call, so they are neither copied to the output buffer nor
+ * make it grow. The source memory is referenced only during the call, as
+ * the senders free the values as soon as they are appended. Shared memory
+ * ring is filled by copying anyway, so there the value follows the buffer.
+ * Value is sent as a frame of its own, its header ends the buffered data
+ *
+ * Returns 0 on success, -1 if failed
+ */
+static int plcBufferAppendDirect (plcConn *conn, char *srcBuffer, size_t nBytes) {
+    plcBuffer    *buf = conn->buffer[PLC_OUTPUT_BUFFER];
+    struct iovec  iov[2];
+    struct iovec *first = iov;
+    int           iovcnt = 0;
+    unsigned int  header = (unsigned int)nBytes;
+
+    if (plcIsFramed(conn)) {
+        plcBufferCloseFrame(conn, false);
+        if (plcBufferMaybeResize(conn, PLC_OUTPUT_BUFFER, PLC_FRAME_HEADER_SIZE) < 0) {
+            return -1;
+        }
+        memcpy(buf->data + buf->pEnd, &header, PLC_FRAME_HEADER_SIZE);
+        buf->pEnd += PLC_FRAME_HEADER_SIZE;
+    }
+
+    if (conn->shm != NULL) {
+        size_t nSent = 0;
+
+        if (plcBufferMaybeFlush(conn, true) < 0) {
+            return -1;
+        }
+        while (nSent < nBytes) {
+            ssize_t sent = plcSocketSend(conn, srcBuffer + nSent, nBytes - nSent);
+            if (sent <= 0) {
+                lprintf(LOG, "plcBufferAppend: Shared memory write failed, send "
+                             "return code is %d", (int)sent);
+                return -1;
+            }
+            nSent += (size_t)sent;
+        }
+        return 0;
+    }
+
+    if (buf->pEnd > buf->pStart) {
+        iov[iovcnt].iov_base = buf->data + buf->pStart;
+        iov[iovcnt].iov_len  = (size_t)(buf->pEnd - buf->pStart);
+        iovcnt++;
+    }
+    iov[iovcnt].iov_base = srcBuffer;
+    iov[iovcnt].iov_len  = nBytes;
+    iovcnt++;
+
+    while (iovcnt > 0) {
+        ssize_t sent = writev(conn->sock, first, iovcnt);
+
+        if (sent < 0 && errno == EINTR) {
+            lprintf(ERROR, "Query and PL/Container connections are terminated by user request");
+        }
+        if (sent <= 0) {
+            lprintf(LOG, "plcBufferAppend: Socket write failed, writev "
+                         "return code is %d, error message is '%s'",
+                         (int)sent, strerror(errno));
+            return -1;
+        }
+
+        // Skip the vectors sent completely and move into the partial one
+        while (iovcnt > 0 && (size_t)sent >= first->iov_len) {
+            sent -= (ssize_t)first->iov_len;
+            first++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            first->iov_base = (char*)first->iov_base + sent;
+            first->iov_len -= (size_t)sent;
+        }
+    }
+
+    buf->pStart = 0;
+    buf->pEnd   = 0;
+    return 0;
+}
+
+/*
+ * Writes the header of the frame being filled, if there is one
+ */
+static void plcBufferCloseFrame (plcConn *conn, bool isLast) {
+    plcBuffer    *buf = conn->buffer[PLC_OUTPUT_BUFFER];
+    unsigned int  header;
+
+    if (buf->frameStart >= 0) {
+        header = (unsigned int)(buf->pEnd - buf->frameStart - PLC_FRAME_HEADER_SIZE);
+        if (isLast) {
+            header |= PLC_FRAME_LAST;
+        }
+        memcpy(buf->data + buf->frameStart, &header, PLC_FRAME_HEADER_SIZE);
+        buf->frameStart = -1;
+    }
+}
+
 /*
  * Read some data from the buffer. If buffer does not have enough data in it,
  * it will ask the socket to receive more data and put it into the buffer
@@ -249,10 +394,15 @@ int plcBufferRead (plcConn *conn, char *resBuffer, size_t nBytes) {
     plcBuffer *buf = conn->buffer[PLC_INPUT_BUFFER];
     int res = 0;
 
+    if (nBytes >= PLC_BUFFER_DIRECT_READ) {
+        return plcBufferReadDirect(conn, resBuffer, nBytes);
+    }
+
     res = plcBufferReceive (conn, nBytes);
     if (res == 0) {
         memcpy(resBuffer, buf->data + buf->pStart, nBytes);
         buf->pStart = buf->pStart + nBytes;
+        buf->frameLeft -= (int)nBytes;
     } else {
         lprintf(LOG, "plcBufferRead: Socket read failed, "
                      "received return code is %d, error message is '%s'",
@@ -262,13 +412,261 @@ int plcBufferRead (plcConn *conn, char *resBuffer, size_t nBytes) {
     return res;
 }
 
+/*
+ * Copies nBytes of the message without consuming them
+ *
+ * Returns 0 on success, -1 if failed
+ */
+int plcBufferPeek (plcConn *conn, char *resBuffer, size_t nBytes) {
+    plcBuffer *buf = conn->buffer[PLC_INPUT_BUFFER];
+
+    if (plcBufferReceive(conn, nBytes) < 0) {
+        return -1;
+    }
+    memcpy(resBuffer, buf->data + buf->pStart, nBytes);
+    return 0;
+}
+
+/*
+ * References nBytes of the message in the input buffer instead of copying
+ * them out. Data block of the buffer is pinned for the message being received
+ * and stays until plcBufferUnpin, the buffer moves on to a new block when it
+ * needs the space. Message references a single block, so the data following
+ * the move within the same message is copied into its arena
+ *
+ * Returns 0 on success, -1 if failed
+ */
+int plcBufferBorrow (plcConn *conn, char **resBuffer, size_t nBytes) {
+    plcBuffer *buf = conn->buffer[PLC_INPUT_BUFFER];
+
+    if (plcBufferReceive(conn, nBytes) < 0) {
+        lprintf(LOG, "plcBufferBorrow: Socket read failed, error message is '%s'",
+                     strerror(errno));
+        return -1;
+    }
+
+    if (conn->pin != NULL && conn->pin != buf->pin) {
+        *resBuffer = plc_arena_alloc(conn->arena, nBytes);
+        memcpy(*resBuffer, buf->data + buf->pStart, nBytes);
+    } else {
+        if (conn->pin == NULL) {
+            if (buf->pin == NULL) {
+                buf->pin = (plcBufferPin*)plc_top_alloc(sizeof(plcBufferPin));
+                buf->pin->data    = buf->data;
+                buf->pin->refs    = 0;
+                buf->pin->retired = 0;
+            }
+            buf->pin->refs += 1;
+            conn->pin = buf->pin;
+        }
+        *resBuffer = buf->data + buf->pStart;
+    }
+    buf->pStart += (int)nBytes;
+    buf->frameLeft -= (int)nBytes;
+    return 0;
+}
+
+/*
+ * Drops the reference of the released message, the block the buffer has
+ * moved away from is freed with the last one
+ */
+void plcBufferUnpin (plcBufferPin *pin) {
+    if (pin != NULL) {
+        pin->refs -= 1;
+        if (pin->refs == 0 && pin->retired) {
+            pfree(pin->data);
+            pfree(pin);
+        }
+    }
+}
+
+/*
+ * Buffer is done with its data block. Block referenced by the messages is
+ * left to them
+ */
+static void plcBufferFreeData (plcBuffer *buf) {
+    if (buf->pin != NULL && buf->pin->refs > 0) {
+        buf->pin->retired = 1;
+    } else {
+        if (buf->pin != NULL) {
+            pfree(buf->pin);
+        }
+        pfree(buf->data);
+    }
+    buf->pin  = NULL;
+    buf->data = NULL;
+}
+
+/*
+ * Large values bypass the input buffer: what is already buffered is copied
+ * and the rest is received right into the memory of the message they belong
+ * to, so the input buffer does not have to grow to hold them. Values are not
+ * referenced in place, the converters still copy them into the final Datum or
+ * Python object
+ *
+ * Returns 0 on success, -1 if failed
+ */
+static int plcBufferReadDirect (plcConn *conn, char *resBuffer, size_t nBytes) {
+    plcBuffer *buf = conn->buffer[PLC_INPUT_BUFFER];
+    size_t     nRead = 0;
+
+    while (nRead < nBytes) {
+        size_t nFrame;
+        size_t nBuffered;
+
+        // Value might continue in the following frame
+        if (plcIsFramed(conn) && buf->frameLeft == 0) {
+            if (buf->frameLast) {
+                lprintf(LOG, "plcBufferRead: Message is shorter than expected");
+                return -1;
+            }
+            if (plcBufferNextFrame(conn) < 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        nFrame = nBytes - nRead;
+        if (plcIsFramed(conn) && nFrame > (size_t)buf->frameLeft) {
+            nFrame = (size_t)buf->frameLeft;
+        }
+
+        // Data already in the buffer goes first
+        nBuffered = (size_t)(buf->pEnd - buf->pStart);
+        if (nBuffered > nFrame) {
+            nBuffered = nFrame;
+        }
+        memcpy(resBuffer + nRead, buf->data + buf->pStart, nBuffered);
+        buf->pStart += (int)nBuffered;
+        buf->frameLeft -= (int)nBuffered;
+        nRead += nBuffered;
+        nFrame -= nBuffered;
+
+        // The rest of the frame is read without touching the buffer
+        while (nFrame > 0) {
+            ssize_t recBytes = plcSocketRecv(conn, resBuffer + nRead, nFrame);
+            if (recBytes <= 0) {
+                lprintf(LOG, "plcBufferRead: Socket read failed, "
+                             "received return code is %d, error message is '%s'",
+                             (int)recBytes, strerror(errno));
+                return -1;
+            }
+            buf->frameLeft -= (int)recBytes;
+            nRead += (size_t)recBytes;
+            nFrame -= (size_t)recBytes;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Function checks whether we have nBytes bytes of the message in the buffer,
+ * reading the following frames of the message if the current one is shorter
+ *
+ * Returns 0 on success, -1 if failed
+ */
+int plcBufferReceive (plcConn *conn, size_t nBytes) {
+    int res = 0;
+    plcBuffer *buf = conn->buffer[PLC_INPUT_BUFFER];
+
+    while (plcIsFramed(conn) && buf->frameLeft < (int)nBytes && res == 0) {
+        if (buf->frameLast) {
+            lprintf(LOG, "plcBufferReceive: Message is shorter than expected");
+            return -1;
+        }
+        res = plcBufferNextFrame(conn);
+    }
+
+    if (res == 0) {
+        res = plcBufferFill(conn, nBytes);
+    }
+    return res;
+}
+
+/*
+ * Reads the header of the frame following the current one, the rest of the
+ * current frame is received first. Header is removed from the buffer, so the
+ * data of both frames is contiguous. Frames smaller than the direct read
+ * size are received completely, so they are decoded without further reads
+ *
+ * Returns 0 on success, -1 if failed
+ */
+static int plcBufferNextFrame (plcConn *conn) {
+    plcBuffer    *buf = conn->buffer[PLC_INPUT_BUFFER];
+    unsigned int  header;
+    char         *pHeader;
+    int           res;
+
+    res = plcBufferFill(conn, buf->frameLeft + PLC_FRAME_HEADER_SIZE);
+    if (res < 0)
+        return res;
+
+    pHeader = buf->data + buf->pStart + buf->frameLeft;
+    memcpy(&header, pHeader, PLC_FRAME_HEADER_SIZE);
+    if (buf->frameLeft == 0) {
+        buf->pStart += PLC_FRAME_HEADER_SIZE;
+    } else {
+        memmove(pHeader, pHeader + PLC_FRAME_HEADER_SIZE,
+                buf->pEnd - (pHeader - buf->data) - PLC_FRAME_HEADER_SIZE);
+        buf->pEnd -= PLC_FRAME_HEADER_SIZE;
+    }
+
+    buf->frameLast = (header & PLC_FRAME_LAST) != 0;
+    header &= ~PLC_FRAME_LAST;
+    if (header > PLC_MAX_MESSAGE_SIZE) {
+        lprintf(LOG, "plcBufferReceive: Frame of %u bytes is too large", header);
+        return -1;
+    }
+    buf->frameLeft += (int)header;
+
+    if (header < PLC_BUFFER_DIRECT_READ) {
+        res = plcBufferFill(conn, buf->frameLeft);
+    }
+    return res;
+}
+
+/*
+ * Skips the rest of the message being read, including the fields added by
+ * the newer peers, so the next read starts the following message
+ *
+ * Returns 0 on success, -1 if failed
+ */
+int plcBufferSkipMessage (plcConn *conn) {
+    plcBuffer *buf = conn->buffer[PLC_INPUT_BUFFER];
+    int        res = 0;
+
+    while (plcIsFramed(conn) && (buf->frameLeft > 0 || !buf->frameLast)) {
+        int nSkip;
+
+        if (buf->frameLeft == 0) {
+            res = plcBufferNextFrame(conn);
+        } else if (buf->pEnd == buf->pStart) {
+            res = plcBufferFill(conn, 1);
+        }
+        if (res < 0)
+            return res;
+
+        nSkip = buf->pEnd - buf->pStart;
+        if (nSkip > buf->frameLeft) {
+            nSkip = buf->frameLeft;
+        }
+        buf->pStart += nSkip;
+        buf->frameLeft -= nSkip;
+    }
+
+    buf->frameLeft = 0;
+    buf->frameLast = 0;
+    return 0;
+}
+
 /*
  * Function checks whether we have nBytes bytes in the buffer. If not, it reads
  * the data from the socket. If the buffer is too small, it would be grown
  *
- * Returns 0 on success, -1 if failed and -2 if socket read has returned no data
+ * Returns 0 on success, -1 if failed
  */
-int plcBufferReceive (plcConn *conn, size_t nBytes) {
+static int plcBufferFill (plcConn *conn, size_t nBytes) {
     int res = 0;
     plcBuffer *buf = conn->buffer[PLC_INPUT_BUFFER];
 
@@ -307,11 +705,22 @@ int plcBufferReceive (plcConn *conn, size_t nBytes) {
 }
 
 /*
- * Function forcefully flushes the buffer
+ * Function ends the message and forcefully flushes the buffer. Message ending
+ * with a large value sent directly gets the empty last frame
  *
  * Returns 0 on success, -1 if failed
  */
 int plcBufferFlush (plcConn *conn) {
+    plcBuffer *buf = conn->buffer[PLC_OUTPUT_BUFFER];
+
+    if (buf->frameStart < 0 && plcIsFramed(conn)) {
+        if (plcBufferMaybeResize(conn, PLC_OUTPUT_BUFFER, PLC_FRAME_HEADER_SIZE) < 0) {
+            return -1;
+        }
+        buf->frameStart = buf->pEnd;
+        buf->pEnd += PLC_FRAME_HEADER_SIZE;
+    }
+    plcBufferCloseFrame(conn, true);
     return plcBufferMaybeFlush(conn, true);
 }
 
@@ -335,9 +744,24 @@ plcConn * plcConnInit(int sock) {
     conn->buffer[PLC_OUTPUT_BUFFER]->bufSize = PLC_BUFFER_SIZE;
     conn->buffer[PLC_OUTPUT_BUFFER]->pStart = 0;
     conn->buffer[PLC_OUTPUT_BUFFER]->pEnd = 0;
+    conn->buffer[PLC_INPUT_BUFFER]->frameStart = -1;
+    conn->buffer[PLC_INPUT_BUFFER]->frameLeft = 0;
+    conn->buffer[PLC_INPUT_BUFFER]->frameLast = 0;
+    conn->buffer[PLC_OUTPUT_BUFFER]->frameStart = -1;
+    conn->buffer[PLC_OUTPUT_BUFFER]->frameLeft = 0;
+    conn->buffer[PLC_OUTPUT_BUFFER]->frameLast = 0;
+    conn->buffer[PLC_INPUT_BUFFER]->pin = NULL;
+    conn->buffer[PLC_OUTPUT_BUFFER]->pin = NULL;
 
     // Initializing control parameters
     conn->sock = sock;
+    conn->procs = NULL;
+    conn->arena = NULL;
+    conn->pin = NULL;
+    conn->seq = 0;
+    conn->features = 0;
+    conn->peerMaxMessage = PLC_MAX_MESSAGE_SIZE;
+    conn->shm = NULL;
 
     return conn;
 }
@@ -374,6 +798,48 @@ plcConn *plcConnect(int port) {
         char ipAddr[INET_ADDRSTRLEN];
         inet_ntop(AF_INET, &(raddr.sin_addr), ipAddr, INET_ADDRSTRLEN);
         lprintf(DEBUG1, "PLContainer: Failed to connect to %s", ipAddr);
+        close(sock);
+        return result;
+    }
+
+    /* Set socker receive timeout to 500ms */
+    tv.tv_sec  = 0;
+    tv.tv_usec = 500000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(struct timeval));
+
+    result = plcConnInit(sock);
+
+    return result;
+}
+
+/*
+ *  Connect to the Unix domain socket of the container and initialize the
+ *  plcConn data structure
+ */
+plcConn *plcConnectUnix(const char *path) {
+    struct sockaddr_un  raddr; /** Remote address */
+    plcConn            *result = NULL;
+    struct timeval      tv;
+    int                 sock;
+
+    if (strlen(path) >= sizeof(raddr.sun_path)) {
+        lprintf(ERROR, "PLContainer: Socket path '%s' is too long", path);
+        return result;
+    }
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        lprintf(ERROR, "PLContainer: Cannot create socket");
+        return result;
+    }
+
+    memset(&raddr, 0, sizeof(raddr));
+    raddr.sun_family = AF_UNIX;
+    strcpy(raddr.sun_path, path);
+    if (connect(sock, (const struct sockaddr *)&raddr,
+            sizeof(struct sockaddr_un)) < 0) {
+        lprintf(DEBUG1, "PLContainer: Failed to connect to %s", path);
+        close(sock);
         return result;
     }
 
@@ -393,10 +859,13 @@ plcConn *plcConnect(int port) {
 void plcDisconnect(plcConn *conn) {
     if (conn != NULL) {
         close(conn->sock);
-        pfree(conn->buffer[PLC_INPUT_BUFFER]->data);
-        pfree(conn->buffer[PLC_OUTPUT_BUFFER]->data);
+        plcBufferUnpin(conn->pin);
+        plcBufferFreeData(conn->buffer[PLC_INPUT_BUFFER]);
+        plcBufferFreeData(conn->buffer[PLC_OUTPUT_BUFFER]);
         pfree(conn->buffer[PLC_INPUT_BUFFER]);
         pfree(conn->buffer[PLC_OUTPUT_BUFFER]);
+        free_proc_handles(conn->procs);
+        plcShmDetach(conn->shm);
         pfree(conn);
     }
     return;
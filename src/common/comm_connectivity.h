@@ -10,30 +10,96 @@
 
 #include <stddef.h>
 
+#include "comm_utils.h"
+
 #define PLC_BUFFER_SIZE 8192
 #define PLC_BUFFER_MIN_FREE 200
+/* Reads of this size and larger bypass the input buffer, see plcBufferRead */
+#define PLC_BUFFER_DIRECT_READ (PLC_BUFFER_SIZE / 2)
+/* Values of this size and larger are sent without copying to the output buffer */
+#define PLC_BUFFER_DIRECT_WRITE (PLC_BUFFER_SIZE / 2)
+/* Largest message accepted, values are limited by the backend allocations */
+#define PLC_MAX_MESSAGE_SIZE 0x3fffffff
+/*
+ * Messages are sent in frames, each starting with the header holding the
+ * length of the frame data, the last frame of the message has PLC_FRAME_LAST
+ * bit set in it. Message fitting into the output buffer is a single frame,
+ * larger ones are split at the buffer flushes and around the large values
+ */
+#define PLC_FRAME_HEADER_SIZE 4
+#define PLC_FRAME_LAST 0x80000000U
 #define PLC_INPUT_BUFFER 0
 #define PLC_OUTPUT_BUFFER 1
 
+/* Unix domain socket transport: directory inside of the container that is
+ * bind-mounted from the host, name of the socket file in it and environment
+ * variable telling the client to listen on the socket file instead of TCP */
+#define PLC_UDS_CONTAINER_DIR "/tmp/plcontainer"
+#define PLC_UDS_SOCKET_NAME "plcontainer.sock"
+#define PLC_TRANSPORT_ENV "PLC_TRANSPORT"
+
+/* Environment variable overriding the time client waits for the connection,
+ * containers started in advance for the pool wait much longer */
+#define PLC_CONNECT_TIMEOUT_ENV "PLC_CONNECT_TIMEOUT"
+
+/* Environment variable telling the client to fork a child per connection */
+#define PLC_ZYGOTE_ENV "PLC_ZYGOTE"
+
+/* Environment variable with comma-separated modules imported on startup */
+#define PLC_PRELOAD_ENV "PLC_PRELOAD"
+
+/* Environment variable with the number of functions cached by the client */
+#define PLC_FUNCTION_CACHE_SIZE_ENV "PLC_FUNCTION_CACHE_SIZE"
+
+/* Environment variable with the directory keeping compiled code of the
+ * functions, shared by the containers of the same role and database */
+#define PLC_CODE_CACHE_ENV "PLC_CODE_CACHE"
+
+/* Environment variable with the key code cache files are signed with */
+#define PLC_CODE_CACHE_KEY_ENV "PLC_CODE_CACHE_KEY"
+
+/* Data block of the input buffer referenced by the received messages */
+typedef struct plcBufferPin {
+    char *data;     // data block, freed with the last reference once retired
+    int   refs;     // messages referencing the block
+    int   retired;  // buffer has moved on to another block
+} plcBufferPin;
+
 typedef struct plcBuffer {
     char *data;
     int   pStart;
     int   pEnd;
     int   bufSize;
+    int   frameStart; // output: header offset of the frame being filled, -1 if none
+    int   frameLeft;  // input: data of the current frame not read yet
+    int   frameLast;  // input: current frame ends the message
+    plcBufferPin *pin; // input: pin of the data block, NULL if not referenced yet
 } plcBuffer;
 
 typedef struct plcConn {
     int sock;
     plcBuffer* buffer[2];
+    struct plcProcHandle *procs; // functions registered over the connection
+    struct plcShm *shm;          // shared memory rings, NULL if not used
+    plcArena *arena;             // arena of the message being received
+    plcBufferPin *pin;           // block referenced by the message being received
+    unsigned int seq;            // sequence number of the last call sent
+    unsigned int features;       // features supported by both sides
+    unsigned int peerMaxMessage; // largest message the peer accepts
 } plcConn;
 
 plcConn * plcConnect(int port);
+plcConn * plcConnectUnix(const char *path);
 plcConn * plcConnInit(int sock);
 void plcDisconnect(plcConn *conn);
 
 int plcBufferAppend (plcConn *conn, char *prt, size_t len);
 int plcBufferRead (plcConn *conn, char *resBuffer, size_t len);
+int plcBufferPeek (plcConn *conn, char *resBuffer, size_t len);
+int plcBufferBorrow (plcConn *conn, char **resBuffer, size_t len);
+void plcBufferUnpin (plcBufferPin *pin);
 int plcBufferReceive (plcConn *conn, size_t nBytes);
 int plcBufferFlush (plcConn *conn);
+int plcBufferSkipMessage (plcConn *conn);
 
 #endif /* PLC_COMM_CONNECTIVITY_H */
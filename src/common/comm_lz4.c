@@ -0,0 +1,223 @@
+/*------------------------------------------------------------------------------
+ *
+ *
+ * Copyright (c) 2016, Pivotal.
+ *
+ *------------------------------------------------------------------------------
+ */
+#include <string.h>
+
+#include "comm_lz4.h"
+
+/*
+ * Block is a sequence of the literal runs each followed by a match. Sequence
+ * starts with the token holding the literal length in the high 4 bits and the
+ * match length minus LZ_MIN_MATCH in the low 4 bits, the value of 15 is
+ * continued in the following bytes until the one less than 255. Literals go
+ * next, then the 2-byte little endian offset of the match and the extension
+ * of the match length. The last sequence has literals only, the last
+ * LZ_LAST_LITERALS bytes are always literals and no match starts within the
+ * last LZ_MF_LIMIT bytes, as the format requires
+ */
+
+#define LZ_MIN_MATCH     4
+#define LZ_LAST_LITERALS 5
+#define LZ_MF_LIMIT      12
+#define LZ_MAX_OFFSET    65535
+#define LZ_HASH_LOG      12
+#define LZ_RUN_MASK      15
+
+static unsigned int lz_read32(const char *p);
+static unsigned int lz_hash(unsigned int v);
+static char *lz_put_length(char *op, int len);
+static int lz_get_length(const unsigned char **ip, const unsigned char *iend, int *len);
+
+static unsigned int lz_read32(const char *p) {
+    unsigned int v;
+
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static unsigned int lz_hash(unsigned int v) {
+    return (v * 2654435761U) >> (32 - LZ_HASH_LOG);
+}
+
+static char *lz_put_length(char *op, int len) {
+    while (len >= 255) {
+        *op++ = (char)255;
+        len  -= 255;
+    }
+    *op++ = (char)len;
+    return op;
+}
+
+static int lz_get_length(const unsigned char **ip, const unsigned char *iend, int *len) {
+    unsigned char b;
+
+    do {
+        if (*ip >= iend || *len > 0x3fffffff) {
+            return -1;
+        }
+        b     = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+/*
+ * Greedy compressor: the hash table keeps the last position of each 4-byte
+ * sequence, match found there is extended in both directions
+ */
+int plc_lz_compress(const char *src, int srcLen, char *dst, int dstCap) {
+    int         table[1 << LZ_HASH_LOG];
+    const char *ip         = src;
+    const char *anchor     = src;
+    const char *iend       = src + srcLen;
+    const char *mflimit    = iend - LZ_MF_LIMIT;
+    const char *matchlimit = iend - LZ_LAST_LITERALS;
+    char       *op         = dst;
+    char       *oend       = dst + dstCap;
+    char       *token;
+    int         litLen;
+    int         i;
+
+    for (i = 0; i < (1 << LZ_HASH_LOG); i++) {
+        table[i] = -1;
+    }
+
+    while (srcLen > LZ_MF_LIMIT && ip <= mflimit) {
+        unsigned int seq = lz_read32(ip);
+        unsigned int h   = lz_hash(seq);
+        const char  *match;
+        int          ref = table[h];
+        int          len;
+        int          offset;
+
+        table[h] = ip - src;
+        if (ref < 0 || (ip - src) - ref > LZ_MAX_OFFSET || lz_read32(src + ref) != seq) {
+            ip++;
+            continue;
+        }
+
+        match = src + ref;
+        while (ip > anchor && match > src && ip[-1] == match[-1]) {
+            ip--;
+            match--;
+        }
+        len = LZ_MIN_MATCH;
+        while (ip + len < matchlimit && ip[len] == match[len]) {
+            len++;
+        }
+
+        litLen = ip - anchor;
+        if (oend - op < 1 + litLen / 255 + 1 + litLen + 2 + len / 255 + 1) {
+            return 0;
+        }
+        token = op++;
+        if (litLen >= LZ_RUN_MASK) {
+            *token = (char)(LZ_RUN_MASK << 4);
+            op     = lz_put_length(op, litLen - LZ_RUN_MASK);
+        } else {
+            *token = (char)(litLen << 4);
+        }
+        memcpy(op, anchor, litLen);
+        op += litLen;
+
+        offset = ip - match;
+        *op++  = (char)(offset & 0xff);
+        *op++  = (char)(offset >> 8);
+        len   -= LZ_MIN_MATCH;
+        if (len >= LZ_RUN_MASK) {
+            *token |= LZ_RUN_MASK;
+            op      = lz_put_length(op, len - LZ_RUN_MASK);
+        } else {
+            *token |= (char)len;
+        }
+
+        ip    += len + LZ_MIN_MATCH;
+        anchor = ip;
+        /* Position inside of the match helps to find the next one */
+        if (ip <= mflimit) {
+            table[lz_hash(lz_read32(ip - 2))] = ip - 2 - src;
+        }
+    }
+
+    litLen = iend - anchor;
+    if (oend - op < 1 + litLen / 255 + 1 + litLen) {
+        return 0;
+    }
+    token = op++;
+    if (litLen >= LZ_RUN_MASK) {
+        *token = (char)(LZ_RUN_MASK << 4);
+        op     = lz_put_length(op, litLen - LZ_RUN_MASK);
+    } else {
+        *token = (char)(litLen << 4);
+    }
+    memcpy(op, anchor, litLen);
+    op += litLen;
+
+    return op - dst;
+}
+
+/*
+ * Block comes from the peer, so every length and offset is checked against
+ * the bounds of both buffers
+ */
+int plc_lz_decompress(const char *src, int srcLen, char *dst, int dstLen) {
+    const unsigned char *ip   = (const unsigned char *)src;
+    const unsigned char *iend = ip + srcLen;
+    char                *op   = dst;
+    char                *oend = dst + dstLen;
+
+    while (ip < iend) {
+        unsigned char token = *ip++;
+        const char   *match;
+        int           len;
+        int           offset;
+
+        len = token >> 4;
+        if (len == LZ_RUN_MASK && lz_get_length(&ip, iend, &len) < 0) {
+            return -1;
+        }
+        if (len > iend - ip || len > oend - op) {
+            return -1;
+        }
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        offset = ip[0] | (ip[1] << 8);
+        ip    += 2;
+        if (offset == 0 || offset > op - dst) {
+            return -1;
+        }
+        len = token & LZ_RUN_MASK;
+        if (len == LZ_RUN_MASK && lz_get_length(&ip, iend, &len) < 0) {
+            return -1;
+        }
+        len += LZ_MIN_MATCH;
+        if (len > oend - op) {
+            return -1;
+        }
+
+        match = op - offset;
+        if (offset >= len) {
+            memcpy(op, match, len);
+            op += len;
+        } else {
+            /* Overlapping match repeats the last offset bytes */
+            while (len-- > 0) {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return op == oend ? 0 : -1;
+}
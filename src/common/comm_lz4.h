@@ -0,0 +1,26 @@
+/*------------------------------------------------------------------------------
+ *
+ *
+ * Copyright (c) 2016, Pivotal.
+ *
+ *------------------------------------------------------------------------------
+ */
+#ifndef PLC_COMM_LZ4_H
+#define PLC_COMM_LZ4_H
+
+/*
+ * Compressor of the LZ4 block format, kept in the tree so both the backend
+ * and the clients build it without external libraries. Blocks are not framed
+ * and carry no checksum, the caller keeps the length of the original data
+ */
+
+/* Largest compressed size of the data of the given length */
+#define PLC_LZ_BOUND(len) ((len) + (len) / 255 + 16)
+
+/* Returns the compressed size or 0 if it does not fit into dst */
+int plc_lz_compress(const char *src, int srcLen, char *dst, int dstCap);
+
+/* Returns 0 if the block decompressed into exactly dstLen bytes, -1 otherwise */
+int plc_lz_decompress(const char *src, int srcLen, char *dst, int dstLen);
+
+#endif /* PLC_COMM_LZ4_H */
@@ -83,6 +83,24 @@ void free_callreq(plcMsgCallreq *req, bool isShared, bool isSender) {
     pfree(req);
 }
 
+void free_proc_handles(plcProcHandle *handle) {
+    while (handle != NULL) {
+        plcProcHandle *next = handle->next;
+        if (handle->def != NULL) {
+            release_proc_def(handle->def);
+        }
+        pfree(handle);
+        handle = next;
+    }
+}
+
+void release_proc_def(plcProcDef *def) {
+    if (--def->refs == 0) {
+        /* The definition itself is allocated in the arena */
+        plc_arena_delete(def->call->arena);
+    }
+}
+
 void free_result(plcMsgResult *res, bool isSender) {
     int i, j;
 
@@ -155,7 +173,8 @@ plcArray *plc_alloc_array(int ndims) {
 void plc_free_array(plcArray *arr, plcType *type, bool isSender) {
     int i;
     if (arr != NULL) {
-        if (arr->meta->type == PLC_DATA_TEXT || arr->meta->type == PLC_DATA_BYTEA) {
+        if (arr->meta->type == PLC_DATA_TEXT || arr->meta->type == PLC_DATA_BYTEA
+                || arr->meta->type == PLC_DATA_NUMERIC) {
             for (i = 0; i < arr->meta->size; i++) {
                 if ( ((char**)arr->data)[i] != NULL ) {
                     pfree(((char**)arr->data)[i]);
@@ -195,7 +214,8 @@ void plc_free_udt(plcUDT *udt, plcType *type, bool isSender) {
     int i;
 
     for (i = 0; i < type->nSubTypes; i++) {
-        if (!udt->data[i].isnull) {
+        /* Scalars are stored inline */
+        if (!udt->data[i].isnull && udt->data[i].value != NULL) {
             if (!isSender && type->subTypes[i].type == PLC_DATA_ARRAY) {
                 plc_free_array((plcArray*)udt->data[i].value, &type->subTypes[i], isSender);
             } else {
@@ -231,6 +251,7 @@ int plc_get_type_length(plcDatatype dt) {
         case PLC_DATA_TEXT:
         case PLC_DATA_UDT:
         case PLC_DATA_BYTEA:
+        case PLC_DATA_NUMERIC:
             /* 8 = the size of pointer */
             res = 8;
             break;
@@ -250,6 +271,7 @@ const char *plc_get_type_name(plcDatatype dt) {
                             "PLC_DATA_ARRAY",
                             "PLC_DATA_UDT",
                             "PLC_DATA_BYTEA",
+                            "PLC_DATA_NUMERIC",
                             "PLC_DATA_INVALID"};
-    return (dt >= 0 && dt <= 10) ? types[dt] : "UNKNOWN";
+    return (dt >= 0 && dt <= 11) ? types[dt] : "UNKNOWN";
 }
\ No newline at end of file
@@ -6,23 +6,65 @@
  *------------------------------------------------------------------------------
  */
 #include <errno.h>
+#include <stdio.h>
 #include <netinet/ip.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <unistd.h>
 
 #include "comm_channel.h"
 #include "comm_utils.h"
 #include "comm_connectivity.h"
 #include "comm_server.h"
+#include "comm_shm.h"
 #include "messages/messages.h"
 
+static int start_listener_unix(void);
+static int wait_for_connection(int sock, int timeoutsec);
+static int get_connect_timeout(void);
+static plcConn* connection_setup(int connection);
+
+static char           startup_timings[PLC_STARTUP_TIMINGS_LEN];
+static struct timeval startup_last;
+
+/*
+ * Records the time spent on the startup stage since the previous mark. The
+ * breakdown is sent to the backend in the ping reply. The first call with
+ * NULL stage marks the start of the process
+ */
+void startup_timing_mark(const char *stage) {
+    struct timeval now;
+    size_t         len = strlen(startup_timings);
+
+    gettimeofday(&now, NULL);
+    if (stage != NULL && startup_last.tv_sec != 0) {
+        snprintf(startup_timings + len, sizeof(startup_timings) - len, "%s%s=%.1fms",
+                 len > 0 ? " " : "", stage,
+                 (now.tv_sec - startup_last.tv_sec) * 1000.0
+                    + (now.tv_usec - startup_last.tv_usec) / 1000.0);
+    }
+    startup_last = now;
+}
+
 /*
  * Functoin binds the socket and starts listening on it
  */
 int start_listener() {
     struct sockaddr_in addr;
     int                sock;
+    char              *transport;
+
+    /* Backend asks to use the socket file in the shared directory */
+    transport = getenv(PLC_TRANSPORT_ENV);
+    if (transport != NULL &&
+            (strcmp(transport, "unix") == 0 || strcmp(transport, "shm") == 0)) {
+        return start_listener_unix();
+    }
 
     sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock == -1) {
@@ -51,35 +93,130 @@ int start_listener() {
 }
 
 /*
- * Fuction waits for the socket to accept connection for finite amount of time
- * and errors out when the timeout is reached and no client connected
+ * Function binds the Unix domain socket in the directory shared with the
+ * host and starts listening on it
  */
-void connection_wait(int sock) {
+static int start_listener_unix() {
+    struct sockaddr_un addr;
+    int                sock;
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1) {
+        lprintf(ERROR, "%s", strerror(errno));
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s",
+             PLC_UDS_CONTAINER_DIR, PLC_UDS_SOCKET_NAME);
+
+    /* Socket file might be left from the previous run */
+    unlink(addr.sun_path);
+    if (bind(sock, (const struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        lprintf(ERROR, "Cannot bind the socket file '%s': %s", addr.sun_path, strerror(errno));
+    }
+
+    /* Directory on the host is private to the database user and its group.
+     * Client might run under another user of the same group, so the group
+     * should be able to connect */
+    if (chmod(addr.sun_path, 0660) == -1) {
+        lprintf(ERROR, "Cannot change mode of the socket file '%s': %s", addr.sun_path, strerror(errno));
+    }
+    if (listen(sock, 10) == -1) {
+        lprintf(ERROR, "Cannot listen the socket: %s", strerror(errno));
+    }
+
+    return sock;
+}
+
+static int get_connect_timeout() {
+    int   timeoutsec = TIMEOUT_SEC;
+    char *env;
+
+    env = getenv(PLC_CONNECT_TIMEOUT_ENV);
+    if (env != NULL && atoi(env) > 0) {
+        timeoutsec = atoi(env);
+    }
+    return timeoutsec;
+}
+
+/*
+ * Returns 1 when the socket is ready to accept connection, 0 on timeout
+ */
+static int wait_for_connection(int sock, int timeoutsec) {
     struct timeval     timeout;
     int                rv;
     fd_set             fdset;
 
-    FD_ZERO(&fdset);    /* clear the set */
-    FD_SET(sock, &fdset); /* add our file descriptor to the set */
-    timeout.tv_sec  = TIMEOUT_SEC;
-    timeout.tv_usec = 0;
+    do {
+        FD_ZERO(&fdset);    /* clear the set */
+        FD_SET(sock, &fdset); /* add our file descriptor to the set */
+        timeout.tv_sec  = timeoutsec;
+        timeout.tv_usec = 0;
 
-    rv = select(sock + 1, &fdset, NULL, NULL, &timeout);
+        rv = select(sock + 1, &fdset, NULL, NULL, &timeout);
+    } while (rv == -1 && errno == EINTR);
     if (rv == -1) {
         lprintf(ERROR, "Failed to select() socket: %s", strerror(errno));
     }
-    if (rv == 0) {
-        lprintf(ERROR, "Socket timeout - no client connected within %d seconds", TIMEOUT_SEC);
+    return rv > 0 ? 1 : 0;
+}
+
+/*
+ * Fuction waits for the socket to accept connection for finite amount of time
+ * and errors out when the timeout is reached and no client connected
+ */
+void connection_wait(int sock) {
+    int timeoutsec = get_connect_timeout();
+
+    if (wait_for_connection(sock, timeoutsec) == 0) {
+        lprintf(ERROR, "Socket timeout - no client connected within %d seconds", timeoutsec);
     }
 }
 
+/*
+ * Zygote mode: the process keeps serving the socket and forks a child for
+ * each incoming connection, so the children share the already initialized
+ * interpreter copy-on-write. Function returns only in the child process,
+ * the zygote itself exits once no connection comes within the timeout
+ */
+plcConn* connection_fork(int sock) {
+    int   timeoutsec = get_connect_timeout();
+    pid_t pid;
+    int   connection;
+
+    /* Children are reaped automatically */
+    signal(SIGCHLD, SIG_IGN);
+
+    while (wait_for_connection(sock, timeoutsec)) {
+        connection = accept(sock, NULL, NULL);
+        if (connection == -1) {
+            continue;
+        }
+
+        pid = fork();
+        if (pid == 0) {
+            close(sock);
+            signal(SIGCHLD, SIG_DFL);
+            return connection_setup(connection);
+        }
+        if (pid == -1) {
+            lprintf(WARNING, "Cannot fork the client process: %s", strerror(errno));
+        }
+        close(connection);
+    }
+
+    lprintf(NOTICE, "Zygote has not received connections within %d seconds", timeoutsec);
+    exit(0);
+}
+
 /*
  * Function accepts the connection and initializes structure for it
  */
 plcConn* connection_init(int sock) {
-    socklen_t          raddr_len;
-    struct sockaddr_in raddr;
-    int                connection;
+    socklen_t               raddr_len;
+    struct sockaddr_storage raddr;
+    int                     connection;
 
     raddr_len  = sizeof(raddr);
     connection = accept(sock, (struct sockaddr *)&raddr, &raddr_len);
@@ -87,7 +224,19 @@ plcConn* connection_init(int sock) {
         lprintf(ERROR, "failed to accept connection: %s", strerror(errno));
     }
 
-    return plcConnInit(connection);
+    return connection_setup(connection);
+}
+
+/*
+ * Function initializes structure for the accepted connection
+ */
+static plcConn* connection_setup(int connection) {
+    plcConn *conn;
+
+    conn = plcConnInit(connection);
+    startup_timing_mark("wait");
+
+    return conn;
 }
 
 /*
@@ -96,6 +245,7 @@ plcConn* connection_init(int sock) {
 void receive_loop( void (*handle_call)(plcMsgCallreq*, plcConn*), plcConn* conn) {
     plcMessage *msg;
     int res = 0;
+    char *transport;
 
     res = plcontainer_channel_receive(conn, &msg);
     if (res < 0) {
@@ -106,13 +256,25 @@ void receive_loop( void (*handle_call)(plcMsgCallreq*, plcConn*), plcConn* conn)
         lprintf(ERROR, "First received message should be 'ping' message, got '%c' instead", msg->msgtype);
         return;
     } else {
+        /* Answer with our features and the breakdown of the startup time */
+        ((plcMsgPing*)msg)->timings = startup_timings[0] != '\0' ? startup_timings : NULL;
         res = plcontainer_channel_send(conn, msg);
         if (res < 0) {
             lprintf(ERROR, "Cannot send 'ping' message response");
             return;
         }
+        plcontainer_channel_negotiate(conn, (plcMsgPing*)msg);
+    }
+    plcontainer_channel_release(msg);
+
+    /* Backend has created and reset the rings before connecting to us and
+     * switches to them after the ping if both sides support them. Nothing is
+     * sent over the socket before that, so the buffers are empty */
+    transport = getenv(PLC_TRANSPORT_ENV);
+    if (transport != NULL && strcmp(transport, "shm") == 0
+            && (conn->features & PLC_FEATURE_SHM)) {
+        conn->shm = plcShmAttach(PLC_UDS_CONTAINER_DIR "/" PLC_SHM_FILE_NAME, 0);
     }
-    pfree(msg);
 
     while (1) {
         res = plcontainer_channel_receive(conn, &msg);
@@ -128,8 +290,14 @@ void receive_loop( void (*handle_call)(plcMsgCallreq*, plcConn*), plcConn* conn)
 
         switch (msg->msgtype) {
             case MT_CALLREQ:
+            case MT_CALLREQ_BATCH:
+                /* Batch starts with a regular call header, handler checks msgtype */
                 handle_call((plcMsgCallreq*)msg, conn);
-                free_callreq((plcMsgCallreq*)msg, false, false);
+                plcontainer_channel_release(msg);
+                break;
+            case MT_RESULT_NEXT:
+                /* Requested ahead for the result that has already been sent */
+                plcontainer_channel_release(msg);
                 break;
             default:
                 lprintf(ERROR, "received unknown message: %c", msg->msgtype);
@@ -18,9 +18,14 @@
 // Timeout in seconds for server to wait for client connection
 #define TIMEOUT_SEC 20
 
+// Size of the startup timings breakdown sent in the ping reply
+#define PLC_STARTUP_TIMINGS_LEN 1024
+
 int  start_listener(void);
 void connection_wait(int sock);
 plcConn* connection_init(int sock);
+plcConn* connection_fork(int sock);
+void startup_timing_mark(const char *stage);
 void receive_loop( void (*handle_call)(plcMsgCallreq*, plcConn*), plcConn* conn);
 
 #endif /* PLC_COMM_SERVER_H */
@@ -0,0 +1,262 @@
+/*------------------------------------------------------------------------------
+ *
+ *
+ * Copyright (c) 2016, Pivotal.
+ *
+ *------------------------------------------------------------------------------
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "comm_utils.h"
+#include "comm_connectivity.h"
+#include "comm_shm.h"
+
+/*
+ * Shared memory transport. The file holds two ring buffers, the first one
+ * carries data from backend to client and the second one from client to
+ * backend. The socket is used only to wake up the other side when it waits
+ * for data or for free space in the ring
+ */
+
+#define PLC_SHM_RING_TOTAL (sizeof(plcShmRing) + PLC_SHM_RING_SIZE)
+#define PLC_SHM_FILE_SIZE  (2 * PLC_SHM_RING_TOTAL)
+
+static int plcShmWait(struct plcConn *conn);
+static int plcShmWakeup(struct plcConn *conn);
+
+/*
+ * Block on the socket until the other side sends a wakeup byte. Receive
+ * timeout set on the socket just makes us check the ring once again
+ *
+ * Returns 1 if the ring should be checked again, 0 if the other side has
+ * closed the connection and -1 on failure
+ */
+static int plcShmWait(struct plcConn *conn) {
+    char    c;
+    ssize_t sz;
+
+    sz = recv(conn->sock, &c, 1, 0);
+    if (sz < 0) {
+        if (errno == EINTR) {
+            lprintf(ERROR, "Query and PL/Container connections are terminated by user request");
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 1;
+        }
+        return -1;
+    }
+    return (int)sz;
+}
+
+static int plcShmWakeup(struct plcConn *conn) {
+    char    c = 'W';
+    ssize_t sz;
+
+    sz = send(conn->sock, &c, 1, 0);
+    if (sz < 0 && errno == EINTR) {
+        lprintf(ERROR, "Query and PL/Container connections are terminated by user request");
+    }
+    return sz == 1 ? 0 : -1;
+}
+
+/*
+ * Create the shared memory file of the required size, called by backend
+ * before the container is started. The file is new and readable only by the
+ * database user, create_container() opens it to the group if the client runs
+ * under another user
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int plcShmCreate(const char *path) {
+    int fd;
+    int res = 0;
+
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        lprintf(ERROR, "Cannot create shared memory file '%s': %s", path, strerror(errno));
+        return -1;
+    }
+
+    if (ftruncate(fd, PLC_SHM_FILE_SIZE) < 0) {
+        lprintf(ERROR, "Cannot initialize shared memory file '%s': %s", path, strerror(errno));
+        res = -1;
+    }
+
+    close(fd);
+    return res;
+}
+
+/*
+ * Map the shared memory file. Backend writes to the first ring and reads from
+ * the second one, client does the opposite
+ *
+ * Returns NULL on failure
+ */
+plcShm *plcShmAttach(const char *path, int isBackend) {
+    int     fd;
+    char   *base;
+    plcShm *shm;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0) {
+        lprintf(ERROR, "Cannot open shared memory file '%s': %s", path, strerror(errno));
+        return NULL;
+    }
+
+    base = mmap(NULL, PLC_SHM_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        lprintf(ERROR, "Cannot map shared memory file '%s': %s", path, strerror(errno));
+        return NULL;
+    }
+
+    shm = (plcShm*)plc_top_alloc(sizeof(plcShm));
+    shm->base    = base;
+    shm->mapSize = PLC_SHM_FILE_SIZE;
+    if (isBackend) {
+        shm->out = (plcShmRing*)base;
+        shm->in  = (plcShmRing*)(base + PLC_SHM_RING_TOTAL);
+    } else {
+        shm->in  = (plcShmRing*)base;
+        shm->out = (plcShmRing*)(base + PLC_SHM_RING_TOTAL);
+    }
+    shm->inData  = (char*)shm->in + sizeof(plcShmRing);
+    shm->outData = (char*)shm->out + sizeof(plcShmRing);
+
+    return shm;
+}
+
+/*
+ * Reset both rings, should be done by backend before connecting to the client
+ */
+void plcShmReset(plcShm *shm) {
+    memset(shm->out, 0, sizeof(plcShmRing));
+    memset(shm->in, 0, sizeof(plcShmRing));
+    shm->out->size = PLC_SHM_RING_SIZE;
+    shm->in->size  = PLC_SHM_RING_SIZE;
+    __sync_synchronize();
+}
+
+void plcShmDetach(plcShm *shm) {
+    if (shm != NULL) {
+        munmap(shm->base, shm->mapSize);
+        pfree(shm);
+    }
+}
+
+/*
+ * Write as much data as fits into the output ring, waiting for the reader to
+ * free up some space if the ring is full
+ *
+ * Returns the number of bytes written, 0 or negative value on failure
+ */
+ssize_t plcShmSend(struct plcConn *conn, const void *ptr, size_t len) {
+    plcShmRing        *ring = conn->shm->out;
+    unsigned long long head = ring->head;
+    size_t             space;
+    size_t             pos, first;
+    int                res;
+
+    while ((space = (size_t)(ring->size - (head - ring->tail))) == 0) {
+        /* Tell the reader we are waiting and check once again to avoid
+         * missing the wakeup sent in between */
+        ring->writerWaiting = 1;
+        __sync_synchronize();
+        if (ring->size - (head - ring->tail) > 0) {
+            continue;
+        }
+        res = plcShmWait(conn);
+        if (res <= 0) {
+            return res;
+        }
+    }
+
+    if (len > space) {
+        len = space;
+    }
+    pos   = (size_t)(head % ring->size);
+    first = ring->size - pos;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(conn->shm->outData + pos, ptr, first);
+    if (len > first) {
+        memcpy(conn->shm->outData, (const char*)ptr + first, len - first);
+    }
+
+    /* Data should be visible before the head moves */
+    __sync_synchronize();
+    ring->head = head + len;
+    __sync_synchronize();
+
+    if (ring->readerWaiting) {
+        ring->readerWaiting = 0;
+        if (plcShmWakeup(conn) < 0) {
+            return -1;
+        }
+    }
+
+    return (ssize_t)len;
+}
+
+/*
+ * Read the data available in the input ring, waiting for the writer if the
+ * ring is empty
+ *
+ * Returns the number of bytes read, 0 if the other side has closed the
+ * connection and -1 on failure
+ */
+ssize_t plcShmRecv(struct plcConn *conn, void *ptr, size_t len) {
+    plcShmRing        *ring = conn->shm->in;
+    unsigned long long tail = ring->tail;
+    size_t             avail;
+    size_t             pos, first;
+    int                res;
+
+    while ((avail = (size_t)(ring->head - tail)) == 0) {
+        ring->readerWaiting = 1;
+        __sync_synchronize();
+        if (ring->head - tail > 0) {
+            continue;
+        }
+        res = plcShmWait(conn);
+        if (res <= 0) {
+            return res;
+        }
+    }
+
+    /* Data written before the head has moved is visible after the barrier */
+    __sync_synchronize();
+    if (len > avail) {
+        len = avail;
+    }
+    pos   = (size_t)(tail % ring->size);
+    first = ring->size - pos;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(ptr, conn->shm->inData + pos, first);
+    if (len > first) {
+        memcpy((char*)ptr + first, conn->shm->inData, len - first);
+    }
+
+    __sync_synchronize();
+    ring->tail = tail + len;
+    __sync_synchronize();
+
+    if (ring->writerWaiting) {
+        ring->writerWaiting = 0;
+        if (plcShmWakeup(conn) < 0) {
+            return -1;
+        }
+    }
+
+    return (ssize_t)len;
+}
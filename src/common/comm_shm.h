@@ -0,0 +1,54 @@
+/*------------------------------------------------------------------------------
+ *
+ *
+ * Copyright (c) 2016, Pivotal.
+ *
+ *------------------------------------------------------------------------------
+ */
+#ifndef PLC_COMM_SHM_H
+#define PLC_COMM_SHM_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct plcConn;
+
+/* Name of the shared memory file inside of the socket directory */
+#define PLC_SHM_FILE_NAME "plcontainer.shm"
+
+/* Size of the data area of each of the two ring buffers */
+#define PLC_SHM_RING_SIZE (8 * 1024 * 1024)
+
+/*
+ * Single-producer single-consumer ring buffer living in the shared file.
+ * Producer advances head, consumer advances tail, both are never wrapped,
+ * so head - tail is the amount of data available for reading. Waiting flags
+ * tell the other side it should send a wakeup byte over the socket
+ */
+typedef struct plcShmRing {
+    volatile unsigned long long head;
+    volatile unsigned long long tail;
+    volatile int                readerWaiting;
+    volatile int                writerWaiting;
+    unsigned long long          size;
+    char                        padding[32];
+} plcShmRing;
+
+/* Process-local view of the mapped file */
+typedef struct plcShm {
+    char       *base;     // start of the mapping
+    size_t      mapSize;  // size of the mapping
+    plcShmRing *in;       // ring we read from
+    plcShmRing *out;      // ring we write to
+    char       *inData;   // data area of the input ring
+    char       *outData;  // data area of the output ring
+} plcShm;
+
+int plcShmCreate(const char *path);
+plcShm *plcShmAttach(const char *path, int isBackend);
+void plcShmReset(plcShm *shm);
+void plcShmDetach(plcShm *shm);
+ssize_t plcShmSend(struct plcConn *conn, const void *ptr, size_t len);
+ssize_t plcShmRecv(struct plcConn *conn, void *ptr, size_t len);
+
+#endif /* PLC_COMM_SHM_H */
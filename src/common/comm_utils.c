@@ -25,4 +25,140 @@
         return out;
     }
 
+    plcArena *plc_arena_create() {
+        return AllocSetContextCreate(CurrentMemoryContext,
+                                     "PL/Container message",
+                                     ALLOCSET_SMALL_MINSIZE,
+                                     ALLOCSET_SMALL_INITSIZE,
+                                     ALLOCSET_DEFAULT_MAXSIZE);
+    }
+
+    void *plc_arena_alloc(plcArena *arena, size_t bytes) {
+        return MemoryContextAlloc(arena, bytes);
+    }
+
+    void plc_arena_reset(plcArena *arena) {
+        MemoryContextReset(arena);
+    }
+
+    void plc_arena_delete(plcArena *arena) {
+        MemoryContextDelete(arena);
+    }
+
+#else /* COMM_STANDALONE */
+
+    #include <stdlib.h>
+
+    #define PLC_ARENA_BLOCK_SIZE 8192
+    #define PLC_ARENA_ALIGN(len) (((len) + 7) & ~((size_t)7))
+
+    typedef struct plcArenaBlock {
+        struct plcArenaBlock *next;
+        size_t                size;   /* usable bytes following the header */
+    } plcArenaBlock;
+
+    struct plcArena {
+        plcArenaBlock *blocks;        /* the first one is being filled */
+        char          *ptr;
+        size_t         left;
+    };
+
+    /* The last deleted arena is kept to serve the next message */
+    static plcArena *plcSpareArena = NULL;
+
+    static plcArenaBlock *plc_arena_block(size_t size) {
+        plcArenaBlock *block = (plcArenaBlock*)malloc(sizeof(plcArenaBlock) + size);
+        if (block == NULL) {
+            lprintf(ERROR, "Cannot allocate %lu bytes of message memory", (unsigned long)size);
+        }
+        block->size = size;
+        return block;
+    }
+
+    plcArena *plc_arena_create() {
+        plcArena *arena = plcSpareArena;
+
+        if (arena != NULL) {
+            plcSpareArena = NULL;
+            return arena;
+        }
+        arena = (plcArena*)malloc(sizeof(plcArena));
+        arena->blocks = NULL;
+        arena->ptr    = NULL;
+        arena->left   = 0;
+        return arena;
+    }
+
+    void *plc_arena_alloc(plcArena *arena, size_t bytes) {
+        plcArenaBlock *block;
+        void          *res;
+
+        bytes = PLC_ARENA_ALIGN(bytes);
+        if (bytes <= arena->left) {
+            res = arena->ptr;
+            arena->ptr  += bytes;
+            arena->left -= bytes;
+            return res;
+        }
+
+        /* Large values get a block of their own, the current one is kept */
+        if (bytes > PLC_ARENA_BLOCK_SIZE / 4) {
+            block = plc_arena_block(bytes);
+            if (arena->blocks != NULL) {
+                block->next = arena->blocks->next;
+                arena->blocks->next = block;
+            } else {
+                block->next = NULL;
+                arena->blocks = block;
+            }
+            return (char*)(block + 1);
+        }
+
+        block = plc_arena_block(PLC_ARENA_BLOCK_SIZE);
+        block->next   = arena->blocks;
+        arena->blocks = block;
+        arena->ptr    = (char*)(block + 1) + bytes;
+        arena->left   = PLC_ARENA_BLOCK_SIZE - bytes;
+        return (char*)(block + 1);
+    }
+
+    /* Frees all the blocks but a regular one, which is reused */
+    void plc_arena_reset(plcArena *arena) {
+        plcArenaBlock *block = arena->blocks;
+        plcArenaBlock *kept  = NULL;
+
+        while (block != NULL) {
+            plcArenaBlock *next = block->next;
+            if (kept == NULL && block->size == PLC_ARENA_BLOCK_SIZE) {
+                kept = block;
+                kept->next = NULL;
+            } else {
+                free(block);
+            }
+            block = next;
+        }
+
+        arena->blocks = kept;
+        arena->ptr    = kept != NULL ? (char*)(kept + 1) : NULL;
+        arena->left   = kept != NULL ? kept->size : 0;
+    }
+
+    void plc_arena_delete(plcArena *arena) {
+        plcArenaBlock *block;
+
+        if (plcSpareArena == NULL) {
+            plc_arena_reset(arena);
+            plcSpareArena = arena;
+            return;
+        }
+
+        block = arena->blocks;
+        while (block != NULL) {
+            plcArenaBlock *next = block->next;
+            free(block);
+            block = next;
+        }
+        free(arena);
+    }
+
 #endif /* COMM_STANDALONE */
@@ -87,6 +87,8 @@ interpreted as representing official policies, either expressed or implied, of t
     #define pstrdup strdup
     #define plc_top_strdup strdup
 
+    typedef struct plcArena plcArena;
+
 #else /* COMM_STANDALONE */
 
 #include "postgres.h"
@@ -97,6 +99,18 @@ interpreted as representing official policies, either expressed or implied, of t
     void *plc_top_alloc(size_t bytes);
     char *plc_top_strdup(char *str);
 
+    typedef struct MemoryContextData plcArena;
+
 #endif /* COMM_STANDALONE */
 
+/*
+  Arena owns everything allocated in it and is freed in one operation. It is
+  a memory context under the current one in the backend and a chain of
+  malloc'ed blocks in the client.
+*/
+plcArena *plc_arena_create(void);
+void *plc_arena_alloc(plcArena *arena, size_t bytes);
+void plc_arena_reset(plcArena *arena);
+void plc_arena_delete(plcArena *arena);
+
 #endif /* PLC_COMM_UTILS_H */
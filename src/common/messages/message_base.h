@@ -10,17 +10,36 @@
 
 #include "../comm_utils.h"
 
-#define base_message_content unsigned short msgtype;
+/* Arena and pin are set only for the received messages, values of the message
+ * might reference the pinned input buffer, see plcontainer_channel_release */
+struct plcBufferPin;
+#define base_message_content unsigned short msgtype; plcArena *arena; \
+                             struct plcBufferPin *pin;
 
 typedef struct plcMessage {
     base_message_content
 } plcMessage;
 
+/*
+ * Fixed-width scalars are stored in the structure itself with value set to
+ * NULL, all the other values are pointed to by value. Data of a non-null
+ * value should be accessed with plc_raw_value
+ */
 typedef struct {
     int   isnull;
     char *value;
+    union {
+        char      int1;
+        short     int2;
+        int       int4;
+        long long int8;
+        float     float4;
+        double    float8;
+    } inlined;
 } rawdata;
 
+#define plc_raw_value(raw) ((raw)->value != NULL ? (raw)->value : (char*)&(raw)->inlined)
+
 typedef enum {
     PLC_DATA_INT1    = 0,  // 1-byte integer
     PLC_DATA_INT2    = 1,  // 2-byte integer
@@ -33,7 +52,8 @@ typedef enum {
     PLC_DATA_ARRAY   = 7,  // Array - array type specification should follow
     PLC_DATA_UDT     = 8,  // User-defined type, specification to follow
     PLC_DATA_BYTEA   = 9,  // Arbitrary set of bytes, stored and transferred as length + data
-    PLC_DATA_INVALID = 10  // Invalid data type
+    PLC_DATA_NUMERIC = 10, // Arbitrary precision decimal, stored as plcNumeric
+    PLC_DATA_INVALID = 11  // Invalid data type
 } plcDatatype;
 
 typedef struct plcType plcType;
@@ -18,18 +18,70 @@ typedef struct {
 typedef struct plcMsgCallreq {
     base_message_content;    // message_type ID
     unsigned int objectid;   // OID of the function in GPDB
+    unsigned int version;    // version of the function definition in GPDB
+    unsigned int seq;        // sequence number of the call on the connection
     int          hasChanged; // flag signaling the function has changed in GPDB
     plcProcSrc   proc;       // procedure - its name and source code
     plcType      retType;    // function return type
     int          retset;     // whether the function is set-returning
     int          nargs;      // number of function arguments
     plcArgument *args;       // function arguments
+    struct plcProcDef *def;  // registered definition a received compact call references
 } plcMsgCallreq;
 
+/*
+ * Batch of calls to the same function. The call header is shared by all the
+ * rows, its arguments carry only names and types while the argument values
+ * of each row are stored in rows[row][arg]. The header has to be the first
+ * member so the batch can be handled as a regular call request. Batch sent
+ * ahead might arrive while the client waits for the SQL results of the
+ * previous one, it is queued until the previous batch is processed.
+ */
+typedef struct plcMsgCallreqBatch {
+    plcMsgCallreq call;      // call header, call.msgtype is MT_CALLREQ_BATCH
+    int           ahead;     // sent before the result of the previous batch
+    int           nrows;     // number of argument rows in the batch
+    rawdata     **rows;      // argument values for each of the rows
+} plcMsgCallreqBatch;
+
+/*
+ * Function registered over the connection. Full function definition is sent
+ * only once per connection and function version, subsequent calls carry
+ * only the function handle and argument values. Sender side remembers the
+ * version it has sent, receiver side keeps the call header to restore the
+ * full call request out of the compact one.
+ */
+typedef struct plcProcHandle {
+    unsigned int          objectid; // OID of the function in GPDB
+    unsigned int          version;  // version of the function definition
+    struct plcProcDef    *def;      // definition kept by the receiver side
+    struct plcProcHandle *next;
+} plcProcHandle;
+
+/*
+ * Definition of a registered function, allocated in its own arena. Compact
+ * calls still being processed keep a reference to it, so the definition
+ * replaced by a re-registration is freed with the last of them
+ */
+typedef struct plcProcDef {
+    plcMsgCallreq *call;     // call header without argument values
+    int            refs;     // the handle and the compact calls referencing it
+} plcProcDef;
+
 /*
   Frees a callreq and all subfields of the struct, this function
   assumes ownership of all pointers in the struct and substructs
 */
 void free_callreq(plcMsgCallreq *req, bool isShared, bool isSender);
 
+/*
+  Frees the list of functions registered over the connection
+ */
+void free_proc_handles(plcProcHandle *handle);
+
+/*
+  Drops a reference to the function definition, the last one frees it
+ */
+void release_proc_def(plcProcDef *def);
+
 #endif /* PLC_MESSAGE_CALLREQ_H */
@@ -30,6 +30,11 @@ struct plcIterator {
     char         *data;
     char         *position;
     char         *payload;
+    /*
+     * contiguous block of fixed-width elements if the array has no NULLs and
+     * its elements are stored exactly as they are sent, NULL otherwise
+     */
+    char         *packed;
     /*
      * used to return next element from client-side array structure to avoid
      * creating a copy of full array before sending it
@@ -45,6 +50,28 @@ typedef struct plcUDT {
     rawdata  *data;
 } plcUDT;
 
+/*
+ * Numeric in the representation of PostgreSQL: base PLC_NUMERIC_NBASE
+ * digits, the first of them multiplied by PLC_NUMERIC_NBASE^weight and each
+ * next one by the lower power, and the number of decimal digits displayed
+ * after the point. Value is transferred as the four header fields followed
+ * by the digits
+ */
+#define PLC_NUMERIC_NBASE 10000
+#define PLC_NUMERIC_POS   0x0000
+#define PLC_NUMERIC_NEG   0x4000
+#define PLC_NUMERIC_NAN   0xC000
+
+typedef struct plcNumeric {
+    short          ndigits;
+    short          weight;
+    unsigned short sign;
+    short          dscale;
+    unsigned short digits[1];
+} plcNumeric;
+
+#define PLC_NUMERIC_SIZE(ndigits) (sizeof(plcNumeric) + (ndigits) * sizeof(unsigned short))
+
 plcArray *plc_alloc_array(int ndims);
 void plc_free_array(plcArray *arr, plcType *type, bool isSender);
 plcUDT *plc_alloc_udt(int nargs);
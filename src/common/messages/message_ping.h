@@ -10,8 +10,48 @@
 
 #include "message_base.h"
 
+/*
+ * Version of the message encoding. Peers of different versions talk to each
+ * other using the baseline encoding and the features both of them support
+ */
+#define PLC_PROTOCOL_VERSION 1
+
+/* Features the side of the connection supports */
+#define PLC_FEATURE_BATCH         0x01  // accepts MT_CALLREQ_BATCH
+#define PLC_FEATURE_PACKED_ARRAYS 0x02  // fixed-width arrays as one block
+#define PLC_FEATURE_COMPRESSION   0x04  // large values compressed with LZ4
+#define PLC_FEATURE_STREAMING     0x08  // set results in MT_RESULT_CHUNK
+#define PLC_FEATURE_SHM           0x10  // shared memory rings
+#define PLC_FEATURE_FRAMING       0x20  // messages sent in length-prefixed frames
+#define PLC_FEATURE_PROC_HANDLES  0x40  // function definition sent once
+#define PLC_FEATURE_CALL_SEQ      0x80  // calls and chunk requests carry seq
+#define PLC_FEATURE_NUMERIC       0x100 // numeric in base-10000 digits, not float8
+#define PLC_FEATURE_PIPELINE      0x200 // batches sent ahead are queued during SQL
+#define PLC_FEATURE_TEXT_NUL      0x400 // text sent with its terminating zero
+
+/* Features supported by this build */
+#define PLC_FEATURES (PLC_FEATURE_BATCH | PLC_FEATURE_PACKED_ARRAYS \
+                      | PLC_FEATURE_COMPRESSION | PLC_FEATURE_STREAMING \
+                      | PLC_FEATURE_SHM | PLC_FEATURE_FRAMING \
+                      | PLC_FEATURE_PROC_HANDLES | PLC_FEATURE_CALL_SEQ \
+                      | PLC_FEATURE_NUMERIC | PLC_FEATURE_PIPELINE \
+                      | PLC_FEATURE_TEXT_NUL)
+
+/*
+ * Backend starts the connection with the ping and the client answers it,
+ * adding the breakdown of its startup time. Each side sends its own protocol
+ * version, features and the largest message it accepts, the message keeps
+ * the values received from the peer. Peers older than the negotiation send
+ * none of them, they are received as version 0 without features. Ping and
+ * its answer are exchanged before the features are known, so they do not
+ * use any of them
+ */
 typedef struct plcMsgPing {
     base_message_content;
+    unsigned int  version;     // protocol version of the peer
+    unsigned int  features;    // features supported by the peer
+    unsigned int  maxMessage;  // largest message the peer accepts
+    char         *timings;
 } plcMsgPing;
 
 #endif /* PLC_MESSAGE_PING_H */
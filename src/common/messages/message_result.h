@@ -22,6 +22,24 @@ typedef struct plcMsgResult {
     void        *(*exception_callback)(void);
 } plcMsgResult;
 
+/*
+ * Rows of set-returning function result are sent in chunks of at most
+ * PLC_RESULT_CHUNK_ROWS rows. Each chunk except the last one is sent as
+ * MT_RESULT_CHUNK and client waits for MT_RESULT_NEXT before producing the
+ * next one, the last chunk is sent as MT_RESULT
+ */
+#define PLC_RESULT_CHUNK_ROWS 1000
+
+/*
+ * Request for the next chunk of the result. Chunks might be requested ahead,
+ * so the request for a result that has already been sent in full is ignored
+ */
+typedef struct plcMsgResultNext {
+    base_message_content;
+    int           cancel;  // backend does not need more rows
+    unsigned int  seq;     // sequence number of the call producing the result
+} plcMsgResultNext;
+
 void free_result(plcMsgResult *res, bool isSender);
 
 #endif /* PLC_MESSAGE_RESULT_H */
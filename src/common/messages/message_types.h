@@ -10,7 +10,10 @@
 
 #define MT_TRIGREQ 'T'
 #define MT_CALLREQ 'C'
+#define MT_CALLREQ_BATCH 'B'
 #define MT_RESULT 'R'
+#define MT_RESULT_CHUNK 'K'
+#define MT_RESULT_NEXT 'N'
 #define MT_EXCEPTION 'E'
 #define MT_SQL 'S'
 #define MT_LOG 'L'
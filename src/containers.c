@@ -12,6 +12,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <sys/stat.h>
 
 #include "postgres.h"
 #include "utils/ps_status.h"
@@ -21,6 +22,8 @@
 #include "common/messages/messages.h"
 #include "plc_configuration.h"
 #include "containers.h"
+#include "common/comm_shm.h"
+#include "plc_manager.h"
 
 #ifdef CURL_DOCKER_API
     #include "plc_docker_curl_api.h"
@@ -32,89 +35,136 @@ typedef struct {
     char    *name;
     char    *dockerid;
     plcConn *conn;
+    int      ctlfd;     // socket to the container manager, -1 if not managed
 } container_t;
 
 #define CONTAINER_NUMBER 10
 static int containers_init = 0;
 static container_t *containers;
 
-static void insert_container(char *image, char *dockerid, plcConn *conn);
+static void insert_container(char *image, char *dockerid, plcConn *conn, int ctlfd);
 static void init_containers();
 static inline bool is_whitespace (const char c);
+static void stop_container_entry(size_t i);
+#ifndef CONTAINER_DEBUG
+static void cleanup(char *dockerid, char *udsdir);
+static void start_docker_container(plcContainer *cont, char **dockerid, char *udsdir, int *port);
+#endif
+static void kill_container(char *dockerid);
 
 #ifndef CONTAINER_DEBUG
 
-static void cleanup(char *dockerid) {
+/*
+ * Waits for the container to finish, removes it and its socket directory on
+ * the host
+ *
+ * Returns 0 on success, -1 if the container cannot be removed
+ */
+int remove_container(char *dockerid, char *udsdir) {
+    int     res;
+    int     sockfd;
+    int     attempt = 0;
+    clock_t start;
+    clock_t end;
+
+    /* We make 5 attempts to start waiting for the container */
+    for (attempt = 0; attempt < 5; attempt++) {
+
+        /* Connect to the Docker API and execute "wait" command for the
+         * target container to wait for its termination */
+        start = clock();
+        sockfd = plc_docker_connect();
+        if (sockfd > 0) {
+            res = plc_docker_wait_container(sockfd, dockerid);
+            plc_docker_disconnect(sockfd);
+        } else {
+            res = -1;
+        }
+        end = clock();
+
+        /* If "wait" has finished successfully - container has finished
+         * and we can remove the container */
+        if (res == 0) {
+            break;
+        }
+
+        /* If we "waited" for more than 1 minute and wait failed, this might
+         * happen due to network issue and we should reset the attempt
+         * counter and start over */
+        if ( (end - start) / CLOCKS_PER_SEC > 60 ) {
+            attempt = 0;
+        }
+
+        /* Sleep for 1 second in case of failed attempt */
+        sleep(1);
+    }
+
+    /* Connect to the Docker API to remove the container */
+    sockfd = plc_docker_connect();
+    if (sockfd > 0) {
+        res = plc_docker_delete_container(sockfd, dockerid);
+        if (res < 0) {
+            plc_docker_disconnect(sockfd);
+            return -1;
+        }
+    }
+    plc_docker_disconnect(sockfd);
+
+    /* Remove the socket file and its directory on the host */
+    if (udsdir != NULL) {
+        char sockpath[1024];
+
+        snprintf(sockpath, sizeof(sockpath), "%s/%s", udsdir, PLC_UDS_SOCKET_NAME);
+        unlink(sockpath);
+        snprintf(sockpath, sizeof(sockpath), "%s/%s", udsdir, PLC_SHM_FILE_NAME);
+        unlink(sockpath);
+        rmdir(udsdir);
+    }
+
+    return 0;
+}
+
+static void cleanup(char *dockerid, char *udsdir) {
     pid_t pid = 0;
 
     /* We fork the process to syncronously wait for container to exit */
     pid = fork();
     if (pid == 0) {
-        char    psname[200];
-        int     res;
-        int     sockfd;
-        int     attempt = 0;
-        clock_t start;
-        clock_t end;
+        char psname[200];
+        int  res;
 
         /* Setting application name to let the system know it is us */
         sprintf(psname, "plcontainer cleaner %s", dockerid);
         set_ps_display(psname, false);
 
-        /* We make 5 attempts to start waiting for the container */
-        for (attempt = 0; attempt < 5; attempt++) {
-
-            /* Connect to the Docker API and execute "wait" command for the
-             * target container to wait for its termination */
-            start = clock();
-            sockfd = plc_docker_connect();
-            if (sockfd > 0) {
-                res = plc_docker_wait_container(sockfd, dockerid);
-                plc_docker_disconnect(sockfd);
-            } else {
-                res = -1;
-            }
-            end = clock();
+        res = remove_container(dockerid, udsdir);
 
-            /* If "wait" has finished successfully - container has finished
-             * and we can remove the container */
-            if (res == 0) {
-                break;
-            }
+        _exit(res < 0 ? 1 : 0);
+    }
+}
 
-            /* If we "waited" for more than 1 minute and wait failed, this might
-             * happen due to network issue and we should reset the attempt
-             * counter and start over */
-            if ( (end - start) / CLOCKS_PER_SEC > 60 ) {
-                attempt = 0;
-            }
+#endif /* not CONTAINER_DEBUG */
 
-            /* Sleep for 1 second in case of failed attempt */
-            sleep(1);
-        }
+static void kill_container(char *dockerid) {
+    int sockfd;
 
-        /* Connect to the Docker API to remove the container */
-        sockfd = plc_docker_connect();
-        if (sockfd > 0) {
-            res = plc_docker_delete_container(sockfd, dockerid);
-            if (res < 0) {
-                _exit(1);
-            }
-        }
+    if (dockerid == NULL) {
+        return;
+    }
+    sockfd = plc_docker_connect();
+    if (sockfd > 0) {
+        plc_docker_kill_container(sockfd, dockerid);
         plc_docker_disconnect(sockfd);
-
-        _exit(0);
     }
 }
 
-#endif /* not CONTAINER_DEBUG */
-
-static void insert_container(char *image, char *dockerid, plcConn *conn) {
+static void insert_container(char *image, char *dockerid, plcConn *conn, int ctlfd) {
     size_t i;
     for (i = 0; i < CONTAINER_NUMBER; i++) {
         if (containers[i].name == NULL) {
             containers[i].name     = plc_top_strdup(image);
             containers[i].conn     = conn;
+            containers[i].ctlfd    = ctlfd;
             containers[i].dockerid = NULL;
             if (dockerid != NULL) {
                 containers[i].dockerid = plc_top_strdup(dockerid);
@@ -146,79 +196,142 @@ plcConn *find_container(const char *image) {
     return NULL;
 }
 
-plcConn *start_container(plcContainer *cont) {
-    int port;
-    unsigned int sleepus = 25000;
-    unsigned int sleepms = 0;
-    plcMsgPing *mping = NULL;
-    plcConn *conn = NULL;
-    char *dockerid = NULL;
+#ifndef CONTAINER_DEBUG
 
-#ifdef CONTAINER_DEBUG
+/*
+ * Creates and starts the container. Directory for the socket file is created
+ * on the host and mounted to the container if the container does not use TCP
+ * transport, otherwise the host port exposed by the container is returned.
+ * Nothing is left behind on error
+ */
+void create_container(plcContainer *cont, char **dockerid, char **udsdir, int *port) {
+    *dockerid = NULL;
+    *udsdir = NULL;
+    *port = 0;
+
+    /* Directory is accessible only to the database user, the client runs
+     * under the same user. Client running under the user of the image gets
+     * the group of the database user to create the socket file */
+    if (cont->transport != PLC_TRANSPORT_TCP) {
+        *udsdir = pstrdup(cont->transport == PLC_TRANSPORT_SHM ? CONTAINER_SHM_DIR_TEMPLATE
+                                                               : CONTAINER_UDS_DIR_TEMPLATE);
+        if (mkdtemp(*udsdir) == NULL) {
+            pfree(*udsdir);
+            *udsdir = NULL;
+            elog(ERROR, "Cannot create directory for the container socket: %s",
+                        strerror(errno));
+            return;
+        }
+        if (cont->user != NULL && chmod(*udsdir, 0770) < 0) {
+            rmdir(*udsdir);
+            pfree(*udsdir);
+            *udsdir = NULL;
+            elog(ERROR, "Cannot open directory for the container socket to its group: %s",
+                        strerror(errno));
+            return;
+        }
+    }
 
-    port = 8080;
+    /* Shared memory file lives next to the socket file */
+    if (cont->transport == PLC_TRANSPORT_SHM) {
+        char shmpath[1024];
+
+        snprintf(shmpath, sizeof(shmpath), "%s/%s", *udsdir, PLC_SHM_FILE_NAME);
+        if (plcShmCreate(shmpath) < 0
+                || (cont->user != NULL && chmod(shmpath, 0660) < 0)) {
+            unlink(shmpath);
+            rmdir(*udsdir);
+            pfree(*udsdir);
+            *udsdir = NULL;
+            elog(ERROR, "Cannot create shared memory file for the container");
+            return;
+        }
+    }
 
-#else
+    PG_TRY();
+    {
+        start_docker_container(cont, dockerid, *udsdir, port);
+    }
+    PG_CATCH();
+    {
+        /* Container that has been created is removed once it exits, the
+         * client exits on its own when nobody connects to it */
+        if (*dockerid != NULL) {
+            cleanup(*dockerid, *udsdir);
+        } else if (*udsdir != NULL) {
+            char shmpath[1024];
+
+            snprintf(shmpath, sizeof(shmpath), "%s/%s", *udsdir, PLC_SHM_FILE_NAME);
+            unlink(shmpath);
+            rmdir(*udsdir);
+        }
+        *dockerid = NULL;
+        *udsdir = NULL;
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+}
 
+static void start_docker_container(plcContainer *cont, char **dockerid, char *udsdir, int *port) {
     int sockfd;
     int res = 0;
 
     sockfd = plc_docker_connect();
     if (sockfd < 0) {
         elog(ERROR, "Cannot connect to the Docker API socket");
-        return conn;
+        return;
     }
 
-    res = plc_docker_create_container(sockfd, cont, &dockerid);
+    res = plc_docker_create_container(sockfd, cont, dockerid, udsdir);
     if (res < 0) {
         elog(ERROR, "Cannot create Docker container");
-        return conn;
+        return;
     }
 
-    res = plc_docker_start_container(sockfd, dockerid);
+    res = plc_docker_start_container(sockfd, *dockerid);
     if (res < 0) {
         elog(ERROR, "Cannot start Docker container");
-        return conn;
+        return;
     }
 
-    res = plc_docker_inspect_container(sockfd, dockerid, &port);
-    if (res < 0) {
-        elog(ERROR, "Cannot parse host port exposed by Docker container");
-        return conn;
+    /* Unix domain socket transport does not need the port mapping */
+    if (udsdir == NULL) {
+        res = plc_docker_inspect_container(sockfd, *dockerid, port);
+        if (res < 0) {
+            elog(ERROR, "Cannot parse host port exposed by Docker container");
+            return;
+        }
     }
 
     res = plc_docker_disconnect(sockfd);
     if (res < 0) {
         elog(ERROR, "Cannot disconnect from the Docker API socket");
-        return conn;
+        return;
     }
+}
 
-    /* Create a process to clean up the container after it finishes */
-    cleanup(dockerid);
+#endif /* not CONTAINER_DEBUG */
 
-#endif // CONTAINER_DEBUG
+/*
+ * Makes a series of connection attempts until the container answers ping
+ * message or timeoutms is reached. Exponential backoff for reconnecting
+ * first attempts: 25ms, 50ms, 100ms, 200ms, 200ms, etc.
+ */
+plcConn *connect_container(plcContainer *cont, int port, char *udsdir, unsigned int timeoutms) {
+    unsigned int sleepus = 25000;
+    unsigned int sleepms = 0;
+    plcConn *conn = NULL;
 
-    /* Making a series of connection attempts unless connection timeout of
-     * CONTAINER_CONNECT_TIMEOUT_MS is reached. Exponential backoff for
-     * reconnecting first attempts: 25ms, 50ms, 100ms, 200ms, 200ms, etc.
-     */
-    mping = palloc(sizeof(plcMsgPing));
-    mping->msgtype = MT_PING;
-    while (sleepms < CONTAINER_CONNECT_TIMEOUT_MS) {
-        int         res = 0;
-        plcMessage *mresp = NULL;
+    while (sleepms < timeoutms) {
+        plcShm *shm = NULL;
 
-        conn = plcConnect(port);
+        conn = send_container_ping(cont, port, udsdir, &shm);
         if (conn != NULL) {
-            res = plcontainer_channel_send(conn, (plcMessage*)mping);
-            if (res == 0) {
-                res = plcontainer_channel_receive(conn, &mresp);
-                if (mresp != NULL)
-                    pfree(mresp);
-                if (res == 0)
-                    break;
+            if (receive_container_ping(cont, conn, shm) == 0) {
+                elog(DEBUG1, "Container '%s' answered after %u ms", cont->name, sleepms);
+                break;
             }
-            plcDisconnect(conn);
+            conn = NULL;
         }
 
         usleep(sleepus);
@@ -227,15 +340,168 @@ plcConn *start_container(plcContainer *cont) {
         sleepus = sleepus >= 200000 ? 200000 : sleepus * 2;
     }
 
-    if (sleepms >= CONTAINER_CONNECT_TIMEOUT_MS) {
+    return conn;
+}
+
+/*
+ * Connects to the container and sends the ping message without waiting for
+ * the answer, so the caller can wait for several containers at once. Rings
+ * of the shared memory transport are reset before the client accepts the
+ * connection and maps the file
+ *
+ * Returns NULL if the container does not accept the connection yet
+ */
+plcConn *send_container_ping(plcContainer *cont, int port, char *udsdir, plcShm **shm) {
+    plcMsgPing mping;
+    plcConn   *conn = NULL;
+    char       path[1024];
+
+    *shm = NULL;
+    if (cont->transport == PLC_TRANSPORT_SHM) {
+        snprintf(path, sizeof(path), "%s/%s", udsdir, PLC_SHM_FILE_NAME);
+        *shm = plcShmAttach(path, 1);
+        if (*shm != NULL) {
+            plcShmReset(*shm);
+        }
+    }
+
+    if (udsdir != NULL) {
+        snprintf(path, sizeof(path), "%s/%s", udsdir, PLC_UDS_SOCKET_NAME);
+        conn = plcConnectUnix(path);
+    } else {
+        conn = plcConnect(port);
+    }
+
+    memset(&mping, 0, sizeof(mping));
+    mping.msgtype = MT_PING;
+    if (conn != NULL && plcontainer_channel_send(conn, (plcMessage*)&mping) < 0) {
+        plcDisconnect(conn);
+        conn = NULL;
+    }
+    if (conn == NULL) {
+        plcShmDetach(*shm);
+        *shm = NULL;
+    }
+    return conn;
+}
+
+/*
+ * Reads the answer to the ping sent by send_container_ping and negotiates the
+ * features. Client not supporting the rings keeps using the socket
+ *
+ * Returns 0 on success. On failure the connection and the rings are released
+ * and -1 is returned
+ */
+int receive_container_ping(plcContainer *cont, plcConn *conn, plcShm *shm) {
+    plcMessage *mresp = NULL;
+    int         res;
+
+    res = plcontainer_channel_receive(conn, &mresp);
+    if (mresp != NULL) {
+        if (res == 0 && mresp->msgtype != MT_PING) {
+            res = -1;
+        }
+        /* Client tells where its startup time went */
+        if (res == 0 && ((plcMsgPing*)mresp)->timings != NULL) {
+            elog(DEBUG1, "Container '%s' client startup: %s",
+                         cont->name, ((plcMsgPing*)mresp)->timings);
+        }
+        if (res == 0) {
+            plcontainer_channel_negotiate(conn, (plcMsgPing*)mresp);
+            elog(DEBUG1, "Container '%s' uses protocol version %u with features 0x%x, "
+                         "using 0x%x", cont->name, ((plcMsgPing*)mresp)->version,
+                         ((plcMsgPing*)mresp)->features, conn->features);
+        }
+        plcontainer_channel_release(mresp);
+    } else if (res == 0) {
+        res = -1;
+    }
+
+    if (res < 0) {
+        plcDisconnect(conn);
+        plcShmDetach(shm);
+        return -1;
+    }
+
+    if (shm != NULL && (conn->features & PLC_FEATURE_SHM)) {
+        conn->shm = shm;
+    } else {
+        plcShmDetach(shm);
+    }
+    return 0;
+}
+
+plcConn *start_container(plcContainer *cont) {
+    int port = 0;
+    int ctlfd = -1;
+    plcConn *conn = NULL;
+    char *dockerid = NULL;
+    char *udsdir = NULL;
+
+#ifdef CONTAINER_DEBUG
+
+    port = 8080;
+    if (cont->transport != PLC_TRANSPORT_TCP) {
+        udsdir = pstrdup(PLC_UDS_CONTAINER_DIR);
+    }
+    if (cont->transport == PLC_TRANSPORT_SHM) {
+        char shmpath[1024];
+
+        snprintf(shmpath, sizeof(shmpath), "%s/%s", udsdir, PLC_SHM_FILE_NAME);
+        if (plcShmCreate(shmpath) < 0) {
+            elog(ERROR, "Cannot create shared memory file for the container");
+        }
+    }
+
+#else
+
+    /* Container manager of the segment starts the container or takes it from
+     * the warm pool it keeps, and hands the established connection over to
+     * us. Code cache key belongs to the role and database of the session, so
+     * such containers are started here */
+    if (cont->codeCache == NULL) {
+        conn = plc_manager_start_container(cont, &ctlfd);
+        if (conn != NULL) {
+            insert_container(cont->name, NULL, conn, ctlfd);
+            return conn;
+        }
+    }
+
+    create_container(cont, &dockerid, &udsdir, &port);
+
+    /* Create a process to clean up the container after it finishes */
+    cleanup(dockerid, udsdir);
+
+#endif // CONTAINER_DEBUG
+
+    /* Container that cannot be used is killed right away, so the cleanup
+     * process removes it and its directory without waiting for the client
+     * to time out */
+    if (conn == NULL) {
+        PG_TRY();
+        {
+            conn = connect_container(cont, port, udsdir, CONTAINER_CONNECT_TIMEOUT_MS);
+        }
+        PG_CATCH();
+        {
+            kill_container(dockerid);
+            PG_RE_THROW();
+        }
+        PG_END_TRY();
+    }
+
+    if (conn == NULL) {
+        kill_container(dockerid);
         elog(ERROR, "Cannot connect to the container, %d ms timeout reached",
                     CONTAINER_CONNECT_TIMEOUT_MS);
-        conn = NULL;
     } else {
-        insert_container(cont->name, dockerid, conn);
+        insert_container(cont->name, dockerid, conn, ctlfd);
     }
 
     pfree(dockerid);
+    if (udsdir != NULL) {
+        pfree(udsdir);
+    }
 
     return conn;
 }
@@ -246,35 +512,57 @@ void stop_containers() {
     if (containers_init != 0) {
         for (i = 0; i < CONTAINER_NUMBER; i++) {
             if (containers[i].name != NULL) {
-
-                /* Terminate connection to the container */
-                if (containers[i].conn != NULL) {
-                    plcDisconnect(containers[i].conn);
-                }
-
-                /* Terminate container process */
-                if (containers[i].dockerid != NULL) {
-                    int sockfd;
-
-                    sockfd = plc_docker_connect();
-                    if (sockfd > 0) {
-                        plc_docker_kill_container(sockfd, containers[i].dockerid);
-                        plc_docker_disconnect(sockfd);
-                    }
-                    pfree(containers[i].dockerid);
-                }
-
-                /* Set all fields to NULL as part of cleanup */
-                pfree(containers[i].name);
-                containers[i].name = NULL;
-                containers[i].dockerid = NULL;
-                containers[i].conn = NULL;
+                stop_container_entry(i);
             }
         }
     }
     containers_init = 0;
 }
 
+void stop_container(plcConn *conn) {
+    size_t i;
+
+    if (containers_init != 0) {
+        for (i = 0; i < CONTAINER_NUMBER; i++) {
+            if (containers[i].name != NULL && containers[i].conn == conn) {
+                stop_container_entry(i);
+                break;
+            }
+        }
+    }
+}
+
+static void stop_container_entry(size_t i) {
+    /* Terminate connection to the container */
+    if (containers[i].conn != NULL) {
+        plcDisconnect(containers[i].conn);
+    }
+
+    /* Container manager removes the container once we close
+     * the socket */
+    if (containers[i].ctlfd >= 0) {
+        close(containers[i].ctlfd);
+    }
+
+    /* Terminate container process */
+    if (containers[i].dockerid != NULL) {
+        int sockfd;
+
+        sockfd = plc_docker_connect();
+        if (sockfd > 0) {
+            plc_docker_kill_container(sockfd, containers[i].dockerid);
+            plc_docker_disconnect(sockfd);
+        }
+        pfree(containers[i].dockerid);
+    }
+
+    /* Set all fields to NULL as part of cleanup */
+    pfree(containers[i].name);
+    containers[i].name = NULL;
+    containers[i].dockerid = NULL;
+    containers[i].conn = NULL;
+}
+
 static inline bool is_whitespace (const char c) {
     return (c == ' ' || c == '\n' || c == '\t' || c == '\r');
 }
@@ -10,11 +10,24 @@
 #define PLC_CONTAINERS_H
 
 #include "common/comm_connectivity.h"
+#include "common/comm_shm.h"
 #include "plc_configuration.h"
 
 //#define CONTAINER_DEBUG
 #define CONTAINER_CONNECT_TIMEOUT_MS 5000
 
+/* Template of the host directory holding Unix domain socket of the container */
+#define CONTAINER_UDS_DIR_TEMPLATE "/tmp/plcontainer.XXXXXX"
+
+/* Same for the containers using shared memory, the file should be in tmpfs */
+#define CONTAINER_SHM_DIR_TEMPLATE "/dev/shm/plcontainer.XXXXXX"
+
+/* Time to connect to the container already started for the pool */
+#define CONTAINER_POOL_CONNECT_TIMEOUT_MS 500
+
+/* Time the client started for the pool waits for the connection */
+#define CONTAINER_POOL_IDLE_TIMEOUT_SEC 600
+
 /* given source code of the function, extract the container name */
 char *parse_container_meta(const char *source);
 
@@ -27,4 +40,21 @@ plcConn *start_container(plcContainer *cont);
 /* Function terminates all the container connections */
 void stop_containers(void);
 
+/* Function terminates the container behind the connection */
+void stop_container(plcConn *conn);
+
+/* create and start the container without connecting to it */
+void create_container(plcContainer *cont, char **dockerid, char **udsdir, int *port);
+
+/* connect to the started container, NULL if it does not answer in time */
+plcConn *connect_container(plcContainer *cont, int port, char *udsdir, unsigned int timeoutms);
+
+/* single connection attempt: send the ping, then read the answer once the
+ * connection is readable. NULL and -1 on failure */
+plcConn *send_container_ping(plcContainer *cont, int port, char *udsdir, plcShm **shm);
+int receive_container_ping(plcContainer *cont, plcConn *conn, plcShm *shm);
+
+/* wait for the container to exit and remove it */
+int remove_container(char *dockerid, char *udsdir);
+
 #endif /* PLC_CONTAINERS_H */
@@ -6,63 +6,263 @@
  *------------------------------------------------------------------------------
  */
 
+#include <limits.h>
+
+#include "postgres.h"
+#include "funcapi.h"
+#include "access/heapam.h"
+#include "nodes/pg_list.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+#include "utils/syscache.h"
+
 #include "function_cache.h"
 #include "message_fns.h"
+#include "plcontainer.h"
+
+/*
+ * Functions are cached in the hash table keyed by function OID. Entries are
+ * also linked into the list in the order of use, so the least recently used
+ * one is found and evicted in constant time when the cache is full
+ */
+typedef struct plcFunctionCacheEntry {
+    Oid                           funcOid;  /* hash key, must be the first */
+    plcProcInfo                  *proc;
+    bool                          valid;    /* false once the catalog row has changed */
+    struct plcFunctionCacheEntry *prev;     /* more recently used entry */
+    struct plcFunctionCacheEntry *next;     /* less recently used entry */
+} plcFunctionCacheEntry;
+
+int plc_function_cache_size = PLC_FUNCTION_CACHE_SIZE;
+
+static HTAB                  *plcFunctionCache = NULL;
+static plcFunctionCacheEntry *plcFunctionCacheHead = NULL;
+static plcFunctionCacheEntry *plcFunctionCacheTail = NULL;
+
+/* Functions removed from the cache while their calls are in progress */
+static List                  *plcFunctionCacheRetired = NIL;
+
+static int64 plcFunctionCacheHits = 0;
+static int64 plcFunctionCacheMisses = 0;
+static int64 plcFunctionCacheEvictions = 0;
+static int64 plcFunctionCacheInvalidations = 0;
+
+static void function_cache_create(void);
+static void function_cache_unlink(plcFunctionCacheEntry *entry);
+static void function_cache_push(plcFunctionCacheEntry *entry);
+static void function_cache_release(plcProcInfo *func);
+#if PG_VERSION_NUM >= 80300
+static void function_cache_invalidate(Datum arg, int cacheid, ItemPointer tuplePtr);
+#else
+static void function_cache_invalidate(Datum arg, Oid relid);
+#endif
+
+PG_FUNCTION_INFO_V1(function_cache_stats);
+
+void function_cache_init() {
+#if PG_VERSION_NUM >= 80300
+    DefineCustomIntVariable("plcontainer.function_cache_size",
+                            "Number of functions cached by each session.",
+                            NULL,
+                            &plc_function_cache_size,
+                            PLC_FUNCTION_CACHE_SIZE,
+                            1, INT_MAX,
+                            PGC_USERSET,
+                            NULL, NULL);
+#else
+    DefineCustomIntVariable("plcontainer.function_cache_size",
+                            "Number of functions cached by each session.",
+                            NULL,
+                            &plc_function_cache_size,
+                            1, INT_MAX,
+                            PGC_USERSET,
+                            NULL, NULL);
+#endif
+
+    CacheRegisterSyscacheCallback(PROCOID, function_cache_invalidate, (Datum)0);
+}
+
+static void function_cache_create() {
+    HASHCTL ctl;
+
+    memset(&ctl, 0, sizeof(ctl));
+    ctl.keysize   = sizeof(Oid);
+    ctl.entrysize = sizeof(plcFunctionCacheEntry);
+    ctl.hash      = oid_hash;
+    ctl.hcxt      = TopMemoryContext;
+    plcFunctionCache = hash_create("PL/Container function cache",
+                                   plc_function_cache_size,
+                                   &ctl,
+                                   HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+}
+
+static void function_cache_unlink(plcFunctionCacheEntry *entry) {
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        plcFunctionCacheHead = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        plcFunctionCacheTail = entry->prev;
+    }
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+/* Make the entry the most recently used one */
+static void function_cache_push(plcFunctionCacheEntry *entry) {
+    entry->prev = NULL;
+    entry->next = plcFunctionCacheHead;
+    if (plcFunctionCacheHead != NULL) {
+        plcFunctionCacheHead->prev = entry;
+    }
+    plcFunctionCacheHead = entry;
+    if (plcFunctionCacheTail == NULL) {
+        plcFunctionCacheTail = entry;
+    }
+}
+
+/*
+ * Function removed from the cache might be used by the calls still in
+ * progress, like the outer call of the function evicted by a nested one
+ */
+static void function_cache_release(plcProcInfo *func) {
+    MemoryContext oldcontext;
+
+    if (func->pins == 0) {
+        free_proc_info(func);
+        return;
+    }
+    oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+    plcFunctionCacheRetired = lappend(plcFunctionCacheRetired, func);
+    MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Cached functions are not freed here, as the invalidation might come while
+ * the function is being executed. They are replaced on the next call
+ */
+#if PG_VERSION_NUM >= 80300
+static void function_cache_invalidate(Datum arg UNUSED, int cacheid UNUSED, ItemPointer tuplePtr) {
+#else
+static void function_cache_invalidate(Datum arg UNUSED, Oid relid UNUSED) {
+    ItemPointer tuplePtr = NULL;
+#endif
+    plcFunctionCacheEntry *entry;
 
-static plcProcInfo *plcFunctionCache[PLC_FUNCTION_CACHE_SIZE];
-static int plcFunctionCacheInitialized = 0;
-
-/* Move up the cache item */
-void function_cache_up(int index) {
-    plcProcInfo *tmp;
-    int i;
-    if (index > 0) {
-        tmp = plcFunctionCache[index];
-        for (i = index; i > 0; i--) {
-            plcFunctionCache[i] = plcFunctionCache[i-1];
+    for (entry = plcFunctionCacheHead; entry != NULL; entry = entry->next) {
+        if (entry->valid && (tuplePtr == NULL ||
+                ItemPointerEquals(&entry->proc->fn_tid, tuplePtr))) {
+            entry->valid = false;
+            plcFunctionCacheInvalidations += 1;
         }
-        plcFunctionCache[0] = tmp;
     }
 }
 
 plcProcInfo *function_cache_get(Oid funcOid) {
-    int i;
-    plcProcInfo *resFunc = NULL;
-    /* Initialize all the elements with nulls initially */
-    if (!plcFunctionCacheInitialized) {
-        for (i = 0; i < PLC_FUNCTION_CACHE_SIZE; i++) {
-            plcFunctionCache[i] = NULL;
-        }
-        plcFunctionCacheInitialized = 1;
-    }
-    for (i = 0; i < PLC_FUNCTION_CACHE_SIZE; i++) {
-        if (plcFunctionCache[i] != NULL &&
-                plcFunctionCache[i]->funcOid == funcOid) {
-            resFunc = plcFunctionCache[i];
-            function_cache_up(i);
-            break;
-        }
+    plcFunctionCacheEntry *entry;
+
+    if (plcFunctionCache == NULL) {
+        function_cache_create();
+    }
+
+    entry = (plcFunctionCacheEntry*)hash_search(plcFunctionCache, &funcOid, HASH_FIND, NULL);
+    if (entry == NULL || !entry->valid) {
+        plcFunctionCacheMisses += 1;
+        return NULL;
+    }
+
+    plcFunctionCacheHits += 1;
+    if (entry != plcFunctionCacheHead) {
+        function_cache_unlink(entry);
+        function_cache_push(entry);
     }
-    return resFunc;
+    return entry->proc;
 }
 
 void function_cache_put(plcProcInfo *func) {
-    int i;
-    plcProcInfo *oldFunc;
-    oldFunc = function_cache_get(func->funcOid);
-    /* If the function is not cached already */
-    if (oldFunc == NULL) {
-        /* If the last element exists we need to free its memory */
-        if (plcFunctionCache[PLC_FUNCTION_CACHE_SIZE-1] != NULL) {
-            free_proc_info(plcFunctionCache[PLC_FUNCTION_CACHE_SIZE-1]);
-        }
-        /* Move our LRU cache right */
-        for (i = PLC_FUNCTION_CACHE_SIZE-1; i > 0; i--) {
-            plcFunctionCache[i] = plcFunctionCache[i-1];
-        }
-        plcFunctionCache[0] = func;
-    } else {
-        free_proc_info(oldFunc);
-        plcFunctionCache[0] = func;
+    plcFunctionCacheEntry *entry;
+    bool                   found;
+
+    if (plcFunctionCache == NULL) {
+        function_cache_create();
+    }
+
+    entry = (plcFunctionCacheEntry*)hash_search(plcFunctionCache, &func->funcOid, HASH_ENTER, &found);
+    if (found) {
+        function_cache_release(entry->proc);
+        function_cache_unlink(entry);
+    }
+    entry->proc  = func;
+    entry->valid = true;
+    function_cache_push(entry);
+
+    /* Cache size might have been decreased, so we might evict more than one */
+    while (hash_get_num_entries(plcFunctionCache) > plc_function_cache_size
+            && plcFunctionCacheTail != entry) {
+        plcFunctionCacheEntry *last = plcFunctionCacheTail;
+        Oid                    lastOid = last->funcOid;
+
+        function_cache_unlink(last);
+        function_cache_release(last->proc);
+        hash_search(plcFunctionCache, &lastOid, HASH_REMOVE, NULL);
+        plcFunctionCacheEvictions += 1;
     }
 }
+
+/* Call of the function has finished, either normally or with an error */
+void function_cache_unpin(plcProcInfo *func) {
+    func->pins -= 1;
+    if (func->pins == 0 && list_member_ptr(plcFunctionCacheRetired, func)) {
+        plcFunctionCacheRetired = list_delete_ptr(plcFunctionCacheRetired, func);
+        free_proc_info(func);
+    }
+}
+
+/*
+ * No calls are in progress at the end of the transaction. Pins left by the
+ * errors that have skipped function_cache_unpin() are dropped here
+ */
+void function_cache_end_xact() {
+    plcFunctionCacheEntry *entry;
+    ListCell              *cell;
+
+    for (entry = plcFunctionCacheHead; entry != NULL; entry = entry->next) {
+        entry->proc->pins = 0;
+    }
+    foreach(cell, plcFunctionCacheRetired) {
+        free_proc_info((plcProcInfo*)lfirst(cell));
+    }
+    list_free(plcFunctionCacheRetired);
+    plcFunctionCacheRetired = NIL;
+}
+
+/*
+ * Returns the cache counters of the current session
+ */
+Datum function_cache_stats(PG_FUNCTION_ARGS) {
+    TupleDesc tupdesc;
+    Datum     values[6];
+    bool      nulls[6];
+    HeapTuple tuple;
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+        elog(ERROR, "Function returning record called in context that cannot accept type record");
+    }
+    tupdesc = BlessTupleDesc(tupdesc);
+
+    memset(nulls, 0, sizeof(nulls));
+    values[0] = Int64GetDatum(plcFunctionCacheHits);
+    values[1] = Int64GetDatum(plcFunctionCacheMisses);
+    values[2] = Int64GetDatum(plcFunctionCacheEvictions);
+    values[3] = Int64GetDatum(plcFunctionCacheInvalidations);
+    values[4] = Int32GetDatum(plcFunctionCache != NULL ? (int)hash_get_num_entries(plcFunctionCache) : 0);
+    values[5] = Int32GetDatum(plc_function_cache_size);
+
+    tuple = heap_form_tuple(tupdesc, values, nulls);
+    PG_RETURN_DATUM(HeapTupleGetDatum(tuple));
+}
@@ -11,10 +11,16 @@
 
 #include "message_fns.h"
 
-#define PLC_FUNCTION_CACHE_SIZE 5
+/* Default for plcontainer.function_cache_size */
+#define PLC_FUNCTION_CACHE_SIZE 100
 
-void function_cache_up(int index);
+extern int plc_function_cache_size;
+
+void function_cache_init(void);
 plcProcInfo *function_cache_get(Oid funcOid);
 void function_cache_put(plcProcInfo *func);
+void function_cache_unpin(plcProcInfo *func);
+void function_cache_end_xact(void);
+Datum function_cache_stats(PG_FUNCTION_ARGS);
 
 #endif /* PLC_FUNCTION_CACHE_H */
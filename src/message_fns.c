@@ -34,6 +34,8 @@ interpreted as representing official policies, either expressed or implied, of t
 #include "postgres.h"
 #include "executor/spi.h"
 #include "access/transam.h"
+#include "catalog/pg_proc.h"
+#include "funcapi.h"
 
 /* message and function definitions */
 #include "common/comm_utils.h"
@@ -42,124 +44,112 @@ interpreted as representing official policies, either expressed or implied, of t
 #include "function_cache.h"
 #include "plc_typeio.h"
 
-static bool plc_procedure_valid(plcProcInfo *proc, HeapTuple procTup);
+static bool plc_procedure_valid(plcProcInfo *proc);
 static bool plc_type_valid(plcTypeInfo *type);
 static void fill_callreq_arguments(FunctionCallInfo fcinfo, plcProcInfo *pinfo, plcMsgCallreq *req);
 
 plcProcInfo * get_proc_info(FunctionCallInfo fcinfo) {
-    int           i, len;
-    Datum        *argnames = NULL;
-    bool         *argnulls = NULL;
-    Datum         argnamesArray;
+    int           i, nall;
+    Oid          *allargtypes;
+    char        **allargnames;
+    char         *allargmodes;
     Datum         srcdatum, namedatum;
     bool          isnull;
     Oid           procoid;
     Form_pg_proc  procTup;
-    HeapTuple     procHeapTup,
-                  textHeapTup = NULL;
-    Form_pg_type  typeTup;
+    HeapTuple     procHeapTup;
     plcProcInfo  *pinfo = NULL;
 
     procoid = fcinfo->flinfo->fn_oid;
+
+    /*
+     * Changes of the pg_proc tuple invalidate the cache entry, so the catalog
+     * is not touched at all while the cached function stays valid
+     */
+    pinfo = function_cache_get(procoid);
+    if (plc_procedure_valid(pinfo)) {
+        pinfo->hasChanged = 0;
+        pinfo->pins += 1;
+        return pinfo;
+    }
+
     procHeapTup = SearchSysCache(PROCOID, procoid, 0, 0, 0);
     if (!HeapTupleIsValid(procHeapTup)) {
         elog(ERROR, "cannot find proc with oid %u", procoid);
     }
 
-    pinfo   = function_cache_get(procoid);
     /*
-     * All the catalog operations are done only if the cached function
-     * information has changed in the catalog
+     * Here we are using plc_top_alloc as the function structure should be
+     * available across the function handler call
+     *
+     * Note: we free the procedure from within function_put_cache below
      */
-    if (!plc_procedure_valid(pinfo, procHeapTup)) {
-
-        /*
-         * Here we are using plc_top_alloc as the function structure should be
-         * available across the function handler call
-         *
-         * Note: we free the procedure from within function_put_cache below
-         */
-        pinfo = plc_top_alloc(sizeof(plcProcInfo));
-        if (pinfo == NULL) {
-            elog(FATAL, "Cannot allocate memory for plcProcInfo structure");
+    pinfo = plc_top_alloc(sizeof(plcProcInfo));
+    if (pinfo == NULL) {
+        elog(FATAL, "Cannot allocate memory for plcProcInfo structure");
+    }
+    /* Remember transactional information to allow caching */
+    pinfo->funcOid = procoid;
+    pinfo->fn_xmin = HeapTupleHeaderGetXmin(procHeapTup->t_data);
+    pinfo->fn_tid  = procHeapTup->t_self;
+    pinfo->retset  = fcinfo->flinfo->fn_retset;
+    pinfo->hasChanged = 1;
+    pinfo->pins    = 0;
+
+    procTup = (Form_pg_proc)GETSTRUCT(procHeapTup);
+    fill_type_info(fcinfo, procTup->prorettype, -1, &pinfo->rettype);
+
+    pinfo->nargs = procTup->pronargs;
+    if (pinfo->nargs > 0) {
+        // This is required to avoid the cycle from being removed by optimizer
+        int volatile j;
+
+        pinfo->argtypes = plc_top_alloc(pinfo->nargs * sizeof(plcTypeInfo));
+        for (j = 0; j < pinfo->nargs; j++) {
+            fill_type_info(fcinfo, procTup->proargtypes.values[j], -1, &pinfo->argtypes[j]);
         }
-        /* Remember transactional information to allow caching */
-        pinfo->funcOid = procoid;
-        pinfo->fn_xmin = HeapTupleHeaderGetXmin(procHeapTup->t_data);
-        pinfo->fn_tid  = procHeapTup->t_self;
-        pinfo->retset  = fcinfo->flinfo->fn_retset;
-        pinfo->hasChanged = 1;
-
-        procTup = (Form_pg_proc)GETSTRUCT(procHeapTup);
-        fill_type_info(fcinfo, procTup->prorettype, &pinfo->rettype);
-
-        pinfo->nargs = procTup->pronargs;
-        if (pinfo->nargs > 0) {
-            // This is required to avoid the cycle from being removed by optimizer
-            int volatile j;
-
-            pinfo->argtypes = plc_top_alloc(pinfo->nargs * sizeof(plcTypeInfo));
-            for (j = 0; j < pinfo->nargs; j++) {
-                fill_type_info(fcinfo, procTup->proargtypes.values[j], &pinfo->argtypes[j]);
-            }
 
-            argnamesArray = SysCacheGetAttr(PROCOID, procHeapTup,
-                                            Anum_pg_proc_proargnames, &isnull);
-            /* If at least some arguments have names */
-            if (!isnull) {
-                textHeapTup = SearchSysCache(TYPEOID, ObjectIdGetDatum(TEXTOID), 0, 0, 0);
-                if (!HeapTupleIsValid(textHeapTup)) {
-                    elog(FATAL, "cannot find text type in cache");
-                }
-                typeTup = (Form_pg_type)GETSTRUCT(textHeapTup);
-                deconstruct_array(DatumGetArrayTypeP(argnamesArray), TEXTOID,
-                                  typeTup->typlen, typeTup->typbyval, typeTup->typalign,
-                                  &argnames, &argnulls, &len);
-                if (len != pinfo->nargs) {
-                    elog(FATAL, "something bad happened, nargs != len");
-                }
+        /* Argument names include OUT arguments which are not passed to
+         * the function, so they are filtered by argument modes */
+        nall = get_func_arg_info(procHeapTup, &allargtypes, &allargnames, &allargmodes);
+        pinfo->argnames = plc_top_alloc(pinfo->nargs * sizeof(char*));
+        for (i = 0, j = 0; i < nall && j < pinfo->nargs; i++) {
+            if (allargmodes != NULL && (allargmodes[i] == PROARGMODE_OUT
+#ifdef PROARGMODE_TABLE
+                                        || allargmodes[i] == PROARGMODE_TABLE
+#endif
+                                       )) {
+                continue;
             }
-
-            pinfo->argnames = plc_top_alloc(pinfo->nargs * sizeof(char*));
-            for (i = 0; i < pinfo->nargs; i++) {
-                if (!isnull && !argnulls[i]) {
-                    pinfo->argnames[i] =
-                        plc_top_strdup(DatumGetCString(
-                                DirectFunctionCall1(textout, argnames[i])
-                            ));
-                    if (strlen(pinfo->argnames[i]) == 0) {
-                        pfree(pinfo->argnames[i]);
-                        pinfo->argnames[i] = NULL;
-                    }
-                } else {
-                    pinfo->argnames[i] = NULL;
-                }
+            if (allargnames != NULL && allargnames[i] != NULL && strlen(allargnames[i]) > 0) {
+                pinfo->argnames[j] = plc_top_strdup(allargnames[i]);
+            } else {
+                pinfo->argnames[j] = NULL;
             }
-
-            if (textHeapTup != NULL) {
-                ReleaseSysCache(textHeapTup);
-            }
-        } else {
-            pinfo->argtypes = NULL;
-            pinfo->argnames = NULL;
+            j += 1;
+        }
+        if (j != pinfo->nargs) {
+            elog(FATAL, "something bad happened, nargs != number of input arguments");
         }
-
-        /* Get the text and name of the function */
-        srcdatum = SysCacheGetAttr(PROCOID, procHeapTup, Anum_pg_proc_prosrc, &isnull);
-        if (isnull)
-            elog(ERROR, "null prosrc");
-        pinfo->src = plc_top_strdup(DatumGetCString(DirectFunctionCall1(textout, srcdatum)));
-        namedatum = SysCacheGetAttr(PROCOID, procHeapTup, Anum_pg_proc_proname, &isnull);
-        if (isnull)
-            elog(ERROR, "null proname");
-        pinfo->name = plc_top_strdup(DatumGetCString(DirectFunctionCall1(nameout, namedatum)));
-
-        /* Cache the function for later use */
-        function_cache_put(pinfo);
     } else {
-        pinfo->hasChanged = 0;
+        pinfo->argtypes = NULL;
+        pinfo->argnames = NULL;
     }
+
+    /* Get the text and name of the function */
+    srcdatum = SysCacheGetAttr(PROCOID, procHeapTup, Anum_pg_proc_prosrc, &isnull);
+    if (isnull)
+        elog(ERROR, "null prosrc");
+    pinfo->src = plc_top_strdup(DatumGetCString(DirectFunctionCall1(textout, srcdatum)));
+    namedatum = SysCacheGetAttr(PROCOID, procHeapTup, Anum_pg_proc_proname, &isnull);
+    if (isnull)
+        elog(ERROR, "null proname");
+    pinfo->name = plc_top_strdup(DatumGetCString(DirectFunctionCall1(nameout, namedatum)));
+
+    /* Cache the function for later use */
+    function_cache_put(pinfo);
     ReleaseSysCache(procHeapTup);
+    pinfo->pins += 1;
     return pinfo;
 }
 
@@ -186,6 +176,8 @@ plcMsgCallreq *plcontainer_create_call(FunctionCallInfo fcinfo, plcProcInfo *pin
     req->proc.name = pinfo->name;
     req->proc.src  = pinfo->src;
     req->objectid  = pinfo->funcOid;
+    req->version   = pinfo->fn_xmin;
+    req->seq       = 0;
     req->hasChanged = pinfo->hasChanged;
     copy_type_info(&req->retType, &pinfo->rettype);
 
@@ -232,26 +224,23 @@ static bool plc_type_valid(plcTypeInfo *type) {
 /*
  * Decide whether a cached PLyProcedure struct is still valid
  */
-static bool plc_procedure_valid(plcProcInfo *proc, HeapTuple procTup) {
+static bool plc_procedure_valid(plcProcInfo *proc) {
     bool valid = false;
 
+    /* Changes of the pg_proc tuple are handled by the function cache */
     if (proc != NULL) {
-        /* If the pg_proc tuple has changed, it's not valid */
-        if (proc->fn_xmin == HeapTupleHeaderGetXmin(procTup->t_data) &&
-            ItemPointerEquals(&proc->fn_tid, &procTup->t_self)) {
-            int  i;
+        int  i;
 
-            valid = true;
+        valid = true;
 
-            // If there are composite input arguments, they might have changed
-            for (i = 0; i < proc->nargs && valid; i++) {
-                valid = plc_type_valid(&proc->argtypes[i]);
-            }
+        // If there are composite input arguments, they might have changed
+        for (i = 0; i < proc->nargs && valid; i++) {
+            valid = plc_type_valid(&proc->argtypes[i]);
+        }
 
-            // Also check for composite output type
-            if (valid) {
-                valid = plc_type_valid(&proc->rettype);
-            }
+        // Also check for composite output type
+        if (valid) {
+            valid = plc_type_valid(&proc->rettype);
         }
     }
     return valid;
@@ -273,7 +262,7 @@ static void fill_callreq_arguments(FunctionCallInfo fcinfo, plcProcInfo *pinfo,
             req->args[i].data.value = NULL;
         } else {
             req->args[i].data.isnull = 0;
-            req->args[i].data.value = pinfo->argtypes[i].outfunc(fcinfo->arg[i], &pinfo->argtypes[i]);
+            pinfo->argtypes[i].outfunc(fcinfo->arg[i], &pinfo->argtypes[i], &req->args[i].data);
         }
     }
 }
\ No newline at end of file
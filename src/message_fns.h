@@ -26,6 +26,7 @@ interpreted as representing official policies, either expressed or implied, of t
 #include "postgres.h"
 #include "fmgr.h"
 
+#include "common/comm_connectivity.h"
 #include "common/messages/messages.h"
 #include "plc_typeio.h"
 
@@ -33,6 +34,10 @@ interpreted as representing official policies, either expressed or implied, of t
 typedef struct {
     plcMsgResult    *resmsg;
     int              resrow;
+    plcConn         *conn;      /* connection the next result chunk comes from */
+    unsigned int     seq;       /* sequence number of the call on the connection */
+    int              requested; /* chunks requested and not received yet */
+    struct plcResultStream *stream; /* entry closed on abort, NULL if none */
 } plcProcResult;
 
 typedef struct {
@@ -49,8 +54,10 @@ typedef struct {
     int              nargs;
     char           **argnames;
     plcTypeInfo     *argtypes;
+    int              pins;    /* calls in progress, it is not freed while they run */
 } plcProcInfo;
 
+/* Returned function is pinned until function_cache_unpin() is called */
 plcProcInfo *get_proc_info(FunctionCallInfo fcinfo);
 void free_proc_info(plcProcInfo *proc);
 
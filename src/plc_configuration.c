@@ -7,27 +7,85 @@
  */
 
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 #include <libxml/tree.h>
 #include <libxml/parser.h>
 
 #include "postgres.h"
+#include "miscadmin.h"
+#include "libpq/md5.h"
 #include "utils/builtins.h"
 #include "utils/guc.h"
 
 #include "common/comm_utils.h"
+#include "common/comm_connectivity.h"
 #include "plcontainer.h"
 #include "plc_configuration.h"
+#include "containers.h"
+#include "function_cache.h"
 
 static plcContainer *plcContainerConf = NULL;
 static int plcNumContainers = 0;
 
 static int parse_container(xmlNode *node, plcContainer *cont);
+static char *parse_preload(const char *value);
+static int check_code_cache(plcContainer *cont);
+static int read_code_cache_secret(char *secret);
+static int get_code_cache_key(char *key, char *keyid);
 static plcContainer *get_containers(xmlNode *node, int *size);
 static void free_containers(plcContainer *cont, int size);
 static void print_containers(plcContainer *cont, int size);
 
 PG_FUNCTION_INFO_V1(read_plcontainer_config);
 
+/* Function returns the list of modules to preload with whitespaces removed,
+ * NULL if it contains anything but module names separated by commas. The list
+ * is passed to the container environment as is */
+static char *parse_preload(const char *value) {
+    char *res;
+    int   len = 0;
+    int   i;
+
+    res = plc_top_alloc(strlen(value) + 1);
+    for (i = 0; value[i] != '\0'; i++) {
+        char c = value[i];
+
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            continue;
+        }
+        if (!isalnum((unsigned char)c) && c != '_' && c != '.' && c != ',') {
+            pfree(res);
+            return NULL;
+        }
+        res[len++] = c;
+    }
+    res[len] = '\0';
+
+    return res;
+}
+
+/* Code cache directory should be a read-write shared directory or be
+ * located inside of one, otherwise the cache would not outlive the container */
+static int check_code_cache(plcContainer *cont) {
+    int i;
+
+    for (i = 0; i < cont->nSharedDirs; i++) {
+        size_t len = strlen(cont->sharedDirs[i].container);
+
+        if (cont->sharedDirs[i].mode == PLC_ACCESS_READWRITE &&
+                strncmp(cont->codeCache, cont->sharedDirs[i].container, len) == 0 &&
+                (cont->codeCache[len] == '\0' || cont->codeCache[len] == '/')) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
 /* Function parses the container XML definition and fills the passed
  * plcContainer structure that should be already allocated */
 static int parse_container(xmlNode *node, plcContainer *cont) {
@@ -41,6 +99,12 @@ static int parse_container(xmlNode *node, plcContainer *cont) {
     /* First iteration - parse name, container_id and memory_mb and count the
      * number of shared directories for later allocation of related structure */
     cont->memoryMb = -1;
+    cont->poolSize = 0;
+    cont->zygote = 0;
+    cont->preload = NULL;
+    cont->codeCache = NULL;
+    cont->user = NULL;
+    cont->transport = PLC_TRANSPORT_TCP;
     for (cur_node = node->children; cur_node; cur_node = cur_node->next) {
         if (cur_node->type == XML_ELEMENT_NODE) {
             int processed = 0;
@@ -73,6 +137,75 @@ static int parse_container(xmlNode *node, plcContainer *cont) {
                 cont->memoryMb = pg_atoi((char*)value, sizeof(int), 0);
             }
 
+            if (xmlStrcmp(cur_node->name, (const xmlChar *)"pool_size") == 0) {
+                processed = 1;
+                value = xmlNodeGetContent(cur_node);
+                cont->poolSize = pg_atoi((char*)value, sizeof(int), 0);
+                if (cont->poolSize < 0) {
+                    elog(ERROR, "Container pool size should not be negative, passed value is '%s'", value);
+                    return -1;
+                }
+            }
+
+            if (xmlStrcmp(cur_node->name, (const xmlChar *)"zygote") == 0) {
+                processed = 1;
+                value = xmlNodeGetContent(cur_node);
+                if (strcmp((char*)value, "yes") == 0) {
+                    cont->zygote = 1;
+                } else if (strcmp((char*)value, "no") == 0) {
+                    cont->zygote = 0;
+                } else {
+                    elog(ERROR, "Container zygote mode should be either 'yes' or 'no', passed value is '%s'", value);
+                    return -1;
+                }
+            }
+
+            if (xmlStrcmp(cur_node->name, (const xmlChar *)"preload") == 0) {
+                processed = 1;
+                value = xmlNodeGetContent(cur_node);
+                cont->preload = parse_preload((char*)value);
+                if (cont->preload == NULL) {
+                    elog(ERROR, "Container preload should be a comma-separated list of module names, passed value is '%s'", value);
+                    return -1;
+                }
+            }
+
+            if (xmlStrcmp(cur_node->name, (const xmlChar *)"code_cache") == 0) {
+                processed = 1;
+                value = xmlNodeGetContent(cur_node);
+                if (value[0] != '/' || strchr((char*)value, '"') != NULL) {
+                    elog(ERROR, "Container code cache should be an absolute path, passed value is '%s'", value);
+                    return -1;
+                }
+                cont->codeCache = plc_top_strdup((char*)value);
+            }
+
+            if (xmlStrcmp(cur_node->name, (const xmlChar *)"user") == 0) {
+                processed = 1;
+                value = xmlNodeGetContent(cur_node);
+                if (value[0] == '\0' || strspn((char*)value, "abcdefghijklmnopqrstuvwxyz"
+                        "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.-") != strlen((char*)value)) {
+                    elog(ERROR, "Container user should be a user name or ID, passed value is '%s'", value);
+                    return -1;
+                }
+                cont->user = plc_top_strdup((char*)value);
+            }
+
+            if (xmlStrcmp(cur_node->name, (const xmlChar *)"transport") == 0) {
+                processed = 1;
+                value = xmlNodeGetContent(cur_node);
+                if (strcmp((char*)value, "tcp") == 0) {
+                    cont->transport = PLC_TRANSPORT_TCP;
+                } else if (strcmp((char*)value, "unix") == 0) {
+                    cont->transport = PLC_TRANSPORT_UNIX;
+                } else if (strcmp((char*)value, "shm") == 0) {
+                    cont->transport = PLC_TRANSPORT_SHM;
+                } else {
+                    elog(ERROR, "Container transport should be one of 'tcp', 'unix' or 'shm', passed value is '%s'", value);
+                    return -1;
+                }
+            }
+
             if (xmlStrcmp(cur_node->name, (const xmlChar *)"shared_directory") == 0) {
                 num_shared_dirs += 1;
                 processed = 1;
@@ -107,6 +240,18 @@ static int parse_container(xmlNode *node, plcContainer *cont) {
         return -1;
     }
 
+    /* Shared memory file holds the rings of a single connection */
+    if (cont->zygote && cont->transport == PLC_TRANSPORT_SHM) {
+        elog(ERROR, "Container zygote mode cannot be used with 'shm' transport");
+        return -1;
+    }
+
+    /* Code cache key is given to the container of a single session */
+    if (cont->codeCache != NULL && (cont->zygote || cont->poolSize > 0)) {
+        elog(ERROR, "Container code cache cannot be used with zygote mode or pool");
+        return -1;
+    }
+
     /* Process the shared directories */
     cont->nSharedDirs = num_shared_dirs;
     cont->sharedDirs = NULL;
@@ -157,6 +302,12 @@ static int parse_container(xmlNode *node, plcContainer *cont) {
         }
     }
 
+    if (cont->codeCache != NULL && check_code_cache(cont) < 0) {
+        elog(ERROR, "Container code cache '%s' should be inside of a shared directory"
+             " with 'rw' access", cont->codeCache);
+        return -1;
+    }
+
     return 0;
 }
 
@@ -230,6 +381,18 @@ static void print_containers(plcContainer *cont, int size) {
         elog(INFO, "Container '%s' configuration", cont[i].name);
         elog(INFO, "    container_id = '%s'", cont[i].dockerid);
         elog(INFO, "    memory_mb = '%d'", cont[i].memoryMb);
+        elog(INFO, "    transport = '%s'", plc_get_transport_name(cont[i].transport));
+        elog(INFO, "    pool_size = '%d'", cont[i].poolSize);
+        elog(INFO, "    zygote = '%s'", cont[i].zygote ? "yes" : "no");
+        if (cont[i].preload != NULL) {
+            elog(INFO, "    preload = '%s'", cont[i].preload);
+        }
+        if (cont[i].codeCache != NULL) {
+            elog(INFO, "    code_cache = '%s'", cont[i].codeCache);
+        }
+        if (cont[i].user != NULL) {
+            elog(INFO, "    user = '%s'", cont[i].user);
+        }
         for (j = 0; j < cont[i].nSharedDirs; j++) {
             elog(INFO, "    shared directory from host '%s' to container '%s'",
                  cont[i].sharedDirs[j].host,
@@ -321,16 +484,172 @@ plcContainer *plc_get_container_config(char *name) {
     return result;
 }
 
-char *get_sharing_options(plcContainer *cont) {
+const char *plc_get_transport_name(plcTransportType transport) {
+    switch (transport) {
+        case PLC_TRANSPORT_UNIX:
+            return "unix";
+        case PLC_TRANSPORT_SHM:
+            return "shm";
+        default:
+            return "tcp";
+    }
+}
+
+/* Function returns the container environment telling the client how many
+ * functions to cache and where to keep compiled code, which transport to
+ * use, whether to run as zygote and how long to wait for the connection when
+ * the container outlives a single session */
+char *get_transport_options(plcContainer *cont, char *udsdir) {
+    char *res;
+
+    res = palloc(160 + strlen(PLC_TRANSPORT_ENV) + strlen(PLC_CONNECT_TIMEOUT_ENV)
+                    + strlen(PLC_ZYGOTE_ENV) + strlen(PLC_PRELOAD_ENV)
+                    + strlen(PLC_FUNCTION_CACHE_SIZE_ENV) + strlen(PLC_CODE_CACHE_ENV)
+                    + strlen(PLC_CODE_CACHE_KEY_ENV)
+                    + (cont->preload != NULL ? strlen(cont->preload) : 0)
+                    + (cont->codeCache != NULL ? strlen(cont->codeCache) : 0));
+    sprintf(res, "\"%s=%d\"", PLC_FUNCTION_CACHE_SIZE_ENV, plc_function_cache_size);
+    if (udsdir != NULL && cont->transport != PLC_TRANSPORT_TCP) {
+        sprintf(res + strlen(res), ",\"%s=%s\"", PLC_TRANSPORT_ENV,
+                plc_get_transport_name(cont->transport));
+    }
+    if (cont->zygote) {
+        sprintf(res + strlen(res), ",\"%s=yes\"", PLC_ZYGOTE_ENV);
+    }
+    if (cont->preload != NULL) {
+        sprintf(res + strlen(res), ",\"%s=%s\"", PLC_PRELOAD_ENV, cont->preload);
+    }
+    if (cont->codeCache != NULL) {
+        char key[33];
+        char keyid[33];
+
+        if (get_code_cache_key(key, keyid) == 0) {
+            sprintf(res + strlen(res), ",\"%s=%s/%.16s\",\"%s=%s\"",
+                    PLC_CODE_CACHE_ENV, cont->codeCache, keyid,
+                    PLC_CODE_CACHE_KEY_ENV, key);
+        }
+    }
+    if (cont->poolSize > 0 || cont->zygote) {
+        sprintf(res + strlen(res), ",\"%s=%d\"", PLC_CONNECT_TIMEOUT_ENV,
+                CONTAINER_POOL_IDLE_TIMEOUT_SEC);
+    }
+    return res;
+}
+
+/*
+ * Secret the code cache keys are derived from is generated once for the data
+ * directory and is readable only by the database user. File is written under
+ * the temporary name and linked, so the backends starting at the same time
+ * read the same secret
+ */
+static int read_code_cache_secret(char *secret) {
+    char        path[MAXPGPATH];
+    char        tmppath[MAXPGPATH];
+    char        random[16];
+    struct stat st;
+    int         fd;
+    int         i;
+
+    snprintf(path, sizeof(path), "%s/%s", DataDir, PLC_CODE_CACHE_SECRET_FILE);
+    fd = open(path, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0 && errno == ENOENT) {
+        fd = open("/dev/urandom", O_RDONLY);
+        if (fd < 0 || read(fd, random, sizeof(random)) != sizeof(random)) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+        close(fd);
+        for (i = 0; i < (int)sizeof(random); i++) {
+            sprintf(secret + 2 * i, "%02x", (unsigned char)random[i]);
+        }
+
+        snprintf(tmppath, sizeof(tmppath), "%s.%d", path, (int)getpid());
+        fd = open(tmppath, O_WRONLY | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            return -1;
+        }
+        if (write(fd, secret, 32) != 32 || close(fd) != 0) {
+            unlink(tmppath);
+            return -1;
+        }
+        if (link(tmppath, path) < 0 && errno != EEXIST) {
+            unlink(tmppath);
+            return -1;
+        }
+        unlink(tmppath);
+        fd = open(path, O_RDONLY | O_NOFOLLOW);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid()
+            || (st.st_mode & 077) != 0 || read(fd, secret, 32) != 32) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    secret[32] = '\0';
+    return 0;
+}
+
+/*
+ * Code cache files are signed with the key of the current role and database,
+ * so the containers of other roles sharing the directory cannot substitute
+ * the code. Key ID names the cache subdirectory
+ */
+static int get_code_cache_key(char *key, char *keyid) {
+    char secret[33];
+    char buf[80];
+
+    if (read_code_cache_secret(secret) < 0) {
+        elog(WARNING, "Cannot read the code cache secret file '%s' in the data directory, "
+                      "code cache is not used", PLC_CODE_CACHE_SECRET_FILE);
+        return -1;
+    }
+
+    snprintf(buf, sizeof(buf), "%s:%u:%u", secret, MyDatabaseId, GetUserId());
+    if (!pg_md5_hash(buf, strlen(buf), key) || !pg_md5_hash(key, strlen(key), keyid)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Client listening on the socket in the directory owned by the database user
+ * runs under the group of the database user, so nobody else can access the
+ * socket. It runs under the database user as well, unless the user of the
+ * image is configured. Client using TCP runs under the configured user or
+ * the user of the image */
+char *get_user_options(plcContainer *cont, char *udsdir) {
+    char *res = palloc(32 + (cont->user != NULL ? strlen(cont->user) : 0));
+
+    res[0] = '\0';
+    if (udsdir != NULL && cont->user != NULL) {
+        sprintf(res, "%s:%d", cont->user, (int)getegid());
+    } else if (udsdir != NULL) {
+        sprintf(res, "%d:%d", (int)geteuid(), (int)getegid());
+    } else if (cont->user != NULL) {
+        strcpy(res, cont->user);
+    }
+    return res;
+}
+
+/* Function returns the list of directories bind-mounted to the container.
+ * When the container uses Unix domain socket transport, the directory on the
+ * host holding the socket file is mounted as well */
+char *get_sharing_options(plcContainer *cont, char *udsdir) {
     char *res = NULL;
+    int nvolumes = cont->nSharedDirs + (udsdir != NULL ? 1 : 0);
 
-    if (cont->nSharedDirs > 0) {
+    if (nvolumes > 0) {
         char **volumes = NULL;
         int totallen = 0;
         char *pos;
         int i;
 
-        volumes = palloc(cont->nSharedDirs * sizeof(char*));
+        volumes = palloc(nvolumes * sizeof(char*));
         for (i = 0; i < cont->nSharedDirs; i++) {
             volumes[i] = palloc(10 + strlen(cont->sharedDirs[i].host) +
                                  strlen(cont->sharedDirs[i].container));
@@ -345,14 +664,21 @@ char *get_sharing_options(plcContainer *cont) {
             }
             totallen += strlen(volumes[i]);
         }
+        if (udsdir != NULL) {
+            volumes[i] = palloc(10 + strlen(udsdir) + strlen(PLC_UDS_CONTAINER_DIR));
+            sprintf(volumes[i], "\"%s:%s:rw\"", udsdir, PLC_UDS_CONTAINER_DIR);
+            totallen += strlen(volumes[i]);
+        }
 
-        res = palloc(totallen + 2*cont->nSharedDirs);
+        res = palloc(totallen + 2*nvolumes);
         pos = res;
-        for (i = 0; i < cont->nSharedDirs; i++) {
+        for (i = 0; i < nvolumes; i++) {
+            if (i > 0) {
+                *pos = ',';
+                pos += 1;
+            }
             memcpy(pos, volumes[i], strlen(volumes[i]));
             pos += strlen(volumes[i]);
-            *pos = ' ';
-            pos += 1;
             pfree(volumes[i]);
         }
         *pos = '\0';
@@ -16,11 +16,20 @@
 
 #define PLC_PROPERTIES_FILE "plcontainer_configuration.xml"
 
+/* File in the data directory with the secret code cache keys derive from */
+#define PLC_CODE_CACHE_SECRET_FILE "pg_plcontainer_code_key"
+
 typedef enum {
     PLC_ACCESS_READONLY  = 0,
     PLC_ACCESS_READWRITE = 1
 } plcFsAccessMode;
 
+typedef enum {
+    PLC_TRANSPORT_TCP  = 0,
+    PLC_TRANSPORT_UNIX = 1,
+    PLC_TRANSPORT_SHM  = 2
+} plcTransportType;
+
 typedef struct plcSharedDir {
     char            *host;
     char            *container;
@@ -32,6 +41,12 @@ typedef struct plcContainer {
     char         *dockerid;
     char         *command;
     int           memoryMb;
+    int           poolSize;
+    int           zygote;
+    char         *preload;
+    char         *codeCache;
+    char         *user;
+    plcTransportType transport;
     int           nSharedDirs;
     plcSharedDir *sharedDirs;
 } plcContainer;
@@ -40,6 +55,9 @@ typedef struct plcContainer {
 Datum read_plcontainer_config(PG_FUNCTION_ARGS);
 int plc_read_container_config(bool verbose);
 plcContainer *plc_get_container_config(char *name);
-char *get_sharing_options(plcContainer *cont);
+char *get_sharing_options(plcContainer *cont, char *udsdir);
+char *get_transport_options(plcContainer *cont, char *udsdir);
+char *get_user_options(plcContainer *cont, char *udsdir);
+const char *plc_get_transport_name(plcTransportType transport);
 
 #endif /* PLC_CONFIGURATION_H */
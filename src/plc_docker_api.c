@@ -18,6 +18,7 @@
 
 #include "plc_docker_api.h"
 #include "plc_configuration.h"
+#include "common/comm_connectivity.h"
 
 /* Templates for Docker API communication */
 
@@ -58,11 +59,13 @@ static char *plc_docker_create_request =
         "    \"Tty\": false,\n"
         "    \"Cmd\": [\"%s\"],\n"
         "    \"Image\": \"%s\",\n"
+        "    \"User\": \"%s\",\n"
         "    \"DisableNetwork\": false,\n"
+        "    \"Env\": [%s],\n"
         "    \"HostConfig\": {\n"
         "        \"Binds\": [%s],\n"
         "        \"Memory\": %lld,\n"
-        "        \"PublishAllPorts\": true\n"
+        "        \"PublishAllPorts\": %s\n"
         "    }\n"
         "}\n";
 
@@ -457,12 +460,14 @@ int plc_docker_connect() {
     return sockfd;
 }
 
-int plc_docker_create_container(int sockfd, plcContainer *cont, char **name) {
+int plc_docker_create_container(int sockfd, plcContainer *cont, char **name, char *udsdir) {
     char *message      = NULL;
     char *message_body = NULL;
     char *apiendpoint  = NULL;
     char *response     = NULL;
     char *sharing      = NULL;
+    char *env          = NULL;
+    char *user         = NULL;
     char *apiendpointtemplate = "/%s/containers/create";
     int   res = 0;
 
@@ -473,15 +478,21 @@ int plc_docker_create_container(int sockfd, plcContainer *cont, char **name) {
             plc_docker_api_version);
 
     /* Get Docket API "create" call JSON message body */
-    sharing = get_sharing_options(cont);
-    message_body = palloc(40 + strlen(plc_docker_create_request) + strlen(cont->command)
-                             + strlen(cont->dockerid) + strlen(sharing));
+    sharing = get_sharing_options(cont, udsdir);
+    env = get_transport_options(cont, udsdir);
+    user = get_user_options(cont, udsdir);
+    message_body = palloc(50 + strlen(plc_docker_create_request) + strlen(cont->command)
+                             + strlen(cont->dockerid) + strlen(user) + strlen(sharing)
+                             + strlen(env));
     sprintf(message_body,
             plc_docker_create_request,
             cont->command,
             cont->dockerid,
+            user,
+            env,
             sharing,
-            ((long long)cont->memoryMb) * 1024 * 1024);
+            ((long long)cont->memoryMb) * 1024 * 1024,
+            (udsdir != NULL) ? "false" : "true");
 
     /* Fill in the HTTP message */
     message = palloc(40 + strlen(plc_docker_post_message_json) + strlen(apiendpoint)
@@ -496,6 +507,8 @@ int plc_docker_create_container(int sockfd, plcContainer *cont, char **name) {
 
     pfree(apiendpoint);
     pfree(sharing);
+    pfree(env);
+    pfree(user);
     pfree(message_body);
     pfree(message);
 
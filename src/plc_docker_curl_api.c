@@ -14,6 +14,7 @@
 
 #include "plc_docker_curl_api.h"
 #include "plc_configuration.h"
+#include "common/comm_connectivity.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -303,7 +304,7 @@ int plc_docker_connect() {
     return 8080;
 }
 
-int plc_docker_create_container(int sockfd UNUSED, plcContainer *cont, char **name) {
+int plc_docker_create_container(int sockfd UNUSED, plcContainer *cont, char **name, char *udsdir) {
     char *createRequest =
             "{\n"
             "    \"AttachStdin\": false,\n"
@@ -312,27 +313,35 @@ int plc_docker_create_container(int sockfd UNUSED, plcContainer *cont, char **na
             "    \"Tty\": false,\n"
             "    \"Cmd\": [\"%s\"],\n"
             "    \"Image\": \"%s\",\n"
+            "    \"User\": \"%s\",\n"
             "    \"DisableNetwork\": false,\n"
+            "    \"Env\": [%s],\n"
             "    \"HostConfig\": {\n"
             "        \"Binds\": [%s],\n"
             "        \"Memory\": %lld,\n"
-            "        \"PublishAllPorts\": true\n"
+            "        \"PublishAllPorts\": %s\n"
             "    }\n"
             "}\n";
-    char *volumeShare = get_sharing_options(cont);
+    char *volumeShare = get_sharing_options(cont, udsdir);
+    char *env = get_transport_options(cont, udsdir);
+    char *user = get_user_options(cont, udsdir);
     char *messageBody = NULL;
     plcCurlBuffer *response = NULL;
     int res = 0;
 
     /* Get Docket API "create" call JSON message body */
-    messageBody = palloc(40 + strlen(createRequest) + strlen(cont->command)
-                            + strlen(cont->dockerid) + strlen(volumeShare));
+    messageBody = palloc(50 + strlen(createRequest) + strlen(cont->command)
+                            + strlen(cont->dockerid) + strlen(user) + strlen(volumeShare)
+                            + strlen(env));
     sprintf(messageBody,
             createRequest,
             cont->command,
             cont->dockerid,
+            user,
+            env,
             volumeShare,
-            ((long long)cont->memoryMb) * 1024 * 1024);
+            ((long long)cont->memoryMb) * 1024 * 1024,
+            (udsdir != NULL) ? "false" : "true");
 
     /* Make a call */
     response = plcCurlRESTAPICall(PLC_CALL_POST, "/containers/create", messageBody, 201, false);
@@ -341,6 +350,8 @@ int plc_docker_create_container(int sockfd UNUSED, plcContainer *cont, char **na
     /* Free up intermediate data */
     pfree(messageBody);
     pfree(volumeShare);
+    pfree(env);
+    pfree(user);
 
     if (res == 0) {
         res = docker_parse_container_id(response->data, name);
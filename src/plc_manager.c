@@ -0,0 +1,1211 @@
+/*------------------------------------------------------------------------------
+ *
+ *
+ * Copyright (c) 2016, Pivotal.
+ *
+ *------------------------------------------------------------------------------
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/pg_shmem.h"
+#include "storage/proc.h"
+#include "utils/memutils.h"
+#include "utils/ps_status.h"
+
+#include "common/comm_utils.h"
+#include "common/comm_connectivity.h"
+#include "common/comm_shm.h"
+#include "plc_configuration.h"
+#include "containers.h"
+#include "plc_manager.h"
+
+#ifdef CURL_DOCKER_API
+    #include "plc_docker_curl_api.h"
+#else
+    #include "plc_docker_api.h"
+#endif
+
+/*
+ * Container manager is a process serving all the backends of the segment. It
+ * owns the Docker API interaction and the lifecycle of the containers, keeps
+ * the pools of containers with established connections and connects to the
+ * starting containers without blocking, polling their answers together with
+ * the requests. Backend asks for the container by name over
+ * the Unix domain socket and gets back the descriptor of the connection to
+ * the client. Backend keeps the socket open while using the container and the
+ * manager removes the container once the socket is closed
+ */
+
+typedef struct plcManagerRequest {
+    char name[PLC_MANAGER_NAME_LEN];
+} plcManagerRequest;
+
+typedef struct plcManagerReply {
+    int  status;                        // 0 on success, descriptor is attached
+    int  transport;                     // transport used by the container
+    unsigned int features;              // features negotiated with the client
+    unsigned int maxMessage;            // largest message the client accepts
+    char udsdir[PLC_MANAGER_PATH_LEN];  // socket directory, empty for TCP
+    char error[PLC_MANAGER_ERROR_LEN];  // error message on failure
+} plcManagerReply;
+
+typedef struct {
+    char    *name;
+    char    *dockerid;
+    char    *udsdir;
+    int      port;
+    int      transport;
+    int      zygote;    // container serves all the backends
+    int      starting;  // container has not answered yet
+    plcConn *conn;      // connection owned by the manager until handed over
+    int      ctlfd;     // socket of the backend using or waiting for the container
+} managed_t;
+
+/* Connection attempt to the starting container. The ping is sent without
+ * waiting and the answer is polled with everything else */
+typedef struct {
+    int          slot;      // container being connected to, -1 if not used
+    int          reqfd;     // backend waiting for the zygote connection
+    int          replace;   // zygote is replaced if it does not answer
+    plcConn     *conn;      // connection with the ping sent, NULL between tries
+    plcShm      *shm;       // rings reset for the connection
+    unsigned int backoff;   // delay before the next try, ms
+    int64        retry;     // time of the next try, ms
+    int64        deadline;  // time to give up, ms
+} attempt_t;
+
+typedef struct {
+    int                sock;
+    plcManagerRequest  req;
+    plcContainer      *cont;
+} request_t;
+
+static managed_t    *managed = NULL;
+static attempt_t     attempts[PLC_MANAGER_MAX_ATTEMPTS];
+static char         *pools[PLC_MANAGER_MAX_CONTAINERS];
+static time_t        poolfailure = 0;
+static MemoryContext managercxt = NULL;
+
+static int64 now_ms(void);
+static bool is_trusted_peer(int sock);
+static int send_fd(int sock, void *data, size_t len, int fd);
+static int receive_fd(int sock, void *data, size_t len, int *fd);
+static int wait_reply(int sock, plcManagerReply *reply, int *fd);
+static int connect_manager(void);
+static void launch_manager(void);
+static void manager_main(void) __attribute__((noreturn));
+static int manager_listen(void);
+static void manager_iteration(int listener);
+static int manager_poll_timeout(int timeout);
+static int manager_accept(int listener, request_t *reqs);
+static void manager_serve(request_t *reqs, int nreqs);
+static void manager_fill_pools(void);
+static bool manager_pools_full(void);
+static int manager_pool_size(const char *name);
+static plcContainer *manager_get_config(char *name);
+static int manager_create(plcContainer *cont);
+static void manager_attempt(int slot, int reqfd, int replace, unsigned int timeoutms);
+static void manager_check_attempts(void);
+static void manager_ping(attempt_t *a, int64 now);
+static void manager_answer(attempt_t *a);
+static void manager_connected(attempt_t *a);
+static void manager_give_up(attempt_t *a);
+static void manager_fail(int slot, int reqfd, const char *error);
+static void manager_serve_zygote(request_t *req);
+static void manager_replace_zygote(int slot);
+static bool is_pooled(int slot, const char *name);
+static void manager_reply(int sock, int slot, plcConn *conn, const char *error);
+static void manager_remove(int *slots, int nslots);
+static void manager_add_pool(char *name);
+
+static int64 now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Only the processes of the database user can be on the other side */
+static bool is_trusted_peer(int sock) {
+    struct ucred cred;
+    socklen_t    len = sizeof(cred);
+
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0
+            || len != sizeof(cred)) {
+        return false;
+    }
+    return cred.uid == geteuid();
+}
+
+/*
+ * Sends the data over the Unix domain socket, attaching the descriptor to it
+ * if fd is not negative
+ *
+ * Returns 0 on success, -1 on failure
+ */
+static int send_fd(int sock, void *data, size_t len, int fd) {
+    struct msghdr   msg;
+    struct iovec    iov;
+    char            control[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = data;
+    iov.iov_len  = len;
+    msg.msg_iov    = &iov;
+    msg.msg_iovlen = 1;
+
+    if (fd >= 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type  = SCM_RIGHTS;
+        cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+/*
+ * Receives the data sent by send_fd, fd is set to the received descriptor or
+ * -1 if no descriptor was attached
+ *
+ * Returns 0 on success, -1 on failure
+ */
+static int receive_fd(int sock, void *data, size_t len, int *fd) {
+    struct msghdr   msg;
+    struct iovec    iov;
+    char            control[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cmsg;
+    ssize_t         sz;
+
+    *fd = -1;
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = data;
+    iov.iov_len  = len;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    do {
+        sz = recvmsg(sock, &msg, MSG_WAITALL);
+    } while (sz < 0 && errno == EINTR);
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+
+    if (sz != (ssize_t)len) {
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Waits for the reply of the manager, staying responsive to the query
+ * cancellation
+ *
+ * Returns 0 on success, -1 on failure or if the manager is too slow
+ */
+static int wait_reply(int sock, plcManagerReply *reply, int *fd) {
+    struct pollfd pfd;
+    int64         deadline = now_ms() + PLC_MANAGER_REPLY_TIMEOUT_MS;
+    int           res;
+
+    *fd = -1;
+    while (1) {
+        pfd.fd     = sock;
+        pfd.events = POLLIN;
+        res = poll(&pfd, 1, 100);
+        if (res > 0) {
+            break;
+        }
+        if (res < 0 && errno != EINTR) {
+            return -1;
+        }
+        CHECK_FOR_INTERRUPTS();
+        if (now_ms() >= deadline) {
+            return -1;
+        }
+    }
+
+    return receive_fd(sock, reply, sizeof(plcManagerReply), fd);
+}
+
+/*
+ * Connects to the manager of the segment. If the manager is not running yet
+ * it is launched and we wait for it to start listening
+ *
+ * Returns the socket or -1 on failure
+ */
+static int connect_manager(void) {
+    struct sockaddr_un addr;
+    unsigned int       sleepus = 10000;
+    unsigned int       sleepms = 0;
+    int                sock;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", PLC_MANAGER_SOCKET_FILE);
+
+    while (1) {
+        sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock < 0) {
+            return -1;
+        }
+        if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            if (is_trusted_peer(sock)) {
+                return sock;
+            }
+            elog(WARNING, "Container manager socket '%s' is not owned by the database user",
+                          PLC_MANAGER_SOCKET_FILE);
+            close(sock);
+            return -1;
+        }
+        close(sock);
+
+        if (sleepms >= PLC_MANAGER_START_TIMEOUT_MS) {
+            return -1;
+        }
+        if (sleepms == 0) {
+            launch_manager();
+        }
+        usleep(sleepus);
+        sleepms += sleepus / 1000;
+        sleepus = sleepus >= 100000 ? 100000 : sleepus * 2;
+    }
+}
+
+/*
+ * Starts the manager as a daemon, so the backend does not have to wait for
+ * it. If the manager is already started by another backend, the new one
+ * exits as it cannot take the lock.
+ *
+ * Manager is a copy of the backend the postmaster does not know about. It
+ * detaches from the shared memory right away and runs only the configuration
+ * and Docker code of the extension, exiting once the postmaster is gone
+ */
+static void launch_manager(void) {
+    pid_t pid = 0;
+
+    pid = fork();
+    if (pid == 0) {
+        setsid();
+        if (fork() == 0) {
+            manager_main();
+        }
+        _exit(0);
+    }
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+}
+
+plcConn *plc_manager_start_container(plcContainer *cont, int *ctlfd) {
+    plcManagerRequest req;
+    plcManagerReply   reply;
+    plcConn          *conn = NULL;
+    int               sock;
+    int               fd = -1;
+    int               res;
+
+    *ctlfd = -1;
+    sock = connect_manager();
+    if (sock < 0) {
+        elog(DEBUG1, "Cannot connect to the container manager");
+        return NULL;
+    }
+
+    memset(&req, 0, sizeof(req));
+    snprintf(req.name, sizeof(req.name), "%s", cont->name);
+    PG_TRY();
+    {
+        res = send_fd(sock, &req, sizeof(req), -1);
+        if (res == 0) {
+            res = wait_reply(sock, &reply, &fd);
+        }
+    }
+    PG_CATCH();
+    {
+        close(sock);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    /* Closing the socket tells the manager to drop the container */
+    if (res < 0) {
+        elog(DEBUG1, "Cannot get the container from the container manager, "
+                     "starting it in the backend");
+        close(sock);
+        return NULL;
+    }
+
+    if (reply.status != 0 || fd < 0) {
+        close(sock);
+        if (fd >= 0) {
+            close(fd);
+        }
+        reply.error[sizeof(reply.error) - 1] = '\0';
+        elog(ERROR, "Container manager cannot start container '%s': %s",
+                    cont->name, reply.error);
+        return NULL;
+    }
+
+    /* Manager has already reset the rings and pinged the client */
+    conn = plcConnInit(fd);
+    conn->features       = reply.features;
+    conn->peerMaxMessage = reply.maxMessage;
+    if (reply.transport == PLC_TRANSPORT_SHM) {
+        char shmpath[1024];
+
+        reply.udsdir[sizeof(reply.udsdir) - 1] = '\0';
+        snprintf(shmpath, sizeof(shmpath), "%s/%s", reply.udsdir, PLC_SHM_FILE_NAME);
+        conn->shm = plcShmAttach(shmpath, 1);
+        if (conn->shm == NULL) {
+            plcDisconnect(conn);
+            close(sock);
+            return NULL;
+        }
+    }
+
+    *ctlfd = sock;
+    return conn;
+}
+
+static void manager_main(void) {
+    int  lockfd;
+    int  listener;
+    int  fd;
+    int  i;
+
+    /* We are a copy of the backend and should neither touch its shared state
+     * nor keep its sockets open */
+    on_exit_reset();
+    PGSharedMemoryDetach();
+    MyProc = NULL;
+    for (fd = 3; fd < sysconf(_SC_OPEN_MAX); fd++) {
+        close(fd);
+    }
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGALRM, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGUSR1, SIG_IGN);
+    signal(SIGUSR2, SIG_IGN);
+    signal(SIGCHLD, SIG_DFL);
+
+    set_ps_display("plcontainer manager", false);
+
+    /* Only one manager should serve the segment */
+    lockfd = open(PLC_MANAGER_LOCK_FILE, O_RDWR | O_CREAT | O_NOFOLLOW, 0600);
+    if (lockfd < 0 || flock(lockfd, LOCK_EX | LOCK_NB) < 0) {
+        _exit(0);
+    }
+
+    listener = manager_listen();
+    if (listener < 0) {
+        _exit(1);
+    }
+
+    managed = (managed_t*)plc_top_alloc(PLC_MANAGER_MAX_CONTAINERS * sizeof(managed_t));
+    memset(managed, 0, PLC_MANAGER_MAX_CONTAINERS * sizeof(managed_t));
+    for (i = 0; i < PLC_MANAGER_MAX_ATTEMPTS; i++) {
+        attempts[i].slot = -1;
+    }
+    memset(pools, 0, sizeof(pools));
+    managercxt = AllocSetContextCreate(TopMemoryContext,
+                                       "PL/Container manager",
+                                       ALLOCSET_DEFAULT_MINSIZE,
+                                       ALLOCSET_DEFAULT_INITSIZE,
+                                       ALLOCSET_DEFAULT_MAXSIZE);
+
+    /* Errors should not get to the backend code copied to this process */
+    while (kill(PostmasterPid, 0) == 0) {
+        MemoryContextSwitchTo(managercxt);
+        PG_TRY();
+        {
+            manager_iteration(listener);
+        }
+        PG_CATCH();
+        {
+            EmitErrorReport();
+            FlushErrorState();
+        }
+        PG_END_TRY();
+        MemoryContextSwitchTo(TopMemoryContext);
+        MemoryContextReset(managercxt);
+    }
+
+    /* Postmaster is gone, so are the backends. Remove all the containers */
+    PG_TRY();
+    {
+        int slots[PLC_MANAGER_MAX_CONTAINERS];
+        int nslots = 0;
+
+        for (i = 0; i < PLC_MANAGER_MAX_CONTAINERS; i++) {
+            if (managed[i].name != NULL) {
+                slots[nslots++] = i;
+            }
+        }
+        manager_remove(slots, nslots);
+    }
+    PG_CATCH();
+    {
+        _exit(1);
+    }
+    PG_END_TRY();
+
+    unlink(PLC_MANAGER_SOCKET_FILE);
+    _exit(0);
+}
+
+static int manager_listen(void) {
+    struct sockaddr_un addr;
+    int                sock;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", PLC_MANAGER_SOCKET_FILE);
+
+    /* Socket file might be left by the manager that has crashed */
+    unlink(addr.sun_path);
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+            || chmod(addr.sun_path, 0600) < 0
+            || listen(sock, PLC_MANAGER_MAX_REQUESTS) < 0
+            || fcntl(sock, F_SETFL, O_NONBLOCK) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+/*
+ * Waits for the requests, for the answers of the containers being connected
+ * to and for the sockets of the managed containers to be closed, serves
+ * everything that is ready and refills the pools
+ */
+static void manager_iteration(int listener) {
+    struct pollfd fds[1 + PLC_MANAGER_MAX_CONTAINERS + PLC_MANAGER_MAX_ATTEMPTS];
+    int           idx[1 + PLC_MANAGER_MAX_CONTAINERS + PLC_MANAGER_MAX_ATTEMPTS];
+    int           released[PLC_MANAGER_MAX_CONTAINERS];
+    request_t     reqs[PLC_MANAGER_MAX_REQUESTS];
+    int           nfds = 0;
+    int           nslotfds;
+    int           nreleased = 0;
+    int           nreqs = 0;
+    int           res;
+    int           i;
+
+    fds[nfds].fd     = listener;
+    fds[nfds].events = POLLIN;
+    nfds++;
+
+    /* Neither backends nor clients send anything to these sockets, so any
+     * event on them means the other side is gone */
+    for (i = 0; i < PLC_MANAGER_MAX_CONTAINERS; i++) {
+        if (managed[i].name != NULL && !managed[i].zygote) {
+            if (managed[i].ctlfd >= 0) {
+                fds[nfds].fd = managed[i].ctlfd;
+            } else if (managed[i].conn != NULL) {
+                fds[nfds].fd = managed[i].conn->sock;
+            } else {
+                continue;
+            }
+            fds[nfds].events = POLLIN;
+            idx[nfds]        = i;
+            nfds++;
+        }
+    }
+    nslotfds = nfds;
+
+    for (i = 0; i < PLC_MANAGER_MAX_ATTEMPTS; i++) {
+        if (attempts[i].slot >= 0 && attempts[i].conn != NULL) {
+            fds[nfds].fd     = attempts[i].conn->sock;
+            fds[nfds].events = POLLIN;
+            idx[nfds]        = i;
+            nfds++;
+        }
+    }
+
+    res = poll(fds, nfds, manager_poll_timeout(manager_pools_full() ? PLC_MANAGER_POLL_TIMEOUT_MS : 0));
+    if (res < 0) {
+        if (errno != EINTR) {
+            elog(ERROR, "Container manager cannot poll the sockets: %s", strerror(errno));
+        }
+        return;
+    }
+
+    if (res > 0) {
+        for (i = 1; i < nslotfds; i++) {
+            if (fds[i].revents != 0) {
+                released[nreleased++] = idx[i];
+            }
+        }
+        manager_remove(released, nreleased);
+
+        /* Attempts of the removed containers are cancelled already */
+        for (i = nslotfds; i < nfds; i++) {
+            if (fds[i].revents != 0 && attempts[idx[i]].slot >= 0
+                    && attempts[idx[i]].conn != NULL) {
+                manager_answer(&attempts[idx[i]]);
+            }
+        }
+    }
+    manager_check_attempts();
+
+    if (res > 0 && (fds[0].revents & POLLIN)) {
+        nreqs = manager_accept(listener, reqs);
+        manager_serve(reqs, nreqs);
+    }
+
+    manager_fill_pools();
+}
+
+/* Time to wait for the next event, the next ping or the deadline */
+static int manager_poll_timeout(int timeout) {
+    int64 now = now_ms();
+    int   i;
+
+    for (i = 0; i < PLC_MANAGER_MAX_ATTEMPTS; i++) {
+        int64 next;
+
+        if (attempts[i].slot < 0) {
+            continue;
+        }
+        next = attempts[i].conn == NULL ? Min(attempts[i].retry, attempts[i].deadline)
+                                        : attempts[i].deadline;
+        next = next > now ? next - now : 0;
+        if (next < timeout) {
+            timeout = (int)next;
+        }
+    }
+    return timeout;
+}
+
+/*
+ * Accepts all the pending connections and reads the requests from them
+ *
+ * Returns the number of requests read
+ */
+static int manager_accept(int listener, request_t *reqs) {
+    struct timeval tv;
+    int            nreqs = 0;
+    int            sock;
+
+    while (nreqs < PLC_MANAGER_MAX_REQUESTS) {
+        sock = accept(listener, NULL, NULL);
+        if (sock < 0) {
+            break;
+        }
+        if (!is_trusted_peer(sock)) {
+            close(sock);
+            continue;
+        }
+
+        /* Backend sends the request right after connecting */
+        tv.tv_sec  = 1;
+        tv.tv_usec = 0;
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(struct timeval));
+        if (recv(sock, &reqs[nreqs].req, sizeof(plcManagerRequest), MSG_WAITALL)
+                != sizeof(plcManagerRequest)) {
+            close(sock);
+            continue;
+        }
+        reqs[nreqs].req.name[PLC_MANAGER_NAME_LEN - 1] = '\0';
+        reqs[nreqs].sock = sock;
+        reqs[nreqs].cont = NULL;
+        nreqs++;
+    }
+
+    return nreqs;
+}
+
+/*
+ * Serves the requests from the pools first. Missing containers are created
+ * and the backend waits on its socket while the manager connects to them
+ * together with the other containers being started
+ */
+static void manager_serve(request_t *reqs, int nreqs) {
+    int i, j;
+
+    for (i = 0; i < nreqs; i++) {
+        int slot = -1;
+
+        reqs[i].cont = manager_get_config(reqs[i].req.name);
+        if (reqs[i].cont == NULL) {
+            manager_reply(reqs[i].sock, -1, NULL, "container is not defined in configuration");
+            continue;
+        }
+        /* Manager cannot derive the code cache key of the requesting role */
+        if (reqs[i].cont->codeCache != NULL) {
+            manager_reply(reqs[i].sock, -1, NULL, "container with code cache is started by the backend");
+            continue;
+        }
+        if (reqs[i].cont->zygote) {
+            manager_serve_zygote(&reqs[i]);
+            continue;
+        }
+        manager_add_pool(reqs[i].cont->name);
+
+        for (j = 0; j < PLC_MANAGER_MAX_CONTAINERS; j++) {
+            if (is_pooled(j, reqs[i].cont->name)) {
+                plcConn *conn = managed[j].conn;
+
+                managed[j].conn = NULL;
+                manager_reply(reqs[i].sock, j, conn, NULL);
+                break;
+            }
+        }
+        if (j < PLC_MANAGER_MAX_CONTAINERS) {
+            continue;
+        }
+
+        slot = manager_create(reqs[i].cont);
+        if (slot < 0) {
+            manager_reply(reqs[i].sock, -1, NULL, "cannot create Docker container");
+            continue;
+        }
+        managed[slot].ctlfd = reqs[i].sock;
+        manager_attempt(slot, -1, 0, CONTAINER_CONNECT_TIMEOUT_MS);
+    }
+}
+
+/*
+ * Zygote container is created once and connected to for every request, the
+ * client inside of it forks for each connection. If the zygote does not
+ * answer it must have exited being idle, so it is replaced with a new one
+ */
+static void manager_serve_zygote(request_t *req) {
+    int slot;
+
+    for (slot = 0; slot < PLC_MANAGER_MAX_CONTAINERS; slot++) {
+        if (managed[slot].name != NULL && managed[slot].zygote
+                && strcmp(managed[slot].name, req->cont->name) == 0) {
+            break;
+        }
+    }
+
+    if (slot < PLC_MANAGER_MAX_CONTAINERS) {
+        if (managed[slot].starting) {
+            manager_attempt(slot, req->sock, 0, CONTAINER_CONNECT_TIMEOUT_MS);
+        } else {
+            manager_attempt(slot, req->sock, 1, CONTAINER_POOL_CONNECT_TIMEOUT_MS);
+        }
+        return;
+    }
+
+    slot = manager_create(req->cont);
+    if (slot < 0) {
+        manager_reply(req->sock, -1, NULL, "cannot create Docker container");
+        return;
+    }
+    managed[slot].zygote = 1;
+    manager_attempt(slot, req->sock, 0, CONTAINER_CONNECT_TIMEOUT_MS);
+}
+
+/*
+ * Zygote has not answered, the attempts waiting for it are moved to a new
+ * one. If it cannot be created, removing the old one fails them
+ */
+static void manager_replace_zygote(int slot) {
+    plcContainer *cont = manager_get_config(managed[slot].name);
+    int64         now = now_ms();
+    int           newslot = -1;
+    int           i;
+
+    if (cont != NULL) {
+        newslot = manager_create(cont);
+    }
+    if (newslot >= 0) {
+        managed[newslot].zygote = 1;
+        for (i = 0; i < PLC_MANAGER_MAX_ATTEMPTS; i++) {
+            attempt_t *a = &attempts[i];
+
+            if (a->slot == slot) {
+                plcDisconnect(a->conn);
+                plcShmDetach(a->shm);
+                a->slot     = newslot;
+                a->replace  = 0;
+                a->conn     = NULL;
+                a->shm      = NULL;
+                a->backoff  = PLC_MANAGER_PING_MIN_MS;
+                a->retry    = now + PLC_MANAGER_PING_MIN_MS;
+                a->deadline = now + CONTAINER_CONNECT_TIMEOUT_MS;
+            }
+        }
+    }
+    manager_remove(&slot, 1);
+}
+
+/*
+ * Starts one container for each pool that is not full. Starting is
+ * suspended for a while after a failure
+ */
+static void manager_fill_pools(void) {
+    int i;
+
+    if (manager_pools_full()) {
+        return;
+    }
+
+    for (i = 0; i < PLC_MANAGER_MAX_CONTAINERS && pools[i] != NULL; i++) {
+        plcContainer *cont = manager_get_config(pools[i]);
+        int           slot;
+
+        if (cont == NULL || cont->zygote) {
+            continue;
+        }
+        if (manager_pool_size(cont->name) < cont->poolSize) {
+            slot = manager_create(cont);
+            if (slot < 0) {
+                poolfailure = time(NULL);
+                return;
+            }
+            manager_attempt(slot, -1, 0, CONTAINER_CONNECT_TIMEOUT_MS);
+        }
+    }
+}
+
+static bool manager_pools_full(void) {
+    int i;
+
+    if (time(NULL) - poolfailure < PLC_MANAGER_RETRY_SEC) {
+        return true;
+    }
+
+    for (i = 0; i < PLC_MANAGER_MAX_CONTAINERS && pools[i] != NULL; i++) {
+        plcContainer *cont = manager_get_config(pools[i]);
+
+        if (cont == NULL || cont->zygote) {
+            continue;
+        }
+        if (manager_pool_size(cont->name) < cont->poolSize) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Containers of the pool, including the ones still starting */
+static int manager_pool_size(const char *name) {
+    int size = 0;
+    int i;
+
+    for (i = 0; i < PLC_MANAGER_MAX_CONTAINERS; i++) {
+        if (managed[i].name != NULL && !managed[i].zygote && managed[i].ctlfd < 0
+                && strcmp(managed[i].name, name) == 0) {
+            size += 1;
+        }
+    }
+    return size;
+}
+
+/* Container is waiting in the pool with the connection established */
+static bool is_pooled(int slot, const char *name) {
+    return managed[slot].name != NULL && !managed[slot].zygote && managed[slot].conn != NULL
+            && managed[slot].ctlfd < 0 && strcmp(managed[slot].name, name) == 0;
+}
+
+/* Configuration is read again when the container is not known */
+static plcContainer *manager_get_config(char *name) {
+    plcContainer *cont = NULL;
+
+    PG_TRY();
+    {
+        cont = plc_get_container_config(name);
+        if (cont == NULL) {
+            plc_read_container_config(false);
+            cont = plc_get_container_config(name);
+        }
+    }
+    PG_CATCH();
+    {
+        EmitErrorReport();
+        FlushErrorState();
+        MemoryContextSwitchTo(managercxt);
+        cont = NULL;
+    }
+    PG_END_TRY();
+
+    return cont;
+}
+
+static void manager_add_pool(char *name) {
+    int i;
+
+    for (i = 0; i < PLC_MANAGER_MAX_CONTAINERS; i++) {
+        if (pools[i] == NULL) {
+            pools[i] = plc_top_strdup(name);
+            return;
+        }
+        if (strcmp(pools[i], name) == 0) {
+            return;
+        }
+    }
+}
+
+/*
+ * Creates and starts the container in a free slot
+ *
+ * Returns the slot or -1 on failure
+ */
+static int manager_create(plcContainer *cont) {
+    char *dockerid = NULL;
+    char *udsdir = NULL;
+    int   port = 0;
+    int   slot;
+
+    for (slot = 0; slot < PLC_MANAGER_MAX_CONTAINERS; slot++) {
+        if (managed[slot].name == NULL) {
+            break;
+        }
+    }
+    if (slot == PLC_MANAGER_MAX_CONTAINERS) {
+        elog(LOG, "Container manager cannot handle more than %d containers",
+                  PLC_MANAGER_MAX_CONTAINERS);
+        return -1;
+    }
+
+    PG_TRY();
+    {
+        create_container(cont, &dockerid, &udsdir, &port);
+    }
+    PG_CATCH();
+    {
+        /* Container and its directory are removed by create_container */
+        EmitErrorReport();
+        FlushErrorState();
+        MemoryContextSwitchTo(managercxt);
+        return -1;
+    }
+    PG_END_TRY();
+
+    managed[slot].name      = plc_top_strdup(cont->name);
+    managed[slot].dockerid  = plc_top_strdup(dockerid);
+    managed[slot].udsdir    = udsdir != NULL ? plc_top_strdup(udsdir) : NULL;
+    managed[slot].port      = port;
+    managed[slot].transport = cont->transport;
+    managed[slot].zygote    = 0;
+    managed[slot].starting  = 1;
+    managed[slot].conn      = NULL;
+    managed[slot].ctlfd     = -1;
+
+    return slot;
+}
+
+/*
+ * Starts connecting to the container in the slot. The first ping is sent on
+ * the next check of the attempts
+ */
+static void manager_attempt(int slot, int reqfd, int replace, unsigned int timeoutms) {
+    int64 now = now_ms();
+    int   i;
+
+    for (i = 0; i < PLC_MANAGER_MAX_ATTEMPTS; i++) {
+        if (attempts[i].slot < 0) {
+            attempts[i].slot     = slot;
+            attempts[i].reqfd    = reqfd;
+            attempts[i].replace  = replace;
+            attempts[i].conn     = NULL;
+            attempts[i].shm      = NULL;
+            attempts[i].backoff  = PLC_MANAGER_PING_MIN_MS;
+            attempts[i].retry    = now;
+            attempts[i].deadline = now + timeoutms;
+            return;
+        }
+    }
+    manager_fail(slot, reqfd, "too many containers are being connected to");
+}
+
+/*
+ * Pings the containers due for the next try and gives up on the ones that
+ * have not answered in time
+ */
+static void manager_check_attempts(void) {
+    int64 now = now_ms();
+    int   i;
+
+    for (i = 0; i < PLC_MANAGER_MAX_ATTEMPTS; i++) {
+        attempt_t *a = &attempts[i];
+
+        if (a->slot < 0) {
+            continue;
+        }
+        if (now >= a->deadline) {
+            manager_give_up(a);
+        } else if (a->conn == NULL && now >= a->retry) {
+            manager_ping(a, now);
+        }
+    }
+}
+
+static void manager_ping(attempt_t *a, int64 now) {
+    plcContainer *cont = manager_get_config(managed[a->slot].name);
+
+    if (cont != NULL) {
+        PG_TRY();
+        {
+            a->conn = send_container_ping(cont, managed[a->slot].port,
+                                          managed[a->slot].udsdir, &a->shm);
+        }
+        PG_CATCH();
+        {
+            EmitErrorReport();
+            FlushErrorState();
+            MemoryContextSwitchTo(managercxt);
+            plcShmDetach(a->shm);
+            a->shm  = NULL;
+            a->conn = NULL;
+        }
+        PG_END_TRY();
+    }
+
+    if (a->conn == NULL) {
+        a->retry   = now + a->backoff;
+        a->backoff = Min(a->backoff * 2, PLC_MANAGER_PING_MAX_MS);
+    }
+}
+
+/*
+ * Reads the answer to the ping. Connection that is closed without answering
+ * is retried, as the client might not listen yet
+ */
+static void manager_answer(attempt_t *a) {
+    plcContainer *cont = manager_get_config(managed[a->slot].name);
+    int           res = -1;
+
+    if (cont != NULL) {
+        PG_TRY();
+        {
+            res = receive_container_ping(cont, a->conn, a->shm);
+        }
+        PG_CATCH();
+        {
+            EmitErrorReport();
+            FlushErrorState();
+            MemoryContextSwitchTo(managercxt);
+            plcDisconnect(a->conn);
+            plcShmDetach(a->shm);
+            res = -1;
+        }
+        PG_END_TRY();
+    } else {
+        plcDisconnect(a->conn);
+        plcShmDetach(a->shm);
+    }
+
+    if (res < 0) {
+        int64 now = now_ms();
+
+        a->conn    = NULL;
+        a->shm     = NULL;
+        a->retry   = now + a->backoff;
+        a->backoff = Min(a->backoff * 2, PLC_MANAGER_PING_MAX_MS);
+        return;
+    }
+
+    manager_connected(a);
+}
+
+/*
+ * Container has answered. Zygote connection goes to the backend that asked
+ * for it, other containers go to the backend waiting on the slot or stay in
+ * the pool
+ */
+static void manager_connected(attempt_t *a) {
+    plcConn *conn = a->conn;
+    int      slot = a->slot;
+
+    a->slot = -1;
+    a->conn = NULL;
+    a->shm  = NULL;
+    managed[slot].starting = 0;
+
+    if (managed[slot].zygote) {
+        manager_reply(a->reqfd, slot, conn, NULL);
+    } else if (managed[slot].ctlfd >= 0) {
+        manager_reply(managed[slot].ctlfd, slot, conn, NULL);
+    } else {
+        managed[slot].conn = conn;
+    }
+}
+
+static void manager_give_up(attempt_t *a) {
+    int slot = a->slot;
+
+    plcDisconnect(a->conn);
+    plcShmDetach(a->shm);
+    a->conn = NULL;
+    a->shm  = NULL;
+
+    if (managed[slot].zygote && a->replace) {
+        manager_replace_zygote(slot);
+        return;
+    }
+    a->slot = -1;
+    manager_fail(slot, a->reqfd, "cannot connect to the container");
+}
+
+/*
+ * Container cannot be connected to, whoever waits for it gets the error.
+ * Zygote that has answered before stays for the other backends
+ */
+static void manager_fail(int slot, int reqfd, const char *error) {
+    if (managed[slot].zygote) {
+        manager_reply(reqfd, -1, NULL, error);
+        if (!managed[slot].starting) {
+            return;
+        }
+    } else if (managed[slot].ctlfd >= 0) {
+        int sock = managed[slot].ctlfd;
+
+        managed[slot].ctlfd = -1;
+        manager_reply(sock, -1, NULL, error);
+    } else {
+        poolfailure = time(NULL);
+    }
+    manager_remove(&slot, 1);
+}
+
+/*
+ * Sends the reply to the backend. On success the connection to the container
+ * is handed over and the socket of the backend is kept to track its usage
+ */
+static void manager_reply(int sock, int slot, plcConn *conn, const char *error) {
+    plcManagerReply reply;
+    int             res;
+
+    memset(&reply, 0, sizeof(reply));
+    if (slot < 0) {
+        reply.status = -1;
+        snprintf(reply.error, sizeof(reply.error), "%s", error);
+        send_fd(sock, &reply, sizeof(reply), -1);
+        close(sock);
+        return;
+    }
+
+    reply.transport  = managed[slot].transport;
+    reply.features   = conn->features;
+    reply.maxMessage = conn->peerMaxMessage;
+    /* Client might not support the rings and use the socket instead */
+    if (reply.transport == PLC_TRANSPORT_SHM && conn->shm == NULL) {
+        reply.transport = PLC_TRANSPORT_UNIX;
+    }
+    if (managed[slot].udsdir != NULL) {
+        snprintf(reply.udsdir, sizeof(reply.udsdir), "%s", managed[slot].udsdir);
+    }
+    res = send_fd(sock, &reply, sizeof(reply), conn->sock);
+
+    /* Backend has its own copy of the descriptor now. Zygote forks a new
+     * client for each connection and outlives the backends, so there is
+     * nothing to track for them */
+    plcDisconnect(conn);
+    if (managed[slot].zygote) {
+        close(sock);
+    } else if (res < 0) {
+        managed[slot].ctlfd = -1;
+        close(sock);
+        manager_remove(&slot, 1);
+    } else {
+        managed[slot].ctlfd = sock;
+    }
+}
+
+/*
+ * Removes the containers in the slots, cancelling the attempts to connect to
+ * them. All of them are killed first, so the following waits finish
+ * immediately
+ */
+static void manager_remove(int *slots, int nslots) {
+    int sockfd;
+    int i, j;
+
+    if (nslots == 0) {
+        return;
+    }
+
+    for (i = 0; i < PLC_MANAGER_MAX_ATTEMPTS; i++) {
+        attempt_t *a = &attempts[i];
+
+        for (j = 0; j < nslots && a->slot >= 0; j++) {
+            if (a->slot == slots[j]) {
+                plcDisconnect(a->conn);
+                plcShmDetach(a->shm);
+                a->slot = -1;
+                a->conn = NULL;
+                a->shm  = NULL;
+                if (a->reqfd >= 0) {
+                    manager_reply(a->reqfd, -1, NULL, "container has been removed");
+                }
+            }
+        }
+    }
+
+    sockfd = plc_docker_connect();
+    for (i = 0; i < nslots; i++) {
+        managed_t *c = &managed[slots[i]];
+
+        if (c->conn != NULL) {
+            plcDisconnect(c->conn);
+            c->conn = NULL;
+        }
+        if (c->ctlfd >= 0) {
+            close(c->ctlfd);
+            c->ctlfd = -1;
+        }
+        if (sockfd > 0) {
+            plc_docker_kill_container(sockfd, c->dockerid);
+        }
+    }
+    if (sockfd > 0) {
+        plc_docker_disconnect(sockfd);
+    }
+
+    for (i = 0; i < nslots; i++) {
+        managed_t *c = &managed[slots[i]];
+
+        if (remove_container(c->dockerid, c->udsdir) < 0) {
+            elog(LOG, "Container manager cannot remove container %s", c->dockerid);
+        }
+        pfree(c->name);
+        pfree(c->dockerid);
+        if (c->udsdir != NULL) {
+            pfree(c->udsdir);
+        }
+        memset(c, 0, sizeof(managed_t));
+    }
+}
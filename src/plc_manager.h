@@ -0,0 +1,45 @@
+/*------------------------------------------------------------------------------
+ *
+ *
+ * Copyright (c) 2016, Pivotal.
+ *
+ *------------------------------------------------------------------------------
+ */
+#ifndef PLC_MANAGER_H
+#define PLC_MANAGER_H
+
+#include "common/comm_connectivity.h"
+#include "plc_configuration.h"
+
+/* Socket and lock file of the container manager in the data directory of the
+ * segment. Backends run in the data directory, so the names are relative to
+ * stay within the length limit of the socket path */
+#define PLC_MANAGER_SOCKET_FILE "pg_plcontainer_manager.sock"
+#define PLC_MANAGER_LOCK_FILE "pg_plcontainer_manager.lock"
+
+/* Time backend waits for the manager it has launched to start listening */
+#define PLC_MANAGER_START_TIMEOUT_MS 2000
+
+/* Time backend waits for the container, covers Docker starting it and the
+ * client answering. Backend starts the container itself afterwards */
+#define PLC_MANAGER_REPLY_TIMEOUT_MS 10000
+
+#define PLC_MANAGER_MAX_CONTAINERS 256
+#define PLC_MANAGER_MAX_REQUESTS 64
+#define PLC_MANAGER_MAX_ATTEMPTS 256
+#define PLC_MANAGER_POLL_TIMEOUT_MS 1000
+#define PLC_MANAGER_RETRY_SEC 5
+
+/* Backoff between the connection attempts to the starting container */
+#define PLC_MANAGER_PING_MIN_MS 25
+#define PLC_MANAGER_PING_MAX_MS 200
+
+#define PLC_MANAGER_NAME_LEN 256
+#define PLC_MANAGER_PATH_LEN 256
+#define PLC_MANAGER_ERROR_LEN 512
+
+/* get the connection to the container from the manager of the segment,
+ * launching the manager if needed. NULL if the manager is not available */
+plcConn *plc_manager_start_container(plcContainer *cont, int *ctlfd);
+
+#endif /* PLC_MANAGER_H */
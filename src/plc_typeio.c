@@ -14,9 +14,15 @@
 #include "access/tupmacs.h"
 #include "executor/spi.h"
 #include "parser/parse_type.h"
+#include "utils/builtins.h"
 #include "utils/fmgroids.h"
 #include "utils/array.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/numeric.h"
+#include "utils/syscache.h"
 #include "utils/typcache.h"
 
 #include "plcontainer.h"
@@ -24,22 +30,58 @@
 #include "message_fns.h"
 #include "common/comm_utils.h"
 
+#define PLC_NUMERIC_NDIGITS(num) ((VARSIZE(num) - NUMERIC_HDRSZ) / sizeof(int16))
+
+/*
+ * Type information built from the catalog is cached by type OID and typmod
+ * and copied out on each request. Record types are resolved for each call
+ * and are not cached. Entries are removed when the pg_type tuple of any type
+ * they are built from or the relation of the row type changes
+ */
+typedef struct plcTypeCacheKey {
+    Oid         typeOid;
+    int32       typmod;
+} plcTypeCacheKey;
+
+typedef struct plcTypeCacheEntry {
+    plcTypeCacheKey key;    /* hash key, must be the first */
+    plcTypeInfo     type;
+} plcTypeCacheEntry;
+
+static HTAB *plcTypeCache = NULL;
+
 static void fill_type_info_inner(FunctionCallInfo fcinfo, Oid typeOid, plcTypeInfo *type,
                                  bool isArrayElement, bool isUDTElement);
-
-static char *plc_datum_as_int1(Datum input, plcTypeInfo *type);
-static char *plc_datum_as_int2(Datum input, plcTypeInfo *type);
-static char *plc_datum_as_int4(Datum input, plcTypeInfo *type);
-static char *plc_datum_as_int8(Datum input, plcTypeInfo *type);
-static char *plc_datum_as_float4(Datum input, plcTypeInfo *type);
-static char *plc_datum_as_float8(Datum input, plcTypeInfo *type);
-static char *plc_datum_as_float8_numeric(Datum input, plcTypeInfo *type);
-static char *plc_datum_as_text(Datum input, plcTypeInfo *type);
-static char *plc_datum_as_bytea(Datum input, plcTypeInfo *type);
-static char *plc_datum_as_array(Datum input, plcTypeInfo *type);
+static void clone_type_info(plcTypeInfo *dst, plcTypeInfo *src);
+static bool type_has_record(plcTypeInfo *type);
+static bool type_uses_relation(plcTypeInfo *type, Oid relid);
+static bool type_uses_tuple(plcTypeInfo *type, ItemPointer tid);
+static void type_cache_remove(Oid relid, ItemPointer tid);
+static void type_cache_relcache_callback(Datum arg, Oid relid);
+#if PG_VERSION_NUM >= 80300
+static void type_cache_syscache_callback(Datum arg, int cacheid, ItemPointer tuplePtr);
+#else
+static void type_cache_syscache_callback(Datum arg, Oid relid);
+#endif
+
+static void plc_datum_as_int1(Datum input, plcTypeInfo *type, rawdata *output);
+static void plc_datum_as_int2(Datum input, plcTypeInfo *type, rawdata *output);
+static void plc_datum_as_int4(Datum input, plcTypeInfo *type, rawdata *output);
+static void plc_datum_as_int8(Datum input, plcTypeInfo *type, rawdata *output);
+static void plc_datum_as_float4(Datum input, plcTypeInfo *type, rawdata *output);
+static void plc_datum_as_float8(Datum input, plcTypeInfo *type, rawdata *output);
+static void plc_datum_as_numeric(Datum input, plcTypeInfo *type, rawdata *output);
+static void plc_numeric_copy(Numeric num, plcNumeric *res);
+static plcNumeric *plc_numeric_from_float8(plcArena *arena, double value);
+static void plc_array_upgrade_numeric(plcArena *arena, plcTypeInfo *elem, plcType *wire,
+                                      plcArray *arr);
+static void plc_datum_as_text(Datum input, plcTypeInfo *type, rawdata *output);
+static void plc_datum_as_bytea(Datum input, plcTypeInfo *type, rawdata *output);
+static void plc_datum_as_array(Datum input, plcTypeInfo *type, rawdata *output);
+static bool plc_is_native_fixed_width(Oid typeOid);
 static void plc_backend_array_free(plcIterator *iter);
 static rawdata *plc_backend_array_next(plcIterator *self);
-static char *plc_datum_as_udt(Datum input, plcTypeInfo *type);
+static void plc_datum_as_udt(Datum input, plcTypeInfo *type, rawdata *output);
 
 static Datum plc_datum_from_int1(char *input, plcTypeInfo *type);
 static Datum plc_datum_from_int2(char *input, plcTypeInfo *type);
@@ -47,7 +89,8 @@ static Datum plc_datum_from_int4(char *input, plcTypeInfo *type);
 static Datum plc_datum_from_int8(char *input, plcTypeInfo *type);
 static Datum plc_datum_from_float4(char *input, plcTypeInfo *type);
 static Datum plc_datum_from_float8(char *input, plcTypeInfo *type);
-static Datum plc_datum_from_float8_numeric(char *input, plcTypeInfo *type);
+static Datum plc_datum_from_numeric(char *input, plcTypeInfo *type);
+static Datum plc_datum_from_numeric_ptr(char *input, plcTypeInfo *type);
 static Datum plc_datum_from_text(char *input, plcTypeInfo *type);
 static Datum plc_datum_from_text_ptr(char *input, plcTypeInfo *type);
 static Datum plc_datum_from_bytea(char *input, plcTypeInfo *type);
@@ -67,6 +110,7 @@ static void fill_type_info_inner(FunctionCallInfo fcinfo, Oid typeOid, plcTypeIn
         elog(ERROR, "cache lookup failed for type %u", typeOid);
 
     typeStruct = (Form_pg_type)GETSTRUCT(typeTup);
+    type->typ_tid = typeTup->t_self;
     ReleaseSysCache(typeTup);
 
     type->typeOid = typeOid;
@@ -121,9 +165,13 @@ static void fill_type_info_inner(FunctionCallInfo fcinfo, Oid typeOid, plcTypeIn
             type->infunc = plc_datum_from_float8;
             break;
         case NUMERICOID:
-            type->type = PLC_DATA_FLOAT8;
-            type->outfunc = plc_datum_as_float8_numeric;
-            type->infunc = plc_datum_from_float8_numeric;
+            type->type = PLC_DATA_NUMERIC;
+            type->outfunc = plc_datum_as_numeric;
+            if (!isArrayElement) {
+                type->infunc = plc_datum_from_numeric;
+            } else {
+                type->infunc = plc_datum_from_numeric_ptr;
+            }
             break;
         case BYTEAOID:
             type->type = PLC_DATA_BYTEA;
@@ -234,10 +282,152 @@ static void fill_type_info_inner(FunctionCallInfo fcinfo, Oid typeOid, plcTypeIn
     }
 }
 
-void fill_type_info(FunctionCallInfo fcinfo, Oid typeOid, plcTypeInfo *type) {
-    fill_type_info_inner(fcinfo, typeOid, type, false, false);
+void fill_type_info(FunctionCallInfo fcinfo, Oid typeOid, int32 typmod, plcTypeInfo *type) {
+    plcTypeCacheEntry *entry;
+    plcTypeCacheKey    key;
+    plcTypeInfo        built;
+    bool               found;
+
+    if (typeOid == RECORDOID) {
+        fill_type_info_inner(fcinfo, typeOid, type, false, false);
+        return;
+    }
+
+    if (plcTypeCache == NULL) {
+        HASHCTL ctl;
+
+        memset(&ctl, 0, sizeof(ctl));
+        ctl.keysize   = sizeof(plcTypeCacheKey);
+        ctl.entrysize = sizeof(plcTypeCacheEntry);
+        ctl.hash      = tag_hash;
+        ctl.hcxt      = TopMemoryContext;
+        plcTypeCache = hash_create("PL/Container type cache", 64, &ctl,
+                                   HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+    }
+
+    memset(&key, 0, sizeof(key));
+    key.typeOid = typeOid;
+    key.typmod  = typmod;
+    entry = (plcTypeCacheEntry*)hash_search(plcTypeCache, &key, HASH_FIND, NULL);
+    if (entry == NULL) {
+        /* Entry is added only after the type is built without errors */
+        fill_type_info_inner(fcinfo, typeOid, &built, false, false);
+
+        /* Column typmod is passed to the input function of the type */
+        if (typmod >= 0) {
+            built.typmod = typmod;
+        }
+        if (type_has_record(&built)) {
+            *type = built;
+            return;
+        }
+        entry = (plcTypeCacheEntry*)hash_search(plcTypeCache, &key, HASH_ENTER, &found);
+        entry->type = built;
+    }
+
+    clone_type_info(type, &entry->type);
+}
+
+void plc_type_cache_init() {
+    CacheRegisterRelcacheCallback(type_cache_relcache_callback, (Datum)0);
+    CacheRegisterSyscacheCallback(TYPEOID, type_cache_syscache_callback, (Datum)0);
+}
+
+static void clone_type_info(plcTypeInfo *dst, plcTypeInfo *src) {
+    int i;
+
+    *dst = *src;
+    if (src->typeName != NULL) {
+        dst->typeName = plc_top_strdup(src->typeName);
+    }
+    if (src->nSubTypes > 0) {
+        dst->subTypes = (plcTypeInfo*)plc_top_alloc(src->nSubTypes * sizeof(plcTypeInfo));
+        for (i = 0; i < src->nSubTypes; i++) {
+            clone_type_info(&dst->subTypes[i], &src->subTypes[i]);
+        }
+    }
+}
+
+/* Arrays of records depend on the call as well */
+static bool type_has_record(plcTypeInfo *type) {
+    int i;
+
+    if (type->is_record) {
+        return true;
+    }
+    for (i = 0; i < type->nSubTypes; i++) {
+        if (type_has_record(&type->subTypes[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool type_uses_relation(plcTypeInfo *type, Oid relid) {
+    int i;
+
+    if (type->is_rowtype && type->typ_relid == relid) {
+        return true;
+    }
+    for (i = 0; i < type->nSubTypes; i++) {
+        if (type_uses_relation(&type->subTypes[i], relid)) {
+            return true;
+        }
+    }
+    return false;
 }
 
+static bool type_uses_tuple(plcTypeInfo *type, ItemPointer tid) {
+    int i;
+
+    if (ItemPointerEquals(&type->typ_tid, tid)) {
+        return true;
+    }
+    for (i = 0; i < type->nSubTypes; i++) {
+        if (type_uses_tuple(&type->subTypes[i], tid)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Remove the types built on top of the relation or the pg_type tuple, or all
+ * of them if neither is given. Nobody references the entries as they are
+ * copied out */
+static void type_cache_remove(Oid relid, ItemPointer tid) {
+    HASH_SEQ_STATUS    status;
+    plcTypeCacheEntry *entry;
+
+    if (plcTypeCache == NULL) {
+        return;
+    }
+
+    hash_seq_init(&status, plcTypeCache);
+    while ((entry = (plcTypeCacheEntry*)hash_seq_search(&status)) != NULL) {
+        if ((!OidIsValid(relid) && tid == NULL)
+                || (OidIsValid(relid) && type_uses_relation(&entry->type, relid))
+                || (tid != NULL && type_uses_tuple(&entry->type, tid))) {
+            free_type_info(&entry->type);
+            hash_search(plcTypeCache, &entry->key, HASH_REMOVE, NULL);
+        }
+    }
+}
+
+static void type_cache_relcache_callback(Datum arg UNUSED, Oid relid) {
+    type_cache_remove(relid, NULL);
+}
+
+/* Callback of 8.2 does not tell which type has changed */
+#if PG_VERSION_NUM >= 80300
+static void type_cache_syscache_callback(Datum arg UNUSED, int cacheid UNUSED, ItemPointer tuplePtr) {
+    type_cache_remove(InvalidOid, tuplePtr);
+}
+#else
+static void type_cache_syscache_callback(Datum arg UNUSED, Oid relid UNUSED) {
+    type_cache_remove(InvalidOid, NULL);
+}
+#endif
+
 void copy_type_info(plcType *type, plcTypeInfo *ptype) {
     type->type = ptype->type;
     type->nSubTypes = 0;
@@ -283,67 +473,183 @@ void free_type_info(plcTypeInfo *type) {
     }
 }
 
-static char *plc_datum_as_int1(Datum input, plcTypeInfo *type UNUSED) {
-    char *out = (char*)pmalloc(1);
-    *((char*)out) = DatumGetBool(input);
-    return out;
+static void plc_datum_as_int1(Datum input, plcTypeInfo *type UNUSED, rawdata *output) {
+    output->value = NULL;
+    output->inlined.int1 = DatumGetBool(input);
+}
+
+static void plc_datum_as_int2(Datum input, plcTypeInfo *type UNUSED, rawdata *output) {
+    output->value = NULL;
+    output->inlined.int2 = DatumGetInt16(input);
+}
+
+static void plc_datum_as_int4(Datum input, plcTypeInfo *type UNUSED, rawdata *output) {
+    output->value = NULL;
+    output->inlined.int4 = DatumGetInt32(input);
+}
+
+static void plc_datum_as_int8(Datum input, plcTypeInfo *type UNUSED, rawdata *output) {
+    output->value = NULL;
+    output->inlined.int8 = DatumGetInt64(input);
 }
 
-static char *plc_datum_as_int2(Datum input, plcTypeInfo *type UNUSED) {
-    char *out = (char*)pmalloc(2);
-    *((int16*)out) = DatumGetInt16(input);
-    return out;
+static void plc_datum_as_float4(Datum input, plcTypeInfo *type UNUSED, rawdata *output) {
+    output->value = NULL;
+    output->inlined.float4 = DatumGetFloat4(input);
 }
 
-static char *plc_datum_as_int4(Datum input, plcTypeInfo *type UNUSED) {
-    char *out = (char*)pmalloc(4);
-    *((int32*)out) = DatumGetInt32(input);
-    return out;
+static void plc_datum_as_float8(Datum input, plcTypeInfo *type UNUSED, rawdata *output) {
+    output->value = NULL;
+    output->inlined.float8 = DatumGetFloat8(input);
 }
 
-static char *plc_datum_as_int8(Datum input, plcTypeInfo *type UNUSED) {
-    char *out = (char*)pmalloc(8);
-    *((int64*)out) = DatumGetInt64(input);
-    return out;
+/*
+ * Numeric is sent with its digits as they are stored, so no precision is
+ * lost and no text is formatted
+ */
+static void plc_datum_as_numeric(Datum input, plcTypeInfo *type UNUSED, rawdata *output) {
+    Numeric     num = DatumGetNumeric(input);
+    plcNumeric *res = (plcNumeric*)pmalloc(PLC_NUMERIC_SIZE(PLC_NUMERIC_NDIGITS(num)));
+
+    plc_numeric_copy(num, res);
+    output->value = (char*)res;
+}
+
+static void plc_numeric_copy(Numeric num, plcNumeric *res) {
+    int ndigits = PLC_NUMERIC_NDIGITS(num);
+
+    res->ndigits = ndigits;
+    res->weight  = num->n_weight;
+    res->dscale  = NUMERIC_DSCALE(num);
+    switch (NUMERIC_SIGN(num)) {
+        case NUMERIC_POS:
+            res->sign = PLC_NUMERIC_POS;
+            break;
+        case NUMERIC_NEG:
+            res->sign = PLC_NUMERIC_NEG;
+            break;
+        default:
+            res->sign = PLC_NUMERIC_NAN;
+            break;
+    }
+    memcpy(res->digits, num->n_data, ndigits * sizeof(int16));
 }
 
-static char *plc_datum_as_float4(Datum input, plcTypeInfo *type UNUSED) {
-    char *out = (char*)pmalloc(4);
-    *((float4*)out) = DatumGetFloat4(input);
-    return out;
+static plcNumeric *plc_numeric_from_float8(plcArena *arena, double value) {
+    Numeric     num = DatumGetNumeric(DirectFunctionCall1(float8_numeric, Float8GetDatum(value)));
+    plcNumeric *res = (plcNumeric*)plc_arena_alloc(arena, PLC_NUMERIC_SIZE(PLC_NUMERIC_NDIGITS(num)));
+
+    plc_numeric_copy(num, res);
+    pfree(num);
+    return res;
 }
 
-static char *plc_datum_as_float8(Datum input, plcTypeInfo *type UNUSED) {
-    char *out = (char*)pmalloc(8);
-    *((float8*)out) = DatumGetFloat8(input);
-    return out;
+/*
+ * Peer without PLC_FEATURE_NUMERIC sends numeric values as float8. Such values
+ * received for the given type are converted in place into the numeric form
+ * the input functions expect, the new values are allocated in the arena
+ */
+void plc_raw_upgrade_numeric(plcArena *arena, plcTypeInfo *type, plcType *wire, rawdata *raw) {
+    plcUDT *udt;
+    int     i, j;
+
+    if (raw->isnull) {
+        return;
+    }
+    switch (type->type) {
+        case PLC_DATA_NUMERIC:
+            if (wire->type == PLC_DATA_FLOAT8) {
+                raw->value = (char*)plc_numeric_from_float8(arena, raw->inlined.float8);
+            }
+            break;
+        case PLC_DATA_ARRAY:
+            if (wire->type == PLC_DATA_ARRAY && wire->nSubTypes == 1) {
+                plc_array_upgrade_numeric(arena, &type->subTypes[0], &wire->subTypes[0],
+                                          (plcArray*)raw->value);
+            }
+            break;
+        case PLC_DATA_UDT:
+            if (wire->type != PLC_DATA_UDT) {
+                break;
+            }
+            udt = (plcUDT*)raw->value;
+            for (i = 0, j = 0; i < type->nSubTypes && j < wire->nSubTypes; i++) {
+                if (!type->subTypes[i].attisdropped) {
+                    plc_raw_upgrade_numeric(arena, &type->subTypes[i], &wire->subTypes[j],
+                                            &udt->data[j]);
+                    j += 1;
+                }
+            }
+            break;
+        default:
+            break;
+    }
 }
 
-static char *plc_datum_as_float8_numeric(Datum input, plcTypeInfo *type UNUSED) {
-    char *out = (char*)pmalloc(8);
-    /* Numeric is casted to float8 which causes precision lost */
-    Datum fdatum = DirectFunctionCall1(numeric_float8, input);
-    *((float8*)out) = DatumGetFloat8(fdatum);
-    return out;
+static void plc_array_upgrade_numeric(plcArena *arena, plcTypeInfo *elem, plcType *wire,
+                                      plcArray *arr) {
+    rawdata value;
+    char  **data;
+    int     i;
+
+    if (arr->meta->size <= 0) {
+        return;
+    }
+    if (elem->type == PLC_DATA_NUMERIC && wire->type == PLC_DATA_FLOAT8) {
+        data = (char**)plc_arena_alloc(arena, arr->meta->size * sizeof(char*));
+        for (i = 0; i < arr->meta->size; i++) {
+            data[i] = NULL;
+            if (!arr->nulls[i]) {
+                data[i] = (char*)plc_numeric_from_float8(arena, ((double*)arr->data)[i]);
+            }
+        }
+        arr->data = (char*)data;
+        arr->meta->type = PLC_DATA_NUMERIC;
+    } else if (elem->type == PLC_DATA_UDT) {
+        for (i = 0; i < arr->meta->size; i++) {
+            if (!arr->nulls[i]) {
+                value.isnull = 0;
+                value.value  = ((char**)arr->data)[i];
+                plc_raw_upgrade_numeric(arena, elem, wire, &value);
+            }
+        }
+    }
 }
 
-static char *plc_datum_as_text(Datum input, plcTypeInfo *type) {
-    return DatumGetCString(OidFunctionCall3(type->output,
-                                            input,
-                                            type->typelem,
-                                            type->typmod));
+static void plc_datum_as_text(Datum input, plcTypeInfo *type, rawdata *output) {
+    output->value = DatumGetCString(OidFunctionCall3(type->output,
+                                                     input,
+                                                     type->typelem,
+                                                     type->typmod));
 }
 
-static char *plc_datum_as_bytea(Datum input, plcTypeInfo *type) {
+static void plc_datum_as_bytea(Datum input, plcTypeInfo *type UNUSED, rawdata *output) {
     text *txt = DatumGetByteaP(input);
     int len = VARSIZE(txt) - VARHDRSZ;
     char *out = (char*)pmalloc(len + 4);
     *((int*)out) = len;
     memcpy(out + 4, VARDATA(txt), len);
-    return out;
+    output->value = out;
+}
+
+/*
+ * Types stored in the array data area exactly as they are sent
+ */
+static bool plc_is_native_fixed_width(Oid typeOid) {
+    switch (typeOid) {
+        case BOOLOID:
+        case INT2OID:
+        case INT4OID:
+        case INT8OID:
+        case FLOAT4OID:
+        case FLOAT8OID:
+            return true;
+        default:
+            return false;
+    }
 }
 
-static char *plc_datum_as_array(Datum input, plcTypeInfo *type) {
+static void plc_datum_as_array(Datum input, plcTypeInfo *type, rawdata *output) {
     ArrayType          *array = DatumGetArrayTypeP(input);
     plcIterator        *iter;
     plcArrayMeta       *meta;
@@ -368,10 +674,15 @@ static char *plc_datum_as_array(Datum input, plcTypeInfo *type) {
         meta->size *= ARR_DIMS(array)[i];
     }
     iter->data = ARR_DATA_PTR(array);
+    iter->packed = NULL;
+    /* Native fixed-width elements without NULLs can be sent as they are */
+    if (pos->bitmap == NULL && plc_is_native_fixed_width(type->subTypes[0].typeOid)) {
+        iter->packed = ARR_DATA_PTR(array);
+    }
     iter->next = plc_backend_array_next;
     iter->cleanup = plc_backend_array_free;
 
-    return (char*)iter;
+    output->value = (char*)iter;
 }
 
 static void plc_backend_array_free(plcIterator *iter) {
@@ -402,7 +713,7 @@ static rawdata *plc_backend_array_next(plcIterator *self) {
     } else {
         res->isnull = 0;
         itemvalue = fetch_att(self->data, subtyp->typbyval, subtyp->typlen);
-        res->value = subtyp->outfunc(itemvalue, subtyp);
+        subtyp->outfunc(itemvalue, subtyp, res);
 
         self->data = att_addlength_pointer(self->data, subtyp->typlen, self->data);
         self->data = (char *) att_align_nominal(self->data, subtyp->typalign);
@@ -429,7 +740,7 @@ rec_data.t_tableOid = InvalidOid;
 rec_data.t_data = rec_header;
 vattr = heap_getattr(&rec_data, (i + 1), type->tupleDesc, &is_null);
 */
-static char *plc_datum_as_udt(Datum input, plcTypeInfo *type) {
+static void plc_datum_as_udt(Datum input, plcTypeInfo *type, rawdata *output) {
     HeapTupleHeader rec_header;
     plcUDT         *res;
     int             i, j;
@@ -455,13 +766,13 @@ static char *plc_datum_as_udt(Datum input, plcTypeInfo *type) {
                 res->data[j].value = NULL;
             } else {
                 res->data[j].isnull = false;
-                res->data[j].value = type->subTypes[i].outfunc(vattr, &type->subTypes[i]);
+                type->subTypes[i].outfunc(vattr, &type->subTypes[i], &res->data[j]);
             }
             j += 1;
         }
     }
 
-    return (char*)res;
+    output->value = (char*)res;
 }
 
 static Datum plc_datum_from_int1(char *input, plcTypeInfo *type UNUSED) {
@@ -488,9 +799,55 @@ static Datum plc_datum_from_float8(char *input, plcTypeInfo *type UNUSED) {
     return Float8GetDatum(*((float8*)input));
 }
 
-static Datum plc_datum_from_float8_numeric(char *input, plcTypeInfo *type UNUSED) {
-    Datum fdatum = Float8GetDatum(*((float8*)input));
-    return DirectFunctionCall1(float8_numeric, fdatum);
+/*
+ * Digits are checked on receive, the value is brought to the form PostgreSQL
+ * keeps it in: without leading and trailing zero digits, zero is positive
+ */
+static Datum plc_datum_from_numeric(char *input, plcTypeInfo *type UNUSED) {
+    plcNumeric     *num = (plcNumeric*)input;
+    unsigned short *digits = num->digits;
+    int             ndigits = num->ndigits;
+    int             weight = num->weight;
+    int             dscale = num->dscale;
+    int             sign;
+    Numeric         res;
+
+    if (num->sign == PLC_NUMERIC_NAN) {
+        sign    = NUMERIC_NAN;
+        ndigits = 0;
+        weight  = 0;
+        dscale  = 0;
+    } else {
+        sign = num->sign == PLC_NUMERIC_NEG ? NUMERIC_NEG : NUMERIC_POS;
+        while (ndigits > 0 && digits[0] == 0) {
+            digits++;
+            ndigits--;
+            weight--;
+        }
+        while (ndigits > 0 && digits[ndigits - 1] == 0) {
+            ndigits--;
+        }
+        if (ndigits == 0) {
+            sign   = NUMERIC_POS;
+            weight = 0;
+        }
+    }
+    if (weight != (int16)weight || dscale > NUMERIC_DSCALE_MASK) {
+        ereport(ERROR,
+                (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+                 errmsg("value overflows numeric format")));
+    }
+
+    res = (Numeric)palloc(NUMERIC_HDRSZ + ndigits * sizeof(int16));
+    SET_VARSIZE(res, NUMERIC_HDRSZ + ndigits * sizeof(int16));
+    res->n_weight      = weight;
+    res->n_sign_dscale = sign | dscale;
+    memcpy(res->n_data, digits, ndigits * sizeof(int16));
+    return NumericGetDatum(res);
+}
+
+static Datum plc_datum_from_numeric_ptr(char *input, plcTypeInfo *type) {
+    return plc_datum_from_numeric( *((char**)input), type );
 }
 
 static Datum plc_datum_from_text(char *input, plcTypeInfo *type) {
@@ -589,7 +946,7 @@ static Datum plc_datum_from_udt(char *input, plcTypeInfo *type) {
                 values[i] = (Datum) 0;
             } else {
                 nulls[i] = false;
-                values[i] = type->subTypes[j].infunc(udt->data[j].value, &type->subTypes[j]);
+                values[i] = type->subTypes[j].infunc(plc_raw_value(&udt->data[j]), &type->subTypes[j]);
             }
             j += 1;
         }
@@ -610,3 +967,45 @@ static Datum plc_datum_from_udt(char *input, plcTypeInfo *type) {
 static Datum plc_datum_from_udt_ptr(char *input, plcTypeInfo *type) {
     return plc_datum_from_udt(*((char**)input), type);
 }
+
+/*
+ * Forms the tuple of the composite type directly out of the result columns,
+ * one column for each attribute that is not dropped
+ */
+HeapTuple plc_form_tuple(plcTypeInfo *type, TupleDesc desc, rawdata *row, int ncols) {
+    HeapTuple  tuple;
+    Datum     *values;
+    bool      *nulls;
+    int        i, j;
+
+    values = palloc(sizeof(Datum) * type->nSubTypes);
+    nulls = palloc(sizeof(bool) * type->nSubTypes);
+    for (i = 0, j = 0; i < type->nSubTypes; ++i) {
+        if (type->subTypes[i].attisdropped) {
+            nulls[i] = true;
+            values[i] = (Datum) 0;
+            continue;
+        }
+        if (j >= ncols) {
+            elog(ERROR, "Result has %d columns while the function returns more attributes", ncols);
+        }
+        if (row[j].isnull) {
+            nulls[i] = true;
+            values[i] = (Datum) 0;
+        } else {
+            nulls[i] = false;
+            values[i] = type->subTypes[i].infunc(plc_raw_value(&row[j]), &type->subTypes[i]);
+        }
+        j += 1;
+    }
+    if (j != ncols) {
+        elog(ERROR, "Result has %d columns while the function returns %d attributes", ncols, j);
+    }
+
+    tuple = heap_form_tuple(desc, values, nulls);
+
+    pfree(values);
+    pfree(nulls);
+
+    return tuple;
+}
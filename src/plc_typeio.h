@@ -17,7 +17,7 @@
 #include "plcontainer.h"
 
 typedef struct plcTypeInfo plcTypeInfo;
-typedef char *(*plcDatumOutput)(Datum, plcTypeInfo*);
+typedef void (*plcDatumOutput)(Datum, plcTypeInfo*, rawdata*);
 typedef Datum (*plcDatumInput)(char*, plcTypeInfo*);
 
 struct plcTypeInfo {
@@ -41,6 +41,7 @@ struct plcTypeInfo {
     int16           typlen;
     char            typalign;
     int32           typmod;
+    ItemPointerData typ_tid;    /* pg_type tuple the information is built from */
 
     /* UDT-specific information */
     bool            is_rowtype;
@@ -58,9 +59,12 @@ typedef struct plcPgArrayPosition {
     int             bitmask;
 } plcPgArrayPosition;
 
-void fill_type_info(FunctionCallInfo fcinfo, Oid typeOid, plcTypeInfo *type);
+void plc_type_cache_init(void);
+void fill_type_info(FunctionCallInfo fcinfo, Oid typeOid, int32 typmod, plcTypeInfo *type);
 void copy_type_info(plcType *type, plcTypeInfo *ptype);
 void free_type_info(plcTypeInfo *type);
 char *fill_type_value(Datum funcArg, plcTypeInfo *argType);
+HeapTuple plc_form_tuple(plcTypeInfo *type, TupleDesc desc, rawdata *row, int ncols);
+void plc_raw_upgrade_numeric(plcArena *arena, plcTypeInfo *type, plcType *wire, rawdata *raw);
 
 #endif /* PLC_TYPEIO_H */
@@ -12,8 +12,16 @@
 #include "fmgr.h"
 #include "funcapi.h"
 #include "miscadmin.h"
+#include "access/heapam.h"
+#include "access/tupdesc.h"
+#include "access/xact.h"
+#include "executor/executor.h"
 #include "executor/spi.h"
 #include "commands/trigger.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/tuplestore.h"
+#include "utils/typcache.h"
 
 /* PLContainer Headers */
 #include "common/comm_channel.h"
@@ -23,6 +31,7 @@
 #include "containers.h"
 #include "plc_typeio.h"
 #include "plc_configuration.h"
+#include "function_cache.h"
 #include "plcontainer.h"
 
 #ifdef PG_MODULE_MAGIC
@@ -30,20 +39,128 @@ PG_MODULE_MAGIC;
 #endif
 
 PG_FUNCTION_INFO_V1(plcontainer_call_handler);
+PG_FUNCTION_INFO_V1(compression_stats);
+PG_FUNCTION_INFO_V1(plcontainer_call_batch);
 
-static Datum plcontainer_call_hook(PG_FUNCTION_ARGS);
+/* Number of result chunks or call batches requested ahead of the one being processed */
+static int plc_result_pipeline_depth = 1;
+
+/* Number of rows sent to the container in one batch call */
+static int plc_batch_size = 1000;
+
+/* Batch calls in progress, nested ones are not sent ahead */
+static int plc_batch_calls = 0;
+
+/*
+ * Estimated size of the arguments of one batch and of the batches sent ahead
+ * of the one the container is processing. Batches sent ahead fit into the
+ * socket buffers, so the backend is not blocked sending them while the
+ * container is blocked sending the result
+ */
+#define PLC_BATCH_MAX_BYTES   32768
+#define PLC_BATCH_AHEAD_BYTES 65536
+
+/*
+ * Set-returning function result the client is sending in chunks. Client keeps
+ * waiting for the next chunk request, so the connection is dropped if the
+ * transaction that started the call is aborted before the result is read
+ */
+typedef struct plcResultStream {
+    plcConn                *conn;
+    int                     level; /* transaction nesting level of the call */
+    struct plcResultStream *next;
+} plcResultStream;
+
+static plcResultStream *plc_result_streams = NULL;
+
+void _PG_init(void);
+
+static Datum plcontainer_call_hook(FunctionCallInfo fcinfo, plcProcInfo *pinfo);
+static Datum plcontainer_materialize_result(FunctionCallInfo  fcinfo,
+                                            plcProcInfo      *pinfo);
 static plcProcResult *plcontainer_get_result(FunctionCallInfo  fcinfo,
                                              plcProcInfo      *pinfo);
+static plcConn *plcontainer_connect(plcMsgCallreq *req);
+static int plcontainer_fill_batch(plcProcInfo        *pinfo,
+                                  plcMsgCallreqBatch *batch,
+                                  int                 maxrows,
+                                  SPITupleTable      *tuptable,
+                                  int                 ntuples,
+                                  int                *next,
+                                  int                 bytes);
+static plcMsgResult *plcontainer_receive_result(plcConn *conn);
+static void plcontainer_request_result(plcProcResult *presult, bool cancel);
+static void plcontainer_next_result(plcProcResult *presult, bool cancel);
+static void plcontainer_result_shutdown(Datum arg);
+static void plcontainer_upgrade_result(plcProcInfo *pinfo, plcProcResult *presult);
+static void plcontainer_open_stream(plcProcResult *presult);
+static void plcontainer_close_stream(plcProcResult *presult);
+static void plcontainer_forget_streams(plcConn *conn);
+static void plcontainer_abort_streams(int level);
+static void plcontainer_xact_callback(XactEvent event, void *arg);
+static void plcontainer_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+                                         SubTransactionId parentSubid, void *arg);
 static Datum plcontainer_process_result(FunctionCallInfo  fcinfo,
                                         plcProcInfo      *pinfo,
                                         plcProcResult    *presult);
+static bool plcontainer_result_is_row(plcProcInfo *pinfo, plcMsgResult *resmsg);
+static HeapTuple plcontainer_form_result_tuple(plcProcInfo   *pinfo,
+                                               TupleDesc      tupdesc,
+                                               plcMsgResult  *resmsg,
+                                               int            row,
+                                               HeapTuple      tmptup);
 static void plcontainer_process_exception(plcMsgError *msg);
 static void plcontainer_process_sql(plcMsgSQL *msg, plcConn* conn);
 static void plcontainer_process_log(plcMsgLog *log);
 
+void _PG_init(void) {
+#if PG_VERSION_NUM >= 80300
+    DefineCustomIntVariable("plcontainer.result_pipeline_depth",
+                            "Number of result chunks of a set-returning function, or "
+                            "call batches, the container works on ahead of the one being processed.",
+                            NULL,
+                            &plc_result_pipeline_depth,
+                            1,
+                            0, 100,
+                            PGC_USERSET,
+                            NULL, NULL);
+    DefineCustomIntVariable("plcontainer.batch_size",
+                            "Number of rows sent to the container in one batch call.",
+                            NULL,
+                            &plc_batch_size,
+                            1000,
+                            1, 100000,
+                            PGC_USERSET,
+                            NULL, NULL);
+#else
+    DefineCustomIntVariable("plcontainer.result_pipeline_depth",
+                            "Number of result chunks of a set-returning function, or "
+                            "call batches, the container works on ahead of the one being processed.",
+                            NULL,
+                            &plc_result_pipeline_depth,
+                            0, 100,
+                            PGC_USERSET,
+                            NULL, NULL);
+    DefineCustomIntVariable("plcontainer.batch_size",
+                            "Number of rows sent to the container in one batch call.",
+                            NULL,
+                            &plc_batch_size,
+                            1, 100000,
+                            PGC_USERSET,
+                            NULL, NULL);
+#endif
+
+    RegisterXactCallback(plcontainer_xact_callback, NULL);
+    RegisterSubXactCallback(plcontainer_subxact_callback, NULL);
+
+    function_cache_init();
+    plc_type_cache_init();
+}
+
 Datum plcontainer_call_handler(PG_FUNCTION_ARGS) {
     Datum datumreturn = (Datum) 0;
     MemoryContext oldMC = NULL;
+    plcProcInfo *volatile pinfo = NULL;
     int ret;
 
     /* TODO: handle trigger requests as well */
@@ -68,10 +185,17 @@ Datum plcontainer_call_handler(PG_FUNCTION_ARGS) {
      */
     PG_TRY();
     {
-        datumreturn = plcontainer_call_hook(fcinfo);
+        /* Get procedure info from cache or compose it based on catalog. It
+         * stays pinned, so the nested calls cannot evict it from the cache */
+        pinfo = get_proc_info(fcinfo);
+        datumreturn = plcontainer_call_hook(fcinfo, pinfo);
     }
     PG_CATCH();
     {
+        if (pinfo != NULL) {
+            function_cache_unpin(pinfo);
+        }
+
         /* If the reason is Cancel or Termination */
         if (InterruptPending || QueryCancelPending || QueryFinishPending) {
             //elog(DEBUG1, "Terminating containers due to user request");
@@ -80,6 +204,7 @@ Datum plcontainer_call_handler(PG_FUNCTION_ARGS) {
         PG_RE_THROW();
     }
     PG_END_TRY();
+    function_cache_unpin(pinfo);
 
     /* Return to old memory context */
     ret = SPI_finish();
@@ -91,9 +216,311 @@ Datum plcontainer_call_handler(PG_FUNCTION_ARGS) {
     return datumreturn;
 }
 
-static Datum plcontainer_call_hook(PG_FUNCTION_ARGS) {
+/*
+ * Returns the compression counters of the current session: values it sent
+ * to the containers compressed and values it received compressed from them
+ */
+Datum compression_stats(PG_FUNCTION_ARGS) {
+    plcCompressionStats *stats = &plc_compression_stats;
+    TupleDesc tupdesc;
+    Datum     values[10];
+    bool      nulls[10];
+    HeapTuple tuple;
+    int64     raw = stats->compressedIn + stats->decompressedOut;
+    int64     packed = stats->compressedOut + stats->decompressedIn;
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+        elog(ERROR, "Function returning record called in context that cannot accept type record");
+    }
+    tupdesc = BlessTupleDesc(tupdesc);
+
+    memset(nulls, 0, sizeof(nulls));
+    values[0] = Int64GetDatum(stats->compressedValues);
+    values[1] = Int64GetDatum(stats->skippedValues);
+    values[2] = Int64GetDatum(stats->compressedIn);
+    values[3] = Int64GetDatum(stats->compressedOut);
+    values[4] = Float8GetDatum(stats->compressUsec / 1000.0);
+    values[5] = Int64GetDatum(stats->decompressedValues);
+    values[6] = Int64GetDatum(stats->decompressedIn);
+    values[7] = Int64GetDatum(stats->decompressedOut);
+    values[8] = Float8GetDatum(stats->decompressUsec / 1000.0);
+    if (packed > 0) {
+        values[9] = Float8GetDatum((double)raw / packed);
+    } else {
+        nulls[9] = true;
+    }
+
+    tuple = heap_form_tuple(tupdesc, values, nulls);
+    PG_RETURN_DATUM(HeapTupleGetDatum(tuple));
+}
+
+/*
+ * Calls the function for each row of the query, sending the rows to the
+ * container in batches answered with one result message each. Up to
+ * plcontainer.result_pipeline_depth batches are sent before the result of
+ * the previous one is received, so the container computes them while the
+ * results are stored. Results are returned in the order of the query rows
+ */
+Datum plcontainer_call_batch(PG_FUNCTION_ARGS) {
+    ReturnSetInfo       *rsinfo = (ReturnSetInfo*)fcinfo->resultinfo;
+    Oid                  funcoid = PG_GETARG_OID(0);
+    char                *query;
+    FmgrInfo             flinfo;
+    FunctionCallInfoData callinfo;
+    plcProcInfo         *pinfo;
+    plcMsgCallreq       *req;
+    plcMsgCallreqBatch   batch;
+    plcProcResult        presult;
+    plcConn *volatile    conn = NULL;
+    volatile int         outstanding = 0;
+    MemoryContext        oldMC;
+    MemoryContext        oldcontext;
+    MemoryContext        argcontext;
+    MemoryContext        rowcontext;
+    TupleDesc            tupdesc;
+    Tuplestorestate     *tupstore;
+    HeapTuple            tuple;
+    HeapTupleData        tmptup;
+    SPITupleTable       *tuptable = NULL;
+    SPITupleTable       *spent = NULL;
+    Portal               portal;
+    void                *plan;
+    int                 *sentrows;
+    int                 *sentbytes;
+    int                  maxrows = plc_batch_size;
+    int                  depth, head = 0, ahead = 0, bytes = 0;
+    int                  ntuples = 0, next = 0;
+    bool                 done = false;
+    int                  i, ret;
+
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo)
+            || !(rsinfo->allowedModes & SFRM_Materialize)
+            || rsinfo->expectedDesc == NULL) {
+        elog(ERROR, "Batch call has to be used in the FROM clause with a column definition list");
+    }
+    query = DatumGetCString(DirectFunctionCall1(textout, PG_GETARG_DATUM(1)));
+
+    fmgr_info(funcoid, &flinfo);
+    if (flinfo.fn_addr != plcontainer_call_handler) {
+        elog(ERROR, "Function %u is not a PL/Container function", funcoid);
+    }
+    if (flinfo.fn_retset) {
+        elog(ERROR, "Set-returning function cannot be called in batch mode");
+    }
+
+    /* Call info of the function itself, argument values come from the rows */
+    InitFunctionCallInfoData(callinfo, &flinfo, flinfo.fn_nargs, NULL, NULL);
+    for (i = 0; i < flinfo.fn_nargs; i++) {
+        callinfo.arg[i]     = (Datum) 0;
+        callinfo.argnull[i] = true;
+    }
+
+    oldMC = pl_container_caller_context;
+    pl_container_caller_context = CurrentMemoryContext;
+
+    ret = SPI_connect();
+    if (ret != SPI_OK_CONNECT)
+        elog(ERROR, "[plcontainer] SPI connect error: %d (%s)", ret,
+             SPI_result_code_string(ret));
+
+    /* Pin left by the errors outside of the try block is dropped when the
+     * transaction ends */
+    pinfo = get_proc_info(&callinfo);
+    if (pinfo->rettype.type == PLC_DATA_UDT) {
+        elog(ERROR, "Function returning composite type cannot be called in batch mode");
+    }
+    if (rsinfo->expectedDesc->natts != 1
+            || rsinfo->expectedDesc->attrs[0]->atttypid != pinfo->rettype.typeOid) {
+        elog(ERROR, "Batch call has to return one column of the function result type");
+    }
+
+    plan = SPI_prepare(query, 0, NULL);
+    if (plan == NULL) {
+        elog(ERROR, "[plcontainer] SPI prepare error: %d (%s)", SPI_result,
+             SPI_result_code_string(SPI_result));
+    }
+    portal = SPI_cursor_open(NULL, plan, NULL, NULL, false);
+
+    /* Results are stored the same way as the materialized set */
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupdesc  = CreateTupleDescCopy(rsinfo->expectedDesc);
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    MemoryContextSwitchTo(oldcontext);
+
+    argcontext = AllocSetContextCreate(CurrentMemoryContext,
+                                       "PL/Container batch arguments",
+                                       ALLOCSET_DEFAULT_MINSIZE,
+                                       ALLOCSET_DEFAULT_INITSIZE,
+                                       ALLOCSET_DEFAULT_MAXSIZE);
+    rowcontext = AllocSetContextCreate(CurrentMemoryContext,
+                                       "PL/Container result rows",
+                                       ALLOCSET_DEFAULT_MINSIZE,
+                                       ALLOCSET_DEFAULT_INITSIZE,
+                                       ALLOCSET_DEFAULT_MAXSIZE);
+
+    req = plcontainer_create_call(&callinfo, pinfo);
+    batch.call         = *req;
+    batch.call.msgtype = MT_CALLREQ_BATCH;
+    batch.ahead        = 0;
+    batch.nrows        = 0;
+    batch.rows         = palloc(maxrows * sizeof(rawdata*));
+
+    plc_batch_calls += 1;
+    PG_TRY();
+    {
+        conn = plcontainer_connect(req);
+        if (!(conn->features & PLC_FEATURE_BATCH)) {
+            elog(ERROR, "Container of function '%s' does not support batch calls", pinfo->name);
+        }
+
+        /* Client without PLC_FEATURE_PIPELINE cannot take the batches sent
+         * ahead while waiting for SQL results, nested batch calls do not
+         * send them to keep the batches of the outer call queued */
+        depth = plc_result_pipeline_depth;
+        if (!(conn->features & PLC_FEATURE_PIPELINE) || plc_batch_calls > 1) {
+            depth = 0;
+        }
+        sentrows  = palloc((depth + 1) * sizeof(int));
+        sentbytes = palloc((depth + 1) * sizeof(int));
+
+        while (1) {
+            while (!done && batch.nrows < maxrows && bytes < PLC_BATCH_MAX_BYTES) {
+                if (next < ntuples) {
+                    MemoryContextSwitchTo(argcontext);
+                    bytes = plcontainer_fill_batch(pinfo, &batch, maxrows, tuptable, ntuples,
+                                                   &next, bytes);
+                    MemoryContextSwitchTo(oldcontext);
+                    continue;
+                }
+
+                /* Values of the arrays are read from the tuples when the
+                 * batch is sent, so at most two tables are kept */
+                if (spent != NULL) {
+                    break;
+                }
+                if (tuptable != NULL && batch.nrows > 0) {
+                    spent = tuptable;
+                } else if (tuptable != NULL) {
+                    SPI_freetuptable(tuptable);
+                }
+                SPI_cursor_fetch(portal, true, maxrows);
+                tuptable = SPI_tuptable;
+                ntuples  = SPI_processed;
+                next     = 0;
+                if (ntuples == 0) {
+                    done = true;
+                } else if (tuptable->tupdesc->natts != pinfo->nargs) {
+                    elog(ERROR, "Batch query returns %d columns, function '%s' takes %d arguments",
+                         tuptable->tupdesc->natts, pinfo->name, pinfo->nargs);
+                }
+                for (i = 0; i < pinfo->nargs && ntuples > 0; i++) {
+                    if (tuptable->tupdesc->attrs[i]->atttypid != pinfo->argtypes[i].typeOid) {
+                        elog(ERROR, "Column %d of the batch query does not match the type "
+                                    "of the argument of function '%s'", i + 1, pinfo->name);
+                    }
+                }
+            }
+
+            /* Batch is sent ahead only if the batches being processed leave
+             * room for it in the socket buffers */
+            if (batch.nrows > 0 && (outstanding == 0
+                    || (outstanding <= depth && ahead + bytes <= PLC_BATCH_AHEAD_BYTES))) {
+                conn->seq += 1;
+                batch.call.seq = conn->seq;
+                batch.ahead    = outstanding > 0;
+                plcontainer_channel_send(conn, (plcMessage*)&batch);
+                batch.call.hasChanged = 0;
+
+                i = (head + outstanding) % (depth + 1);
+                sentrows[i]  = batch.nrows;
+                sentbytes[i] = bytes;
+                outstanding += 1;
+                ahead += bytes;
+
+                batch.nrows = 0;
+                bytes = 0;
+                MemoryContextReset(argcontext);
+                if (spent != NULL) {
+                    SPI_freetuptable(spent);
+                    spent = NULL;
+                }
+                continue;
+            }
+            if (outstanding == 0) {
+                break;
+            }
+
+            /* Client answers the batches in the order they are sent */
+            outstanding -= 1;
+            presult.resmsg    = plcontainer_receive_result(conn);
+            presult.resrow    = 0;
+            presult.conn      = conn;
+            presult.seq       = 0;
+            presult.requested = 0;
+            presult.stream    = NULL;
+            if (presult.resmsg->msgtype != MT_RESULT || presult.resmsg->rows != sentrows[head]) {
+                elog(ERROR, "Batch call result has %d rows, %d expected",
+                     presult.resmsg->rows, sentrows[head]);
+            }
+            plcontainer_upgrade_result(pinfo, &presult);
+            ahead -= sentbytes[head];
+            head = (head + 1) % (depth + 1);
+
+            for (presult.resrow = 0; presult.resrow < presult.resmsg->rows; presult.resrow++) {
+                MemoryContextSwitchTo(rowcontext);
+                tuple = plcontainer_form_result_tuple(pinfo, tupdesc, presult.resmsg,
+                                                      presult.resrow, &tmptup);
+
+                /* Tuplestore copies the tuple into the current memory context */
+                MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+                tuplestore_puttuple(tupstore, tuple);
+                MemoryContextSwitchTo(oldcontext);
+            }
+            MemoryContextReset(rowcontext);
+            plcontainer_channel_release((plcMessage*)presult.resmsg);
+        }
+    }
+    PG_CATCH();
+    {
+        plc_batch_calls -= 1;
+        pl_container_caller_context = oldMC;
+        function_cache_unpin(pinfo);
+
+        /* If the reason is Cancel or Termination */
+        if (InterruptPending || QueryCancelPending || QueryFinishPending) {
+            stop_containers();
+        } else if (outstanding > 0) {
+            /* Results of the batches sent ahead would be taken by the next call */
+            stop_container(conn);
+        }
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+    plc_batch_calls -= 1;
+    function_cache_unpin(pinfo);
+
+    SPI_cursor_close(portal);
+    free_callreq(req, true, true);
+    MemoryContextDelete(argcontext);
+    MemoryContextDelete(rowcontext);
+
+    ret = SPI_finish();
+    if (ret != SPI_OK_FINISH)
+        elog(ERROR, "[plcontainer] SPI finish error: %d (%s)", ret,
+             SPI_result_code_string(ret));
+    pl_container_caller_context = oldMC;
+
+    tuplestore_donestoring(tupstore);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult  = tupstore;
+    rsinfo->setDesc    = tupdesc;
+
+    fcinfo->isnull = true;
+    return (Datum) 0;
+}
+
+static Datum plcontainer_call_hook(FunctionCallInfo fcinfo, plcProcInfo *pinfo) {
     Datum                     result = (Datum) 0;
-    plcProcInfo              *pinfo;
     bool                      bFirstTimeCall = true;
     FuncCallContext *volatile funcctx = NULL;
     MemoryContext             oldcontext = NULL;
@@ -102,8 +529,13 @@ static Datum plcontainer_call_hook(PG_FUNCTION_ARGS) {
     /* By default we return NULL */
     fcinfo->isnull = true;
 
-    /* Get procedure info from cache or compose it based on catalog */
-    pinfo = get_proc_info(fcinfo);
+    /* Whole result set is returned at once if the caller allows it */
+    if (fcinfo->flinfo->fn_retset
+            && fcinfo->resultinfo != NULL
+            && IsA(fcinfo->resultinfo, ReturnSetInfo)
+            && (((ReturnSetInfo*)fcinfo->resultinfo)->allowedModes & SFRM_Materialize)) {
+        return plcontainer_materialize_result(fcinfo, pinfo);
+    }
 
     /* If we have a set-retuning function */
     if (fcinfo->flinfo->fn_retset) {
@@ -129,14 +561,35 @@ static Datum plcontainer_call_hook(PG_FUNCTION_ARGS) {
         presult = plcontainer_get_result(fcinfo, pinfo);
         if (fcinfo->flinfo->fn_retset) {
             funcctx->user_fctx = (void*)presult;
+            /* Client should be told to stop if the executor does not need
+             * all the rows */
+            if (presult->resmsg->msgtype == MT_RESULT_CHUNK) {
+                plcontainer_open_stream(presult);
+                RegisterExprContextCallback(((ReturnSetInfo*)fcinfo->resultinfo)->econtext,
+                                            plcontainer_result_shutdown,
+                                            PointerGetDatum(presult));
+            }
         }
     } else {
         presult = (plcProcResult*)funcctx->user_fctx;
     }
 
+    /* Request the next chunk when the current one is consumed */
+    while (presult->resrow >= presult->resmsg->rows
+            && presult->resmsg->msgtype == MT_RESULT_CHUNK) {
+        plcontainer_next_result(presult, false);
+        plcontainer_upgrade_result(pinfo, presult);
+        if (presult->resmsg->msgtype != MT_RESULT_CHUNK) {
+            plcontainer_close_stream(presult);
+            UnregisterExprContextCallback(((ReturnSetInfo*)fcinfo->resultinfo)->econtext,
+                                          plcontainer_result_shutdown,
+                                          PointerGetDatum(presult));
+        }
+    }
+
     /* If we processed all the rows or the function returned 0 rows we can return immediately */
     if (presult->resrow >= presult->resmsg->rows) {
-        free_result(presult->resmsg, false);
+        plcontainer_channel_release((plcMessage*)presult->resmsg);
         pfree(presult);
         MemoryContextSwitchTo(oldcontext);
         SRF_RETURN_DONE(funcctx);
@@ -151,22 +604,169 @@ static Datum plcontainer_call_hook(PG_FUNCTION_ARGS) {
     if (fcinfo->flinfo->fn_retset) {
         SRF_RETURN_NEXT(funcctx, result);
     } else {
-        free_result(presult->resmsg, false);
+        plcontainer_channel_release((plcMessage*)presult->resmsg);
         pfree(presult);
     }
 
     return result;
 }
 
+/*
+ * Set-returning function in materialize mode. All the result chunks are
+ * converted into the tuplestore that spills to disk after work_mem, so the
+ * raw result messages are freed as soon as they are processed. Nothing else
+ * is sent over the connection until the last chunk arrives, so the following
+ * chunks are requested before the current one is converted and the container
+ * computes them meanwhile
+ */
+static Datum plcontainer_materialize_result(FunctionCallInfo  fcinfo,
+                                            plcProcInfo      *pinfo) {
+    ReturnSetInfo   *rsinfo = (ReturnSetInfo*)fcinfo->resultinfo;
+    MemoryContext    oldcontext;
+    MemoryContext    rowcontext;
+    TupleDesc        tupdesc;
+    Tuplestorestate *tupstore;
+    plcProcResult   *presult;
+    HeapTuple        tuple;
+    HeapTupleData    tmptup;
+
+    /* Tuplestore and its descriptor are used after the function returns */
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    if (pinfo->rettype.type == PLC_DATA_UDT) {
+        TupleDesc desc = lookup_rowtype_tupdesc(pinfo->rettype.typeOid,
+                                                pinfo->rettype.typmod);
+        tupdesc = CreateTupleDescCopy(desc);
+        ReleaseTupleDesc(desc);
+    } else {
+        tupdesc = CreateTemplateTupleDesc(1, false);
+        TupleDescInitEntry(tupdesc, (AttrNumber) 1, "plcontainer",
+                           pinfo->rettype.typeOid, -1, 0);
+    }
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    MemoryContextSwitchTo(oldcontext);
+
+    rowcontext = AllocSetContextCreate(CurrentMemoryContext,
+                                       "PL/Container result rows",
+                                       ALLOCSET_DEFAULT_MINSIZE,
+                                       ALLOCSET_DEFAULT_INITSIZE,
+                                       ALLOCSET_DEFAULT_MAXSIZE);
+
+    presult = plcontainer_get_result(fcinfo, pinfo);
+    if (presult->resmsg->msgtype == MT_RESULT_CHUNK) {
+        plcontainer_open_stream(presult);
+    }
+    while (1) {
+        if (presult->resmsg->msgtype == MT_RESULT_CHUNK) {
+            while (presult->requested < plc_result_pipeline_depth) {
+                plcontainer_request_result(presult, false);
+            }
+        }
+
+        for (presult->resrow = 0; presult->resrow < presult->resmsg->rows; presult->resrow++) {
+            MemoryContextSwitchTo(rowcontext);
+            tuple = plcontainer_form_result_tuple(pinfo, tupdesc, presult->resmsg,
+                                                  presult->resrow, &tmptup);
+
+            /* Tuplestore copies the tuple into the current memory context */
+            MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+            tuplestore_puttuple(tupstore, tuple);
+            MemoryContextSwitchTo(oldcontext);
+        }
+        MemoryContextReset(rowcontext);
+
+        if (presult->resmsg->msgtype != MT_RESULT_CHUNK) {
+            break;
+        }
+        plcontainer_next_result(presult, false);
+        plcontainer_upgrade_result(pinfo, presult);
+    }
+    plcontainer_close_stream(presult);
+
+    plcontainer_channel_release((plcMessage*)presult->resmsg);
+    pfree(presult);
+    MemoryContextDelete(rowcontext);
+
+    tuplestore_donestoring(tupstore);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult  = tupstore;
+    rsinfo->setDesc    = tupdesc;
+
+    fcinfo->isnull = true;
+    return (Datum) 0;
+}
+
+/*
+ * Converts the query rows into the argument rows of the batch until the
+ * batch is full, returns the estimated size of the batch arguments
+ */
+static int plcontainer_fill_batch(plcProcInfo        *pinfo,
+                                  plcMsgCallreqBatch *batch,
+                                  int                 maxrows,
+                                  SPITupleTable      *tuptable,
+                                  int                 ntuples,
+                                  int                *next,
+                                  int                 bytes) {
+    HeapTuple tuple;
+    rawdata  *row;
+    Datum     value;
+    bool      isnull;
+    int       j;
+
+    while (*next < ntuples && batch->nrows < maxrows && bytes < PLC_BATCH_MAX_BYTES) {
+        tuple = tuptable->vals[*next];
+        row   = palloc((pinfo->nargs + 1) * sizeof(rawdata));
+        for (j = 0; j < pinfo->nargs; j++) {
+            value = SPI_getbinval(tuple, tuptable->tupdesc, j + 1, &isnull);
+            if (isnull) {
+                row[j].isnull = 1;
+                row[j].value  = NULL;
+            } else {
+                row[j].isnull = 0;
+                pinfo->argtypes[j].outfunc(value, &pinfo->argtypes[j], &row[j]);
+            }
+        }
+        batch->rows[batch->nrows++] = row;
+        bytes += tuple->t_len;
+        *next += 1;
+    }
+    return bytes;
+}
+
 static plcProcResult *plcontainer_get_result(FunctionCallInfo  fcinfo,
                                              plcProcInfo      *pinfo) {
-    char          *name;
     plcConn       *conn;
-    int            message_type;
     plcMsgCallreq *req    = NULL;
     plcProcResult *result = NULL;
 
     req = plcontainer_create_call(fcinfo, pinfo);
+    conn = plcontainer_connect(req);
+
+    if (conn != NULL) {
+        conn->seq += 1;
+        req->seq = conn->seq;
+        plcontainer_channel_send(conn, (plcMessage*)req);
+        free_callreq(req, true, true);
+
+        result = (plcProcResult*)pmalloc(sizeof(plcProcResult));
+        result->resmsg    = plcontainer_receive_result(conn);
+        result->resrow    = 0;
+        result->conn      = conn;
+        result->seq       = conn->seq;
+        result->requested = 0;
+        result->stream    = NULL;
+        plcontainer_upgrade_result(pinfo, result);
+    }
+    return result;
+}
+
+/*
+ * Connection to the container of the called function, the container is
+ * started if it is not running
+ */
+static plcConn *plcontainer_connect(plcMsgCallreq *req) {
+    char    *name;
+    plcConn *conn;
+
     name = parse_container_meta(req->proc.src);
     conn = find_container(name);
     if (conn == NULL) {
@@ -180,48 +780,213 @@ static plcProcResult *plcontainer_get_result(FunctionCallInfo  fcinfo,
         }
     }
     pfree(name);
+    return conn;
+}
 
-    if (conn != NULL) {
-        plcontainer_channel_send(conn, (plcMessage*)req);
-        free_callreq(req, true, true);
+/*
+ * Receive the result message or the next result chunk, processing SQL and
+ * log messages from the client in between
+ */
+static plcMsgResult *plcontainer_receive_result(plcConn *conn) {
+    int           message_type;
+    plcMsgResult *result = NULL;
 
-        while (1) {
-            int res = 0;
-            plcMessage *answer;
+    while (1) {
+        int res = 0;
+        plcMessage *answer;
+
+        res = plcontainer_channel_receive(conn, &answer);
+        if (res < 0) {
+            elog(ERROR, "Error receiving data from the client, %d", res);
+            break;
+        }
 
-            res = plcontainer_channel_receive(conn, &answer);
-            if (res < 0) {
-                elog(ERROR, "Error receiving data from the client, %d", res);
+        message_type = answer->msgtype;
+        switch (message_type) {
+            case MT_RESULT:
+            case MT_RESULT_CHUNK:
+                result = (plcMsgResult*)answer;
                 break;
-            }
+            case MT_EXCEPTION:
+                /* Client stops sending all its results when reporting an error */
+                plcontainer_forget_streams(conn);
+                plcontainer_process_exception((plcMsgError*)answer);
+                break;
+            case MT_SQL:
+                plcontainer_process_sql((plcMsgSQL*)answer, conn);
+                plcontainer_channel_release(answer);
+                break;
+            case MT_LOG:
+                plcontainer_process_log((plcMsgLog*)answer);
+                plcontainer_channel_release(answer);
+                break;
+            default:
+                elog(ERROR, "Received unhandled message with type id %d "
+                "from client", message_type);
+                break;
+        }
 
-            message_type = answer->msgtype;
-            switch (message_type) {
-                case MT_RESULT:
-                    result = (plcProcResult*)pmalloc(sizeof(plcProcResult));
-                    result->resmsg = (plcMsgResult*)answer;
-                    result->resrow = 0;
-                    break;
-                case MT_EXCEPTION:
-                    plcontainer_process_exception((plcMsgError*)answer);
-                    break;
-                case MT_SQL:
-                    plcontainer_process_sql((plcMsgSQL*)answer, conn);
-                    break;
-                case MT_LOG:
-                    plcontainer_process_log((plcMsgLog*)answer);
-                    break;
-                default:
-                    elog(ERROR, "Received unhandled message with type id %d "
-                    "from client", message_type);
-                    break;
-            }
+        if (message_type != MT_SQL && message_type != MT_LOG)
+            break;
+    }
+    return result;
+}
+
+/*
+ * Ask the client for the next chunk of the set-returning function result,
+ * or tell it to stop producing rows if the cancel flag is set
+ */
+static void plcontainer_request_result(plcProcResult *presult, bool cancel) {
+    plcMsgResultNext next;
+
+    next.msgtype = MT_RESULT_NEXT;
+    next.cancel  = cancel ? 1 : 0;
+    next.seq     = presult->seq;
+    plcontainer_channel_send(presult->conn, (plcMessage*)&next);
+
+    if (!cancel) {
+        presult->requested += 1;
+    }
+}
+
+/*
+ * Replace the processed result chunk with the next one, requesting it unless
+ * it has been requested ahead
+ */
+static void plcontainer_next_result(plcProcResult *presult, bool cancel) {
+    plcontainer_channel_release((plcMessage*)presult->resmsg);
+    presult->resmsg = NULL;
+    presult->resrow = 0;
+
+    if (cancel || presult->requested == 0) {
+        plcontainer_request_result(presult, cancel);
+    }
+
+    if (!cancel) {
+        presult->resmsg = plcontainer_receive_result(presult->conn);
+        presult->requested -= 1;
+    }
+}
+
+/*
+ * Called on executor shutdown of the set-returning function that has not
+ * received all the result chunks
+ */
+static void plcontainer_result_shutdown(Datum arg) {
+    plcProcResult *presult = (plcProcResult*)DatumGetPointer(arg);
+
+    if (presult->resmsg != NULL && presult->resmsg->msgtype == MT_RESULT_CHUNK) {
+        plcontainer_next_result(presult, true);
+    }
+    plcontainer_close_stream(presult);
+}
+
+static void plcontainer_open_stream(plcProcResult *presult) {
+    plcResultStream *stream;
+
+    stream = MemoryContextAlloc(TopMemoryContext, sizeof(plcResultStream));
+    stream->conn  = presult->conn;
+    stream->level = GetCurrentTransactionNestLevel();
+    stream->next  = plc_result_streams;
+    plc_result_streams = stream;
+    presult->stream = stream;
+}
 
-            if (message_type != MT_SQL && message_type != MT_LOG)
+static void plcontainer_close_stream(plcProcResult *presult) {
+    plcResultStream **link;
+
+    /* Entry is already gone if the client has reported an error */
+    for (link = &plc_result_streams; *link != NULL; link = &(*link)->next) {
+        if (*link == presult->stream) {
+            *link = presult->stream->next;
+            pfree(presult->stream);
+            break;
+        }
+    }
+    presult->stream = NULL;
+}
+
+static void plcontainer_forget_streams(plcConn *conn) {
+    plcResultStream **link = &plc_result_streams;
+    plcResultStream  *stream;
+
+    while (*link != NULL) {
+        stream = *link;
+        if (stream->conn == conn) {
+            *link = stream->next;
+            pfree(stream);
+        } else {
+            link = &stream->next;
+        }
+    }
+}
+
+/*
+ * Client blocked waiting for the next chunk request of the aborted call
+ * cannot be told to stop in the middle of the nested calls, so its container
+ * is stopped and started again by the next call
+ */
+static void plcontainer_abort_streams(int level) {
+    plcResultStream *stream = plc_result_streams;
+    plcConn         *conn;
+
+    while (stream != NULL) {
+        if (stream->level >= level) {
+            conn = stream->conn;
+            elog(DEBUG1, "Stopping container with the result set being sent");
+            plcontainer_forget_streams(conn);
+            stop_container(conn);
+            stream = plc_result_streams;
+        } else {
+            stream = stream->next;
+        }
+    }
+}
+
+static void plcontainer_xact_callback(XactEvent event, void *arg) {
+    if (event == XACT_EVENT_ABORT) {
+        plcontainer_abort_streams(0);
+    }
+    if (event == XACT_EVENT_COMMIT || event == XACT_EVENT_ABORT) {
+        function_cache_end_xact();
+    }
+}
+
+static void plcontainer_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+                                         SubTransactionId parentSubid, void *arg) {
+    if (event == SUBXACT_EVENT_ABORT_SUB) {
+        plcontainer_abort_streams(GetCurrentTransactionNestLevel());
+    }
+}
+
+/*
+ * Client without PLC_FEATURE_NUMERIC returns numeric values as float8, they
+ * are converted before the input functions of numeric see them
+ */
+static void plcontainer_upgrade_result(plcProcInfo *pinfo, plcProcResult *presult) {
+    plcMsgResult *resmsg = presult->resmsg;
+    plcTypeInfo  *type;
+    int           i, j, k;
+
+    if (presult->conn->features & PLC_FEATURE_NUMERIC) {
+        return;
+    }
+    for (j = 0, k = 0; j < resmsg->cols; j++) {
+        type = &pinfo->rettype;
+        if (plcontainer_result_is_row(pinfo, resmsg)) {
+            /* Columns are sent for the attributes that are not dropped */
+            while (k < pinfo->rettype.nSubTypes && pinfo->rettype.subTypes[k].attisdropped) {
+                k++;
+            }
+            if (k >= pinfo->rettype.nSubTypes) {
                 break;
+            }
+            type = &pinfo->rettype.subTypes[k++];
+        }
+        for (i = 0; i < resmsg->rows; i++) {
+            plc_raw_upgrade_numeric(resmsg->arena, type, &resmsg->types[j], &resmsg->data[i][j]);
         }
     }
-    return result;
 }
 
 /*
@@ -233,11 +998,6 @@ static Datum plcontainer_process_result(FunctionCallInfo  fcinfo,
     Datum         result = (Datum) 0;
     plcMsgResult *resmsg = presult->resmsg;
 
-    if (resmsg->cols > 1) {
-        elog(ERROR, "Functions returning multiple columns are not supported yet");
-        return result;
-    }
-
     if (resmsg->rows == 0) {
         return result;
     }
@@ -250,14 +1010,92 @@ static Datum plcontainer_process_result(FunctionCallInfo  fcinfo,
         return result;
     }
 
+    /* Composite result is sent as one column per attribute */
+    if (plcontainer_result_is_row(pinfo, resmsg)) {
+        TupleDesc desc = lookup_rowtype_tupdesc(pinfo->rettype.typeOid,
+                                                pinfo->rettype.typmod);
+        HeapTuple tuple = plc_form_tuple(&pinfo->rettype, desc,
+                                         resmsg->data[presult->resrow], resmsg->cols);
+        ReleaseTupleDesc(desc);
+        fcinfo->isnull = false;
+        return HeapTupleGetDatum(tuple);
+    }
+
+    if (resmsg->cols > 1) {
+        elog(ERROR, "Result with %d columns cannot be returned by function "
+                    "returning scalar type", resmsg->cols);
+        return result;
+    }
+
     if (resmsg->data[presult->resrow][0].isnull == 0) {
         fcinfo->isnull = false;
-        result = pinfo->rettype.infunc(resmsg->data[presult->resrow][0].value, &pinfo->rettype);
+        result = pinfo->rettype.infunc(plc_raw_value(&resmsg->data[presult->resrow][0]), &pinfo->rettype);
     }
 
     return result;
 }
 
+/*
+ * Result of the function returning composite type has one column for each of
+ * its attributes, unless the client sends the whole row as a single column
+ */
+static bool plcontainer_result_is_row(plcProcInfo *pinfo, plcMsgResult *resmsg) {
+    return pinfo->rettype.type == PLC_DATA_UDT
+           && (resmsg->cols != 1 || resmsg->types[0].type != PLC_DATA_UDT);
+}
+
+/*
+ * Forms the tuple for the given row of the result message to be stored in
+ * tuplestore. Tuple returned for the row sent as a single composite column
+ * points to the data of this composite datum and uses tmptup as a header
+ */
+static HeapTuple plcontainer_form_result_tuple(plcProcInfo   *pinfo,
+                                               TupleDesc      tupdesc,
+                                               plcMsgResult  *resmsg,
+                                               int            row,
+                                               HeapTuple      tmptup) {
+    rawdata        *raw = &resmsg->data[row][0];
+    Datum          *values;
+    bool           *nulls;
+    HeapTupleHeader td;
+    int             i;
+
+    if (plcontainer_result_is_row(pinfo, resmsg)) {
+        return plc_form_tuple(&pinfo->rettype, tupdesc, resmsg->data[row], resmsg->cols);
+    }
+
+    if (resmsg->cols > 1) {
+        elog(ERROR, "Result with %d columns cannot be returned by function "
+                    "returning scalar type", resmsg->cols);
+    }
+
+    /* NULL composite value is stored as a row of NULLs */
+    if (raw->isnull) {
+        values = (Datum*)palloc(tupdesc->natts * sizeof(Datum));
+        nulls  = (bool*)palloc(tupdesc->natts * sizeof(bool));
+        for (i = 0; i < tupdesc->natts; i++) {
+            values[i] = (Datum) 0;
+            nulls[i]  = true;
+        }
+        return heap_form_tuple(tupdesc, values, nulls);
+    }
+
+    if (pinfo->rettype.type == PLC_DATA_UDT) {
+        td = DatumGetHeapTupleHeader(pinfo->rettype.infunc(plc_raw_value(raw), &pinfo->rettype));
+        tmptup->t_len = HeapTupleHeaderGetDatumLength(td);
+        ItemPointerSetInvalid(&(tmptup->t_self));
+        tmptup->t_tableOid = InvalidOid;
+        tmptup->t_data = td;
+        return tmptup;
+    }
+
+    values = (Datum*)palloc(sizeof(Datum));
+    nulls  = (bool*)palloc(sizeof(bool));
+    values[0] = pinfo->rettype.infunc(plc_raw_value(raw), &pinfo->rettype);
+    nulls[0]  = false;
+    return heap_form_tuple(tupdesc, values, nulls);
+}
+
 /*
  * Processing client log message
  */
@@ -319,5 +1157,5 @@ static void plcontainer_process_exception(plcMsgError *msg) {
                 (errcode(ERRCODE_RAISE_EXCEPTION),
                  errmsg("PL/Container client exception occurred: \n %s", msg->message)));
     }
-    free_error(msg);
+    plcontainer_channel_release((plcMessage*)msg);
 }
@@ -18,4 +18,10 @@ MemoryContext pl_container_caller_context;
 /* entrypoint for all plcontainer procedures */
 Datum plcontainer_call_handler(PG_FUNCTION_ARGS);
 
+/* compression counters of the session */
+Datum compression_stats(PG_FUNCTION_ARGS);
+
+/* function called for the rows of the query in batches */
+Datum plcontainer_call_batch(PG_FUNCTION_ARGS);
+
 #endif /* PLC_PLCONTAINER_H */
@@ -24,6 +24,7 @@ int main(int argc UNUSED, char **argv UNUSED) {
     int      sock;
     plcConn* conn;
     int      status;
+    char    *zygote = getenv(PLC_ZYGOTE_ENV);
 
     assert(sizeof(char) == 1);
     assert(sizeof(short) == 2);
@@ -32,8 +33,11 @@ int main(int argc UNUSED, char **argv UNUSED) {
     assert(sizeof(float) == 4);
     assert(sizeof(double) == 8);
 
+    startup_timing_mark(NULL);
+
     // Bind the socket and start listening the port
     sock = start_listener();
+    startup_timing_mark("listen");
 
     // Initialize Python
     status = python_init();
@@ -50,10 +54,21 @@ int main(int argc UNUSED, char **argv UNUSED) {
             }
         }
     #else
-        // In release mode we wait for incoming connection for limited time
-        // and the client works for a single connection only
-        connection_wait(sock);
-        conn = connection_init(sock);
+        if (status == 0 && zygote != NULL && strcmp(zygote, "yes") == 0) {
+            // In zygote mode the process forks a child for each connection
+            // and only the child gets here
+            conn = connection_fork(sock);
+            #if PY_VERSION_HEX >= 0x03070000
+                PyOS_AfterFork_Child();
+            #else
+                PyOS_AfterFork();
+            #endif
+        } else {
+            // In release mode we wait for incoming connection for limited time
+            // and the client works for a single connection only
+            connection_wait(sock);
+            conn = connection_init(sock);
+        }
         if (status == 0) {
             receive_loop(handle_call, conn);
         } else {
@@ -7,65 +7,502 @@
  */
 
 #include <Python.h>
+#include <marshal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "pycache.h"
 #include "pyconversions.h"
 #include "common/comm_utils.h"
+#include "common/comm_connectivity.h"
 
-static plcPyFunction **plcPyFuncCache = NULL;
+/*
+ * Both caches are hash tables with the entries linked into the list in the
+ * order of use, the least recently used entry is evicted when the cache is
+ * full
+ */
+typedef struct plcPyCacheEntry {
+    unsigned long long      key;
+    void                   *value;
+    struct plcPyCacheEntry *hnext;  /* next entry in the same bucket */
+    struct plcPyCacheEntry *prev;   /* more recently used entry */
+    struct plcPyCacheEntry *next;   /* less recently used entry */
+} plcPyCacheEntry;
+
+typedef struct plcPyCache {
+    plcPyCacheEntry **buckets;
+    int               nbuckets;     /* power of 2 */
+    int               size;
+    int               capacity;
+    plcPyCacheEntry  *head;
+    plcPyCacheEntry  *tail;
+    void            (*freeValue)(void *value);
+} plcPyCache;
+
+/* Compiled function definition and the source it was compiled from */
+typedef struct plcPyCode {
+    char     *src;
+    PyObject *code;
+} plcPyCode;
+
+static plcPyCache *plcPyFuncCache = NULL;
+static plcPyCache *plcPyCodeCache = NULL;
+
+/* Directory of the on-disk code cache, NULL when it is not used */
+static char *plcPyCodeDir = NULL;
+static char *plcPyCodeKey = NULL;
+static int   plcPyCodeDirInit = 0;
+
+/* Length of HMAC-SHA256 signature the cache file starts with */
+#define PLC_PY_CODE_SIGNATURE_LEN 32
+
+static int plc_py_cache_capacity(void);
+static plcPyCache *plc_py_cache_create(int capacity, void (*freeValue)(void *value));
+static void plc_py_cache_unlink(plcPyCache *cache, plcPyCacheEntry *entry);
+static void plc_py_cache_push(plcPyCache *cache, plcPyCacheEntry *entry);
+static void *plc_py_cache_find(plcPyCache *cache, unsigned long long key);
+static void plc_py_cache_insert(plcPyCache *cache, unsigned long long key, void *value);
+static void plc_py_cache_evict(plcPyCache *cache);
+static void plc_py_free_function_value(void *value);
+static void plc_py_free_code_value(void *value);
+static unsigned long long plc_py_source_hash(const char *src);
+static void plc_py_code_cache_add(const char *src, unsigned long long hash, PyObject *code);
+static char *plc_py_code_path(unsigned long long hash);
+static PyObject *plc_py_code_sign(const char *data, Py_ssize_t size);
+static PyObject *plc_py_code_load(const char *src, unsigned long long hash);
+static void plc_py_code_save(const char *src, unsigned long long hash, PyObject *code);
+
+/* Backend passes its cache size to the client in the environment */
+static int plc_py_cache_capacity() {
+    char *env = getenv(PLC_FUNCTION_CACHE_SIZE_ENV);
+    int   capacity = 0;
+
+    if (env != NULL) {
+        capacity = atoi(env);
+    }
+    if (capacity <= 0) {
+        capacity = PLC_PY_FUNCTION_CACHE_SIZE;
+    }
+    return capacity;
+}
+
+static plcPyCache *plc_py_cache_create(int capacity, void (*freeValue)(void *value)) {
+    plcPyCache *cache;
+
+    cache = malloc(sizeof(plcPyCache));
+    cache->nbuckets = 16;
+    while (cache->nbuckets < capacity) {
+        cache->nbuckets *= 2;
+    }
+    cache->buckets   = calloc(cache->nbuckets, sizeof(plcPyCacheEntry*));
+    cache->size      = 0;
+    cache->capacity  = capacity;
+    cache->head      = NULL;
+    cache->tail      = NULL;
+    cache->freeValue = freeValue;
+    return cache;
+}
+
+static void plc_py_cache_unlink(plcPyCache *cache, plcPyCacheEntry *entry) {
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+}
+
+/* Make the entry the most recently used one */
+static void plc_py_cache_push(plcPyCache *cache, plcPyCacheEntry *entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head != NULL) {
+        cache->head->prev = entry;
+    }
+    cache->head = entry;
+    if (cache->tail == NULL) {
+        cache->tail = entry;
+    }
+}
+
+static void *plc_py_cache_find(plcPyCache *cache, unsigned long long key) {
+    plcPyCacheEntry *entry;
+
+    entry = cache->buckets[key & (cache->nbuckets - 1)];
+    while (entry != NULL && entry->key != key) {
+        entry = entry->hnext;
+    }
+    if (entry == NULL) {
+        return NULL;
+    }
 
-static void plc_py_function_cache_up(int index);
+    if (entry != cache->head) {
+        plc_py_cache_unlink(cache, entry);
+        plc_py_cache_push(cache, entry);
+    }
+    return entry->value;
+}
 
-/* Move up the cache item */
-static void plc_py_function_cache_up(int index) {
-    plcPyFunction *tmp;
-    int i;
-    if (index > 0) {
-        tmp = plcPyFuncCache[index];
-        for (i = index; i > 0; i--) {
-            plcPyFuncCache[i] = plcPyFuncCache[i-1];
+/* Add the value to the cache, replacing the one stored with the same key */
+static void plc_py_cache_insert(plcPyCache *cache, unsigned long long key, void *value) {
+    plcPyCacheEntry **bucket = &cache->buckets[key & (cache->nbuckets - 1)];
+    plcPyCacheEntry  *entry;
+
+    for (entry = *bucket; entry != NULL; entry = entry->hnext) {
+        if (entry->key == key) {
+            if (entry->value != value) {
+                cache->freeValue(entry->value);
+                entry->value = value;
+            }
+            if (entry != cache->head) {
+                plc_py_cache_unlink(cache, entry);
+                plc_py_cache_push(cache, entry);
+            }
+            return;
         }
-        plcPyFuncCache[0] = tmp;
     }
+
+    if (cache->size >= cache->capacity) {
+        plc_py_cache_evict(cache);
+    }
+
+    entry = malloc(sizeof(plcPyCacheEntry));
+    entry->key   = key;
+    entry->value = value;
+    entry->hnext = *bucket;
+    *bucket = entry;
+    plc_py_cache_push(cache, entry);
+    cache->size += 1;
+}
+
+static void plc_py_cache_evict(plcPyCache *cache) {
+    plcPyCacheEntry  *last = cache->tail;
+    plcPyCacheEntry **prev;
+
+    if (last == NULL) {
+        return;
+    }
+
+    prev = &cache->buckets[last->key & (cache->nbuckets - 1)];
+    while (*prev != last) {
+        prev = &(*prev)->hnext;
+    }
+    *prev = last->hnext;
+
+    plc_py_cache_unlink(cache, last);
+    cache->freeValue(last->value);
+    free(last);
+    cache->size -= 1;
+}
+
+static void plc_py_free_function_value(void *value) {
+    plc_py_free_function((plcPyFunction*)value);
+}
+
+static void plc_py_free_code_value(void *value) {
+    plcPyCode *code = (plcPyCode*)value;
+
+    Py_DECREF(code->code);
+    free(code->src);
+    free(code);
+}
+
+/* 64-bit FNV-1a hash of the function source */
+static unsigned long long plc_py_source_hash(const char *src) {
+    unsigned long long hash = 14695981039346656037ULL;
+
+    while (*src != '\0') {
+        hash ^= (unsigned char)*src++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
 }
 
 plcPyFunction *plc_py_function_cache_get(unsigned int objectid) {
-    int i;
-    plcPyFunction *resFunc = NULL;
-    /* Initialize all the elements with nulls initially */
     if (plcPyFuncCache == NULL) {
-        plcPyFuncCache = malloc(PLC_PY_FUNCTION_CACHE_SIZE * sizeof(plcPyFunction));
-        for (i = 0; i < PLC_PY_FUNCTION_CACHE_SIZE; i++) {
-            plcPyFuncCache[i] = NULL;
-        }
+        return NULL;
     }
-    for (i = 0; i < PLC_PY_FUNCTION_CACHE_SIZE; i++) {
-        if (plcPyFuncCache[i] != NULL &&
-                plcPyFuncCache[i]->objectid == objectid) {
-            resFunc = plcPyFuncCache[i];
-            plc_py_function_cache_up(i);
-            break;
+    return (plcPyFunction*)plc_py_cache_find(plcPyFuncCache, objectid);
+}
+
+void plc_py_function_cache_put(plcPyFunction *func) {
+    if (plcPyFuncCache == NULL) {
+        plcPyFuncCache = plc_py_cache_create(plc_py_cache_capacity(),
+                                             plc_py_free_function_value);
+    }
+    plc_py_cache_insert(plcPyFuncCache, func->objectid, func);
+}
+
+static void plc_py_code_cache_add(const char *src, unsigned long long hash, PyObject *code) {
+    plcPyCode *entry;
+
+    if (plcPyCodeCache == NULL) {
+        plcPyCodeCache = plc_py_cache_create(PLC_PY_CODE_CACHE_RATIO * plc_py_cache_capacity(),
+                                             plc_py_free_code_value);
+    }
+    entry = malloc(sizeof(plcPyCode));
+    entry->src  = strdup(src);
+    entry->code = code;
+    plc_py_cache_insert(plcPyCodeCache, hash, entry);
+}
+
+/*
+ * Cache file name holds the source hash and the magic number of the
+ * interpreter, so the clients of different Python versions can share the
+ * directory. Directory and the key the files are signed with are given by
+ * the backend for the role and the database. Returns NULL when the on-disk
+ * cache is not used
+ */
+static char *plc_py_code_path(unsigned long long hash) {
+    char *path;
+
+    if (!plcPyCodeDirInit) {
+        plcPyCodeDirInit = 1;
+        plcPyCodeDir = getenv(PLC_CODE_CACHE_ENV);
+        plcPyCodeKey = getenv(PLC_CODE_CACHE_KEY_ENV);
+        if (plcPyCodeDir != NULL && plcPyCodeDir[0] == '\0') {
+            plcPyCodeDir = NULL;
+        }
+        if (plcPyCodeKey == NULL || plcPyCodeKey[0] == '\0') {
+            plcPyCodeDir = NULL;
+        }
+        if (plcPyCodeDir != NULL && mkdir(plcPyCodeDir, 0700) < 0 && errno != EEXIST) {
+            lprintf(WARNING, "Cannot create code cache directory '%s': %s",
+                    plcPyCodeDir, strerror(errno));
+            plcPyCodeDir = NULL;
         }
     }
-    return resFunc;
+    if (plcPyCodeDir == NULL) {
+        return NULL;
+    }
+
+    path = malloc(strlen(plcPyCodeDir) + 64);
+    sprintf(path, "%s/%016llx.%08lx.plcode", plcPyCodeDir, hash,
+            (unsigned long)PyImport_GetMagicNumber() & 0xFFFFFFFFUL);
+    return path;
 }
 
-void plc_py_function_cache_put(plcPyFunction *func) {
-    int i;
-    plcPyFunction *oldFunc;
-    oldFunc = plc_py_function_cache_get(func->objectid);
-    /* If the function is not cached already */
-    if (oldFunc == NULL) {
-        /* If the last element exists we need to free its memory */
-        if (plcPyFuncCache[PLC_PY_FUNCTION_CACHE_SIZE-1] != NULL) {
-            plc_py_free_function(plcPyFuncCache[PLC_PY_FUNCTION_CACHE_SIZE-1]);
+/* Returns HMAC-SHA256 of the data as bytes, NULL on failure */
+static PyObject *plc_py_code_sign(const char *data, Py_ssize_t size) {
+    PyObject *hmac;
+    PyObject *hashlib;
+    PyObject *digestmod = NULL;
+    PyObject *key;
+    PyObject *msg;
+    PyObject *mac = NULL;
+    PyObject *res = NULL;
+
+    hmac = PyImport_ImportModule("hmac"); // Returns new reference
+    hashlib = PyImport_ImportModule("hashlib"); // Returns new reference
+    if (hmac != NULL && hashlib != NULL) {
+        digestmod = PyObject_GetAttrString(hashlib, "sha256");
+    }
+    key = PyBytes_FromString(plcPyCodeKey); // Returns new reference
+    msg = PyBytes_FromStringAndSize(data, size); // Returns new reference
+    if (digestmod != NULL && key != NULL && msg != NULL) {
+        mac = PyObject_CallMethod(hmac, "new", "(OOO)", key, msg, digestmod);
+    }
+    if (mac != NULL) {
+        res = PyObject_CallMethod(mac, "digest", NULL);
+    }
+    if (res != NULL && (!PyBytes_Check(res) || PyBytes_Size(res) != PLC_PY_CODE_SIGNATURE_LEN)) {
+        Py_DECREF(res);
+        res = NULL;
+    }
+    if (res == NULL) {
+        PyErr_Clear();
+    }
+
+    Py_XDECREF(mac);
+    Py_XDECREF(msg);
+    Py_XDECREF(key);
+    Py_XDECREF(digestmod);
+    Py_XDECREF(hashlib);
+    Py_XDECREF(hmac);
+    return res;
+}
+
+/*
+ * File holds the signature followed by the marshalled tuple of the source and
+ * the code object, source is compared to be sure the hash has not collided.
+ * Data is unmarshalled only if the signature matches. Anything wrong with the
+ * file is treated as a cache miss
+ */
+static PyObject *plc_py_code_load(const char *src, unsigned long long hash) {
+    char     *path;
+    char     *buf;
+    long      size;
+    FILE     *f;
+    PyObject *obj;
+    PyObject *sign;
+    PyObject *code = NULL;
+
+    path = plc_py_code_path(hash);
+    if (path == NULL) {
+        return NULL;
+    }
+    f = fopen(path, "rb");
+    free(path);
+    if (f == NULL) {
+        return NULL;
+    }
+
+    if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) <= PLC_PY_CODE_SIGNATURE_LEN
+            || fseek(f, 0, SEEK_SET) != 0) {
+        fclose(f);
+        return NULL;
+    }
+    buf = malloc(size);
+    if (fread(buf, 1, size, f) != (size_t)size) {
+        free(buf);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+
+    sign = plc_py_code_sign(buf + PLC_PY_CODE_SIGNATURE_LEN, size - PLC_PY_CODE_SIGNATURE_LEN);
+    if (sign == NULL || memcmp(PyBytes_AsString(sign), buf, PLC_PY_CODE_SIGNATURE_LEN) != 0) {
+        Py_XDECREF(sign);
+        free(buf);
+        return NULL;
+    }
+    Py_DECREF(sign);
+
+    obj = PyMarshal_ReadObjectFromString(buf + PLC_PY_CODE_SIGNATURE_LEN,
+                                         size - PLC_PY_CODE_SIGNATURE_LEN); // Returns new reference
+    free(buf);
+    if (obj == NULL) {
+        PyErr_Clear();
+        return NULL;
+    }
+
+    if (PyTuple_Check(obj) && PyTuple_Size(obj) == 2
+            && PyBytes_Check(PyTuple_GetItem(obj, 0))
+            && strcmp(PyBytes_AsString(PyTuple_GetItem(obj, 0)), src) == 0
+            && PyCode_Check(PyTuple_GetItem(obj, 1))) {
+        code = PyTuple_GetItem(obj, 1);
+        Py_INCREF(code);
+    }
+    Py_DECREF(obj);
+    return code;
+}
+
+/*
+ * File is written under the temporary name and renamed, so the containers
+ * reading the directory at the same time never see it half-written. On
+ * failure the on-disk cache is disabled for the rest of the process
+ */
+static void plc_py_code_save(const char *src, unsigned long long hash, PyObject *code) {
+    char      *path;
+    char      *tmppath;
+    char      *data;
+    Py_ssize_t size;
+    PyObject  *obj;
+    PyObject  *marshalled;
+    PyObject  *sign;
+    int        fd;
+    int        res = -1;
+
+    path = plc_py_code_path(hash);
+    if (path == NULL) {
+        return;
+    }
+
+    obj = PyTuple_New(2);
+    PyTuple_SetItem(obj, 0, PyBytes_FromString(src));
+    Py_INCREF(code);
+    PyTuple_SetItem(obj, 1, code);
+    marshalled = PyMarshal_WriteObjectToString(obj, Py_MARSHAL_VERSION); // Returns new reference
+    Py_DECREF(obj);
+    if (marshalled == NULL) {
+        PyErr_Clear();
+        free(path);
+        return;
+    }
+    data = PyBytes_AsString(marshalled);
+    size = PyBytes_Size(marshalled);
+    sign = plc_py_code_sign(data, size);
+    if (sign == NULL) {
+        Py_DECREF(marshalled);
+        free(path);
+        return;
+    }
+
+    tmppath = malloc(strlen(path) + 32);
+    sprintf(tmppath, "%s.%d.tmp", path, (int)getpid());
+    fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd >= 0 && write(fd, PyBytes_AsString(sign), PLC_PY_CODE_SIGNATURE_LEN)
+                    != PLC_PY_CODE_SIGNATURE_LEN) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd >= 0) {
+        Py_ssize_t written = 0;
+
+        while (written < size) {
+            ssize_t sz = write(fd, data + written, size - written);
+            if (sz < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sz <= 0) {
+                break;
+            }
+            written += sz;
         }
-        /* Move our LRU cache right */
-        for (i = PLC_PY_FUNCTION_CACHE_SIZE-1; i > 0; i--) {
-            plcPyFuncCache[i] = plcPyFuncCache[i-1];
+        if (close(fd) == 0 && written == size && rename(tmppath, path) == 0) {
+            res = 0;
         }
-    } else {
-        plc_py_free_function(oldFunc);
     }
-    plcPyFuncCache[0] = func;
+
+    if (res < 0) {
+        lprintf(WARNING, "Cannot write code cache file '%s': %s, code cache directory is not used anymore",
+                path, strerror(errno));
+        unlink(tmppath);
+        plcPyCodeDir = NULL;
+    }
+
+    Py_DECREF(sign);
+    Py_DECREF(marshalled);
+    free(tmppath);
+    free(path);
+}
+
+/*
+ * Compiled code outlives the functions evicted from the function cache and
+ * the ones replaced after the backend has lost them from its own cache, so it
+ * is kept for more functions than the function cache holds
+ */
+PyObject *plc_py_code_cache_get(const char *src) {
+    unsigned long long hash = plc_py_source_hash(src);
+    PyObject          *code;
+
+    if (plcPyCodeCache != NULL) {
+        plcPyCode *entry = (plcPyCode*)plc_py_cache_find(plcPyCodeCache, hash);
+        if (entry != NULL && strcmp(entry->src, src) == 0) {
+            return entry->code;
+        }
+    }
+
+    /* The function might have been compiled by another container */
+    code = plc_py_code_load(src, hash);
+    if (code != NULL) {
+        plc_py_code_cache_add(src, hash, code);
+    }
+    return code;
+}
+
+void plc_py_code_cache_put(const char *src, PyObject *code) {
+    unsigned long long hash = plc_py_source_hash(src);
+
+    plc_py_code_cache_add(src, hash, code);
+    plc_py_code_save(src, hash, code);
 }
@@ -12,9 +12,18 @@
 #include <Python.h>
 #include "pyconversions.h"
 
-#define PLC_PY_FUNCTION_CACHE_SIZE 20
+/* Used when the backend does not pass its cache size */
+#define PLC_PY_FUNCTION_CACHE_SIZE 100
+
+/* Compiled code is kept for that many times more functions */
+#define PLC_PY_CODE_CACHE_RATIO 4
 
 plcPyFunction *plc_py_function_cache_get(unsigned int objectid);
 void plc_py_function_cache_put(plcPyFunction *func);
 
+/* Compiled function definition for the source, borrowed reference */
+PyObject *plc_py_code_cache_get(const char *src);
+/* Cache takes over the reference to the code object */
+void plc_py_code_cache_put(const char *src, PyObject *code);
+
 #endif /* PLC_PYCACHE_H */
@@ -12,6 +12,7 @@
 #include "common/comm_channel.h"
 #include "common/comm_utils.h"
 #include "common/comm_connectivity.h"
+#include "common/comm_server.h"
 #include "pycall.h"
 #include "pyerror.h"
 #include "pyconversions.h"
@@ -23,10 +24,48 @@
 
 plcConn* plcconn_global = NULL;
 
+/*
+ * Result of the set-returning function being sent in chunks. Function called
+ * while waiting for the next chunk request may return a set as well, so the
+ * requests of the outer results arrive while the inner one is being sent
+ */
+typedef struct plcPyStream {
+    unsigned int        seq;       // sequence number of the call
+    PyObject           *iter;
+    plcPyFunction      *pyfunc;
+    int                 requested; // chunks requested and not sent yet
+    int                 active;    // iterator is being advanced
+    int                 finished;
+    struct plcPyStream *prev;
+} plcPyStream;
+
+static plcPyStream *streams = NULL;
+
+/*
+ * Batch sent ahead by the backend that has arrived while the client was
+ * waiting for SQL results, it is processed when the current call returns
+ */
+typedef struct plcPyQueuedCall {
+    plcMessage             *msg;
+    struct plcPyQueuedCall *next;
+} plcPyQueuedCall;
+
+static plcPyQueuedCall *queued_calls = NULL;
+static int call_depth = 0;
+
+static void process_call(plcMsgCallreq *req, plcConn *conn);
 static char *create_python_func(plcMsgCallreq *req);
 static PyObject *arguments_to_pytuple(plcPyFunction *pyfunc);
+static plcMsgResult *create_call_result(plcPyFunction *pyfunc, int asRow);
 static int process_call_results(plcConn *conn, PyObject *retval, plcPyFunction *pyfunc);
+static int process_set_results(plcConn *conn, PyObject *retval, plcPyFunction *pyfunc);
+static int send_result_chunks(plcConn *conn, plcPyStream *stream);
+static int send_result_chunk(plcConn *conn, plcPyStream *stream);
+static int wait_next_result(plcConn *conn);
+static int process_batch_call(plcConn *conn, plcMsgCallreqBatch *batch, plcPyFunction *pyfunc);
+static int fill_row(plcMsgResult *res, rawdata *row, PyObject *retval, plcPyFunction *pyfunc);
 static int fill_rawdata(rawdata *res, PyObject *retval, plcPyFunction *pyfunc);
+static void preload_modules(void);
 
 static PyObject *PyMainModule = NULL;
 static PyMethodDef moddef[] = {
@@ -102,15 +141,84 @@ int python_init() {
         return -1;
     }
     Py_DECREF(gd);
+    startup_timing_mark("python");
+
+    preload_modules();
 
     return 0;
 }
 
+/*
+ * Imports the modules listed in the container configuration, so the first
+ * call does not pay for it. Module that cannot be imported is reported and
+ * skipped, the function using it gets the error on its own import
+ */
+static void preload_modules() {
+    char     *preload;
+    char     *name;
+    char     *saveptr = NULL;
+    char      stage[200];
+    PyObject *module;
+
+    preload = getenv(PLC_PRELOAD_ENV);
+    if (preload == NULL || preload[0] == '\0') {
+        return;
+    }
+
+    preload = strdup(preload);
+    for (name = strtok_r(preload, ",", &saveptr); name != NULL;
+            name = strtok_r(NULL, ",", &saveptr)) {
+        module = PyImport_ImportModule(name);
+        if (module == NULL) {
+            lprintf(WARNING, "Cannot preload module '%s'", name);
+            PyErr_Print();
+        } else {
+            Py_DECREF(module);
+        }
+        snprintf(stage, sizeof(stage), "import:%s", name);
+        startup_timing_mark(stage);
+    }
+    free(preload);
+}
+
 void handle_call(plcMsgCallreq *req, plcConn *conn) {
+    plcPyQueuedCall *queued;
+
+    call_depth += 1;
+    process_call(req, conn);
+    call_depth -= 1;
+
+    /* Queued batches are processed in the order they have arrived */
+    while (call_depth == 0 && queued_calls != NULL) {
+        queued = queued_calls;
+        queued_calls = queued->next;
+        call_depth += 1;
+        process_call((plcMsgCallreq*)queued->msg, conn);
+        call_depth -= 1;
+        plcontainer_channel_release(queued->msg);
+        free(queued);
+    }
+}
+
+void queue_call(plcMessage *msg) {
+    plcPyQueuedCall  *queued;
+    plcPyQueuedCall **link = &queued_calls;
+
+    queued = malloc(sizeof(plcPyQueuedCall));
+    queued->msg  = msg;
+    queued->next = NULL;
+    while (*link != NULL) {
+        link = &(*link)->next;
+    }
+    *link = queued;
+}
+
+static void process_call(plcMsgCallreq *req, plcConn *conn) {
     PyObject      *retval = NULL;
     PyObject      *dict = NULL;
     PyObject      *args = NULL;
     plcPyFunction *pyfunc = NULL;
+    plcMsgCallreq *prevcall = NULL;
 
     /*
      * Keep our connection for future calls from Python back to us.
@@ -129,6 +237,7 @@ void handle_call(plcMsgCallreq *req, plcConn *conn) {
 
     if (pyfunc == NULL || req->hasChanged) {
         char     *func;
+        PyObject *code;
         PyObject *val;
 
         /* Parse request to get funcion structure */
@@ -140,14 +249,27 @@ void handle_call(plcMsgCallreq *req, plcConn *conn) {
             return;
         }
 
+        /* Function is compiled only once for the same source, even if it has
+         * been evicted from the function cache since then */
+        code = plc_py_code_cache_get(func); // Returns borrowed reference
+        if (code == NULL) {
+            code = Py_CompileString(func, "<string>", Py_single_input); // Returns new reference
+            if (code == NULL) {
+                free(func);
+                raise_execution_error("Cannot compile function in Python");
+                return;
+            }
+            plc_py_code_cache_put(func, code);
+        }
+        free(func);
+
         /* The function will be in the dictionary because it was wrapped with "def proc_name:... " */
-        val = PyRun_String(func, Py_single_input, dict, dict); // Returns new reference
+        val = plc_PyEval_EvalCode(code, dict, dict); // Returns new reference
         if (val == NULL) {
             raise_execution_error("Cannot compile function in Python");
             return;
         }
         Py_DECREF(val);
-        free(func);
 
         /* get the function from the global dictionary, returns borrowed reference */
         val = PyDict_GetItemString(dict, req->proc.name);
@@ -156,10 +278,15 @@ void handle_call(plcMsgCallreq *req, plcConn *conn) {
             return;
         }
 
+        /* Overloaded functions share the name in the dictionary, so the
+         * function object is referenced by the cache as well */
+        Py_INCREF(val);
         pyfunc->pyfunc = val;
 
         plc_py_function_cache_put(pyfunc);
     } else {
+        /* Same function might be called again while its set is being sent */
+        prevcall = pyfunc->call;
         pyfunc->call = req;
     }
 
@@ -168,6 +295,13 @@ void handle_call(plcMsgCallreq *req, plcConn *conn) {
         return;
     }
 
+    /* Batch of calls is processed row by row and answered with one result */
+    if (req->msgtype == MT_CALLREQ_BATCH) {
+        process_batch_call(conn, (plcMsgCallreqBatch*)req, pyfunc);
+        pyfunc->call = prevcall;
+        return;
+    }
+
     args = arguments_to_pytuple(pyfunc);
     if (args == NULL) {
         raise_execution_error("Cannot convert input arguments to Python tuple");
@@ -187,7 +321,7 @@ void handle_call(plcMsgCallreq *req, plcConn *conn) {
         process_call_results(conn, retval, pyfunc);
     }
 
-    pyfunc->call = NULL;
+    pyfunc->call = prevcall;
     Py_XDECREF(args);
     Py_XDECREF(retval);
 
@@ -305,7 +439,7 @@ static PyObject *arguments_to_pytuple(plcPyFunction *pyfunc) {
                                       pyfunc->args[i].type);
                 return NULL;
             }
-            arg = pyfunc->args[i].conv.inputfunc(pyfunc->call->args[i].data.value,
+            arg = pyfunc->args[i].conv.inputfunc(plc_raw_value(&pyfunc->call->args[i].data),
                                                  &pyfunc->args[i]);
         }
 
@@ -338,76 +472,316 @@ static PyObject *arguments_to_pytuple(plcPyFunction *pyfunc) {
     return args;
 }
 
-static int process_call_results(plcConn *conn, PyObject *retval, plcPyFunction *pyfunc) {
+/*
+ * Result of the function returning composite type has a column for each of
+ * its attributes if asRow is set, otherwise the whole row is sent as a single
+ * column. The latter is used to return NULL instead of a row
+ */
+static plcMsgResult *create_call_result(plcPyFunction *pyfunc, int asRow) {
     plcMsgResult *res;
-    int           retcode = 0;
+    int           i;
 
     /* allocate a result */
     res           = malloc(sizeof(plcMsgResult));
     res->msgtype  = MT_RESULT;
-    res->names    = malloc(1 * sizeof(char*));
-    res->names[0] = (pyfunc->res.argName == NULL) ? NULL : strdup(pyfunc->res.argName);
-    res->types    = malloc(1 * sizeof(plcType));
+    res->rows     = 0;
     res->data     = NULL;
     res->exception_callback = plc_error_callback;
-    plc_py_copy_type(&res->types[0], &pyfunc->res);
 
-    /* Now we support only functions returning single column */
-    res->cols = 1;
+    if (asRow && pyfunc->res.type == PLC_DATA_UDT) {
+        res->cols  = pyfunc->res.nSubTypes;
+        res->names = malloc(res->cols * sizeof(char*));
+        res->types = malloc(res->cols * sizeof(plcType));
+        for (i = 0; i < res->cols; i++) {
+            plcPyType *attr = &pyfunc->res.subTypes[i];
+            res->names[i] = (attr->typeName == NULL) ? NULL : strdup(attr->typeName);
+            plc_py_copy_type(&res->types[i], attr);
+        }
+    } else {
+        res->cols     = 1;
+        res->names    = malloc(1 * sizeof(char*));
+        res->names[0] = (pyfunc->res.argName == NULL) ? NULL : strdup(pyfunc->res.argName);
+        res->types    = malloc(1 * sizeof(plcType));
+        plc_py_copy_type(&res->types[0], &pyfunc->res);
+    }
+
+    return res;
+}
+
+static int process_call_results(plcConn *conn, PyObject *retval, plcPyFunction *pyfunc) {
+    plcMsgResult *res;
+    int           retcode = 0;
 
     if (pyfunc->retset) {
-        int       i      = 0;
-        int       len    = 0;
-        PyObject *retobj = retval;
-        PyObject *obj    = NULL;
+        return process_set_results(conn, retval, pyfunc);
+    }
 
-        if (PySequence_Check(retval)) {
-            len = PySequence_Length(retval);
-        } else {
-            PyObject *iter = NULL;
+    res = create_call_result(pyfunc, retval != Py_None);
+    res->rows = 1;
+    res->data    = malloc(res->rows * sizeof(rawdata*));
+    res->data[0] = malloc(res->cols * sizeof(rawdata));
+    retcode = fill_row(res, res->data[0], retval, pyfunc);
 
-            iter = PyObject_GetIter(retval);
-            if (iter == NULL) {
-                raise_execution_error("Cannot get iterator out of the returned object");
-                free_result(res, true);
-                return -1;
-            }
+    /* If the output operation succeeded we send the result back */
+    if (retcode == 0) {
+        /* We manually state that we are sending the data to avoid message interleaving */
+        plc_sending_data = 1;
+        plcontainer_channel_send(conn, (plcMessage*)res);
+        plc_sending_data = 0;
+    }
 
-            retobj = PyList_New(0);
-            obj = PyIter_Next(iter);
-            while (obj != NULL && retcode == 0) {
-                len += 1;
-                retcode = PyList_Append(retobj, obj);
-                Py_DECREF(obj);
-                obj = PyIter_Next(iter);
-            }
-            Py_XDECREF(obj);
-            Py_DECREF(iter);
+    free_result(res, true);
 
-            if (retcode < 0) {
-                raise_execution_error("Error receiving result data from Python iterator");
-                free_result(res, true);
-                return -1;
+    /* After the message is sent we can safely send exceptions */
+    plc_raise_delayed_error();
+
+    return retcode;
+}
+
+/*
+ * Iterates over the rows returned by set-returning function and sends them in
+ * chunks of PLC_RESULT_CHUNK_ROWS rows, so neither the client nor the backend
+ * has to hold the whole result set. After sending each chunk except the last
+ * one the client waits for the backend to request the next one. Backend not
+ * supporting the chunks receives all the rows in one message
+ */
+static int process_set_results(plcConn *conn, PyObject *retval, plcPyFunction *pyfunc) {
+    plcPyStream *stream;
+    plcPyStream **link;
+    int          retcode = 0;
+
+    stream = malloc(sizeof(plcPyStream));
+    stream->iter = PyObject_GetIter(retval);
+    if (stream->iter == NULL) {
+        free(stream);
+        raise_execution_error("Cannot get iterator out of the returned object");
+        return -1;
+    }
+    stream->seq       = pyfunc->call->seq;
+    stream->pyfunc    = pyfunc;
+    stream->requested = 1;
+    stream->active    = 0;
+    stream->finished  = 0;
+    stream->prev      = streams;
+    streams = stream;
+
+    /* Requests of this result might be served by the calls processed while
+     * waiting, stop if the error has been reported to the backend */
+    retcode = send_result_chunks(conn, stream);
+    while (retcode == 0 && !stream->finished && plc_is_execution_terminated == 0) {
+        retcode = wait_next_result(conn);
+    }
+
+    for (link = &streams; *link != NULL; link = &(*link)->prev) {
+        if (*link == stream) {
+            *link = stream->prev;
+            break;
+        }
+    }
+    Py_DECREF(stream->iter);
+    free(stream);
+    return retcode;
+}
+
+/*
+ * Sends the chunks requested so far. Requests arriving while the iterator is
+ * being advanced are counted and served by the same loop
+ */
+static int send_result_chunks(plcConn *conn, plcPyStream *stream) {
+    int retcode = 0;
+
+    stream->active = 1;
+    while (retcode == 0 && stream->requested > 0 && !stream->finished
+            && plc_is_execution_terminated == 0) {
+        stream->requested -= 1;
+        retcode = send_result_chunk(conn, stream);
+    }
+    stream->active = 0;
+
+    if (retcode != 0) {
+        stream->finished = 1;
+    }
+    return retcode;
+}
+
+static int send_result_chunk(plcConn *conn, plcPyStream *stream) {
+    plcMsgResult  *res;
+    PyObject      *obj = NULL;
+    plcPyFunction *pyfunc = stream->pyfunc;
+    int            retcode = 0;
+    int            size;
+
+    res = create_call_result(pyfunc, 1);
+    size = PLC_RESULT_CHUNK_ROWS;
+    res->data = malloc(size * sizeof(rawdata*));
+    memset(res->data, 0, size * sizeof(rawdata*));
+
+    while (1) {
+        if (res->rows == size) {
+            if (conn->features & PLC_FEATURE_STREAMING) {
+                break;
             }
+            size *= 2;
+            res->data = realloc(res->data, size * sizeof(rawdata*));
+        }
+        obj = PyIter_Next(stream->iter);
+        if (obj == NULL) {
+            stream->finished = 1;
+            break;
+        }
+        res->data[res->rows] = malloc(res->cols * sizeof(rawdata));
+        res->rows += 1;
+        retcode = fill_row(res, res->data[res->rows - 1], obj, pyfunc);
+        Py_DECREF(obj);
+        if (retcode != 0) {
+            break;
         }
+    }
+
+    if (retcode == 0 && PyErr_Occurred()) {
+        raise_execution_error("Error receiving result data from Python iterator");
+        retcode = -1;
+    }
+
+    if (retcode == 0) {
+        res->msgtype = stream->finished ? MT_RESULT : MT_RESULT_CHUNK;
+        /* We manually state that we are sending the data to avoid message interleaving */
+        plc_sending_data = 1;
+        plcontainer_channel_send(conn, (plcMessage*)res);
+        plc_sending_data = 0;
+    }
+
+    free_result(res, true);
+
+    /* After the message is sent we can safely send exceptions */
+    plc_raise_delayed_error();
+
+    return retcode;
+}
+
+/*
+ * Serves the request for the next chunk of the result being sent. Results
+ * already sent are not found, these requests were made ahead and are skipped
+ */
+int handle_result_next(plcMsgResultNext *next, plcConn *conn) {
+    plcPyStream *stream;
+
+    for (stream = streams; stream != NULL; stream = stream->prev) {
+        if (stream->seq == next->seq && !stream->finished) {
+            break;
+        }
+    }
+    if (stream == NULL) {
+        return 0;
+    }
+
+    if (next->cancel) {
+        stream->finished = 1;
+        return 0;
+    }
+
+    stream->requested += 1;
+    if (stream->active) {
+        return 0;
+    }
+    return send_result_chunks(conn, stream);
+}
+
+/*
+ * Waits for the backend message while the result is being sent. Calls made
+ * by the backend in between are processed the same way as during SPI calls
+ */
+static int wait_next_result(plcConn *conn) {
+    plcMessage *msg = NULL;
+    int         res = 0;
+
+    res = plcontainer_channel_receive(conn, &msg);
+    if (res < 0) {
+        raise_execution_error("Error receiving data from the backend, %d", res);
+        return -1;
+    }
 
-        res->rows = len;
+    switch (msg->msgtype) {
+        case MT_CALLREQ_BATCH:
+            if (((plcMsgCallreqBatch*)msg)->ahead) {
+                queue_call(msg);
+                return 0;
+            }
+            handle_call((plcMsgCallreq*)msg, conn);
+            break;
+        case MT_CALLREQ:
+            handle_call((plcMsgCallreq*)msg, conn);
+            break;
+        case MT_RESULT_NEXT:
+            res = handle_result_next((plcMsgResultNext*)msg, conn);
+            break;
+        default:
+            raise_execution_error("Client cannot process message type %c", msg->msgtype);
+            res = -1;
+            break;
+    }
+    plcontainer_channel_release(msg);
+    return res;
+}
+
+/*
+ * Calls the function for each of the argument rows of the batch and sends
+ * all the results back in a single result message, one row per call
+ */
+static int process_batch_call(plcConn *conn, plcMsgCallreqBatch *batch, plcPyFunction *pyfunc) {
+    plcMsgResult *res;
+    PyObject     *args   = NULL;
+    PyObject     *retval = NULL;
+    int           retcode = 0;
+    int           i, j;
+
+    if (pyfunc->retset) {
+        raise_execution_error("Set-returning function cannot be called in batch mode");
+        return -1;
+    }
+
+    res       = create_call_result(pyfunc, 1);
+    res->rows = batch->nrows;
+    if (res->rows > 0) {
         res->data = malloc(res->rows * sizeof(rawdata*));
         memset(res->data, 0, res->rows * sizeof(rawdata*));
-        for(i = 0; i < len && retcode == 0; i++) {
-            res->data[i] = malloc(res->cols * sizeof(rawdata));
-            obj = PySequence_GetItem(retobj, i);
-            retcode = fill_rawdata(&res->data[i][0], obj, pyfunc);
-            Py_XDECREF(obj);
+    }
+
+    for (i = 0; i < batch->nrows && retcode == 0; i++) {
+        /* Arguments of the current row are referenced, not copied */
+        for (j = 0; j < batch->call.nargs; j++) {
+            batch->call.args[j].data = batch->rows[i][j];
         }
-    } else {
-        res->rows = 1;
-        res->data    = malloc(res->rows * sizeof(rawdata*));
-        res->data[0] = malloc(res->cols * sizeof(rawdata));
-        retcode = fill_rawdata(&res->data[0][0], retval, pyfunc);
+
+        args = arguments_to_pytuple(pyfunc);
+        if (args == NULL) {
+            raise_execution_error("Cannot convert input arguments to Python tuple");
+            retcode = -1;
+            break;
+        }
+
+        plc_is_execution_terminated = 0;
+        retval = PyObject_Call(pyfunc->pyfunc, args, NULL); // returns new reference
+        Py_DECREF(args);
+        if (retval == NULL || PyErr_Occurred()) {
+            Py_XDECREF(retval);
+            raise_execution_error("Exception occurred in Python during function execution");
+            retcode = -1;
+            break;
+        }
+
+        /* Error has already been reported to the backend */
+        if (plc_is_execution_terminated != 0) {
+            Py_DECREF(retval);
+            retcode = -1;
+            break;
+        }
+
+        res->data[i] = malloc(res->cols * sizeof(rawdata));
+        retcode = fill_row(res, res->data[i], retval, pyfunc);
+        Py_DECREF(retval);
     }
 
-    /* If the output operation succeeded we send the result back */
     if (retcode == 0) {
         /* We manually state that we are sending the data to avoid message interleaving */
         plc_sending_data = 1;
@@ -423,6 +797,42 @@ static int process_call_results(plcConn *conn, PyObject *retval, plcPyFunction *
     return retcode;
 }
 
+/*
+ * Fills the result row, splitting the composite value into the columns if
+ * the result has a column for each attribute. None is returned as a row of
+ * NULLs in this case
+ */
+static int fill_row(plcMsgResult *res, rawdata *row, PyObject *retval, plcPyFunction *pyfunc) {
+    rawdata  value;
+    plcUDT  *udt;
+    int      i;
+
+    if (pyfunc->res.type != PLC_DATA_UDT
+            || (res->cols == 1 && res->types[0].type == PLC_DATA_UDT)) {
+        return fill_rawdata(&row[0], retval, pyfunc);
+    }
+
+    for (i = 0; i < res->cols; i++) {
+        row[i].isnull = 1;
+        row[i].value  = NULL;
+    }
+    if (retval == Py_None) {
+        return 0;
+    }
+
+    if (fill_rawdata(&value, retval, pyfunc) != 0) {
+        return -1;
+    }
+
+    /* Attribute values are moved to the row as they are */
+    udt = (plcUDT*)value.value;
+    memcpy(row, udt->data, res->cols * sizeof(rawdata));
+    pfree(udt->data);
+    pfree(udt);
+
+    return 0;
+}
+
 static int fill_rawdata(rawdata *res, PyObject *retval, plcPyFunction *pyfunc) {
     res->value  = NULL;
     if (retval == Py_None) {
@@ -435,7 +845,7 @@ static int fill_rawdata(rawdata *res, PyObject *retval, plcPyFunction *pyfunc) {
                                   (int)pyfunc->res.type);
             return -1;
         }
-        ret = pyfunc->res.conv.outputfunc(retval, &res->value, &pyfunc->res);
+        ret = pyfunc->res.conv.outputfunc(retval, res, &pyfunc->res);
         if (ret != 0) {
             raise_execution_error("Exception raised converting function output to type %s [%d]",
                                   plc_get_type_name(pyfunc->res.type), (int)pyfunc->res.type);
@@ -26,8 +26,13 @@
     #define PyString_FromString(x) PyUnicode_FromString(x)
     #define PyString_AsString(x)   PyUnicode_AsUTF8(x)
     #define PyString_Check(x)      (PyUnicode_Check(x) || PyBytes_Check(x))
+
+    #define plc_PyEval_EvalCode(code, globals, locals) \
+        PyEval_EvalCode(code, globals, locals)
 #else
     #define plc_Py_SetProgramName(x) Py_SetProgramName(x)
+    #define plc_PyEval_EvalCode(code, globals, locals) \
+        PyEval_EvalCode((PyCodeObject*)(code), globals, locals)
 #endif
 
 #include "common/comm_connectivity.h"
@@ -48,4 +53,10 @@ int python_init(void);
 // Processing of the Greenplum function call
 void handle_call(plcMsgCallreq *req, plcConn* conn);
 
+// Queueing of the batch sent ahead until the current call returns
+void queue_call(plcMessage *msg);
+
+// Processing of the request for the next chunk of the set being returned
+int handle_result_next(plcMsgResultNext *next, plcConn *conn);
+
 #endif /* PLC_PYCALL_H */
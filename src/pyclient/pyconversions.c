@@ -29,17 +29,22 @@ static PyObject *plc_pyobject_from_udt(char *input, plcPyType *type);
 static PyObject *plc_pyobject_from_udt_ptr(char *input, plcPyType *type);
 static PyObject *plc_pyobject_from_bytea(char *input, plcPyType *type);
 static PyObject *plc_pyobject_from_bytea_ptr(char *input, plcPyType *type);
-
-static int plc_pyobject_as_int1(PyObject *input, char **output, plcPyType *type);
-static int plc_pyobject_as_int2(PyObject *input, char **output, plcPyType *type);
-static int plc_pyobject_as_int4(PyObject *input, char **output, plcPyType *type);
-static int plc_pyobject_as_int8(PyObject *input, char **output, plcPyType *type);
-static int plc_pyobject_as_float4(PyObject *input, char **output, plcPyType *type);
-static int plc_pyobject_as_float8(PyObject *input, char **output, plcPyType *type);
-static int plc_pyobject_as_text(PyObject *input, char **output, plcPyType *type);
-static int plc_pyobject_as_array(PyObject *input, char **output, plcPyType *type);
-static int plc_pyobject_as_udt(PyObject *input, char **output, plcPyType *type);
-static int plc_pyobject_as_bytea(PyObject *input, char **output, plcPyType *type);
+static PyObject *plc_pyobject_from_numeric(char *input, plcPyType *type);
+static PyObject *plc_pyobject_from_numeric_ptr(char *input, plcPyType *type);
+
+static int plc_pyobject_as_int1(PyObject *input, rawdata *output, plcPyType *type);
+static int plc_pyobject_as_int2(PyObject *input, rawdata *output, plcPyType *type);
+static int plc_pyobject_as_int4(PyObject *input, rawdata *output, plcPyType *type);
+static int plc_pyobject_as_int8(PyObject *input, rawdata *output, plcPyType *type);
+static int plc_pyobject_as_float4(PyObject *input, rawdata *output, plcPyType *type);
+static int plc_pyobject_as_float8(PyObject *input, rawdata *output, plcPyType *type);
+static int plc_pyobject_as_text(PyObject *input, rawdata *output, plcPyType *type);
+static int plc_pyobject_as_array(PyObject *input, rawdata *output, plcPyType *type);
+static int plc_pyobject_as_udt(PyObject *input, rawdata *output, plcPyType *type);
+static int plc_pyobject_as_bytea(PyObject *input, rawdata *output, plcPyType *type);
+static int plc_pyobject_as_numeric(PyObject *input, rawdata *output, plcPyType *type);
+static PyObject *plc_get_decimal(void);
+static int plc_floor_div4(int p);
 
 static void plc_pyobject_iter_free (plcIterator *iter);
 static rawdata *plc_pyobject_as_array_next (plcIterator *iter);
@@ -150,7 +155,7 @@ static PyObject *plc_pyobject_from_udt(char *input, plcPyType *type) {
             if (udt->data[i].isnull) {
                 PyDict_SetItemString(res, type->subTypes[i].typeName, Py_None);
             } else {
-                obj = type->subTypes[i].conv.inputfunc(udt->data[i].value,
+                obj = type->subTypes[i].conv.inputfunc(plc_raw_value(&udt->data[i]),
                                                        &type->subTypes[i]);
                 PyDict_SetItemString(res, type->subTypes[i].typeName, obj);
                 Py_XDECREF(obj);
@@ -177,16 +182,74 @@ static PyObject *plc_pyobject_from_bytea_ptr(char *input, plcPyType *type) {
     return plc_pyobject_from_bytea(*((char**)input), type);
 }
 
-static int plc_pyobject_as_int1(PyObject *input, char **output, plcPyType *type UNUSED) {
+/*
+ * Numeric becomes decimal.Decimal built from the tuple of its decimal digits,
+ * so the value keeps all of its digits and the number of them after the point
+ */
+static PyObject *plc_pyobject_from_numeric(char *input, plcPyType *type UNUSED) {
+    plcNumeric *num = (plcNumeric*)input;
+    PyObject   *decimal = plc_get_decimal();
+    PyObject   *digits;
+    PyObject   *res;
+    char       *dec;
+    int         ndec = 0;
+    int         exponent;
+    int         first;
+    int         i;
+
+    if (decimal == NULL) {
+        return NULL;
+    }
+    if (num->sign == PLC_NUMERIC_NAN) {
+        return PyObject_CallFunction(decimal, "s", "NaN");
+    }
+
+    /* Each base 10000 digit gives four decimal ones, zeros are added up to
+     * the point and after it up to the scale */
+    exponent = (num->weight - num->ndigits + 1) * 4;
+    dec = (char*)pmalloc(num->ndigits * 4 + (exponent > 0 ? exponent : 0) + num->dscale + 1);
+    for (i = 0; i < num->ndigits; i++) {
+        dec[ndec++] = num->digits[i] / 1000;
+        dec[ndec++] = num->digits[i] / 100 % 10;
+        dec[ndec++] = num->digits[i] / 10 % 10;
+        dec[ndec++] = num->digits[i] % 10;
+    }
+    while (ndec > 0 && exponent < -num->dscale && dec[ndec - 1] == 0) {
+        ndec--;
+        exponent++;
+    }
+    while (exponent > -num->dscale) {
+        dec[ndec++] = 0;
+        exponent--;
+    }
+    for (first = 0; first < ndec - 1 && dec[first] == 0; first++)
+        ;
+
+    digits = PyTuple_New(ndec - first);
+    for (i = first; i < ndec; i++) {
+        PyTuple_SetItem(digits, i - first, PyInt_FromLong(dec[i]));
+    }
+    pfree(dec);
+
+    res = PyObject_CallFunction(decimal, "((iOi))",
+                                num->sign == PLC_NUMERIC_NEG ? 1 : 0, digits, exponent);
+    Py_DECREF(digits);
+    return res;
+}
+
+static PyObject *plc_pyobject_from_numeric_ptr(char *input, plcPyType *type) {
+    return plc_pyobject_from_numeric(*((char**)input), type);
+}
+
+static int plc_pyobject_as_int1(PyObject *input, rawdata *output, plcPyType *type UNUSED) {
     int res = 0;
-    char *out = (char*)malloc(1);
-    *output = out;
+    output->value = NULL;
     if (PyInt_Check(input))
-        *out = (char)PyInt_AsLong(input);
+        output->inlined.int1 = (char)PyInt_AsLong(input);
     else if (PyLong_Check(input))
-        *out = (char)PyLong_AsLongLong(input);
+        output->inlined.int1 = (char)PyLong_AsLongLong(input);
     else if (PyFloat_Check(input))
-        *out = (char)PyFloat_AsDouble(input);
+        output->inlined.int1 = (char)PyFloat_AsDouble(input);
     else {
         raise_execution_error("Exception occurred transforming result object to int1");
         res = -1;
@@ -194,16 +257,15 @@ static int plc_pyobject_as_int1(PyObject *input, char **output, plcPyType *type
     return res;
 }
 
-static int plc_pyobject_as_int2(PyObject *input, char **output, plcPyType *type UNUSED) {
+static int plc_pyobject_as_int2(PyObject *input, rawdata *output, plcPyType *type UNUSED) {
     int res = 0;
-    char *out = (char*)malloc(2);
-    *output = out;
+    output->value = NULL;
     if (PyInt_Check(input))
-        *((short*)out) = (short)PyInt_AsLong(input);
+        output->inlined.int2 = (short)PyInt_AsLong(input);
     else if (PyLong_Check(input))
-        *((short*)out) = (short)PyLong_AsLongLong(input);
+        output->inlined.int2 = (short)PyLong_AsLongLong(input);
     else if (PyFloat_Check(input))
-        *((short*)out) = (short)PyFloat_AsDouble(input);
+        output->inlined.int2 = (short)PyFloat_AsDouble(input);
     else {
         raise_execution_error("Exception occurred transforming result object to int2");
         res = -1;
@@ -211,16 +273,15 @@ static int plc_pyobject_as_int2(PyObject *input, char **output, plcPyType *type
     return res;
 }
 
-static int plc_pyobject_as_int4(PyObject *input, char **output, plcPyType *type UNUSED) {
+static int plc_pyobject_as_int4(PyObject *input, rawdata *output, plcPyType *type UNUSED) {
     int res = 0;
-    char *out = (char*)malloc(4);
-    *output = out;
+    output->value = NULL;
     if (PyInt_Check(input))
-        *((int*)out) = (int)PyInt_AsLong(input);
+        output->inlined.int4 = (int)PyInt_AsLong(input);
     else if (PyLong_Check(input))
-        *((int*)out) = (int)PyLong_AsLongLong(input);
+        output->inlined.int4 = (int)PyLong_AsLongLong(input);
     else if (PyFloat_Check(input))
-        *((int*)out) = (int)PyFloat_AsDouble(input);
+        output->inlined.int4 = (int)PyFloat_AsDouble(input);
     else {
         raise_execution_error("Exception occurred transforming result object to int4");
         res = -1;
@@ -228,16 +289,15 @@ static int plc_pyobject_as_int4(PyObject *input, char **output, plcPyType *type
     return res;
 }
 
-static int plc_pyobject_as_int8(PyObject *input, char **output, plcPyType *type UNUSED) {
+static int plc_pyobject_as_int8(PyObject *input, rawdata *output, plcPyType *type UNUSED) {
     int res = 0;
-    char *out = (char*)malloc(8);
-    *output = out;
+    output->value = NULL;
     if (PyLong_Check(input))
-        *((long long*)out) = (long long)PyLong_AsLongLong(input);
+        output->inlined.int8 = (long long)PyLong_AsLongLong(input);
     else if (PyInt_Check(input))
-        *((long long*)out) = (long long)PyInt_AsLong(input);
+        output->inlined.int8 = (long long)PyInt_AsLong(input);
     else if (PyFloat_Check(input))
-        *((long long*)out) = (long long)PyFloat_AsDouble(input);
+        output->inlined.int8 = (long long)PyFloat_AsDouble(input);
     else {
         raise_execution_error("Exception occurred transforming result object to int8");
         res = -1;
@@ -245,16 +305,15 @@ static int plc_pyobject_as_int8(PyObject *input, char **output, plcPyType *type
     return res;
 }
 
-static int plc_pyobject_as_float4(PyObject *input, char **output, plcPyType *type UNUSED) {
+static int plc_pyobject_as_float4(PyObject *input, rawdata *output, plcPyType *type UNUSED) {
     int res = 0;
-    char *out = (char*)malloc(4);
-    *output = out;
+    output->value = NULL;
     if (PyFloat_Check(input))
-        *((float*)out) = (float)PyFloat_AsDouble(input);
+        output->inlined.float4 = (float)PyFloat_AsDouble(input);
     else if (PyLong_Check(input))
-        *((float*)out) = (float)PyLong_AsLongLong(input);
+        output->inlined.float4 = (float)PyLong_AsLongLong(input);
     else if (PyInt_Check(input))
-        *((float*)out) = (float)PyInt_AsLong(input);
+        output->inlined.float4 = (float)PyInt_AsLong(input);
     else {
         raise_execution_error("Exception occurred transforming result object to float4");
         res = -1;
@@ -262,16 +321,15 @@ static int plc_pyobject_as_float4(PyObject *input, char **output, plcPyType *typ
     return res;
 }
 
-static int plc_pyobject_as_float8(PyObject *input, char **output, plcPyType *type UNUSED) {
+static int plc_pyobject_as_float8(PyObject *input, rawdata *output, plcPyType *type UNUSED) {
     int res = 0;
-    char *out = (char*)malloc(8);
-    *output = out;
+    output->value = NULL;
     if (PyFloat_Check(input))
-        *((double*)out) = (double)PyFloat_AsDouble(input);
+        output->inlined.float8 = (double)PyFloat_AsDouble(input);
     else if (PyLong_Check(input))
-        *((double*)out) = (double)PyLong_AsLongLong(input);
+        output->inlined.float8 = (double)PyLong_AsLongLong(input);
     else if (PyInt_Check(input))
-        *((double*)out) = (double)PyInt_AsLong(input);
+        output->inlined.float8 = (double)PyInt_AsLong(input);
     else {
         raise_execution_error("Exception occurred transforming result object to float8");
         res = -1;
@@ -279,15 +337,15 @@ static int plc_pyobject_as_float8(PyObject *input, char **output, plcPyType *typ
     return res;
 }
 
-static int plc_pyobject_as_text(PyObject *input, char **output, plcPyType *type UNUSED) {
+static int plc_pyobject_as_text(PyObject *input, rawdata *output, plcPyType *type UNUSED) {
     int res = 0;
     PyObject *obj;
     obj = PyObject_Str(input);
     if (obj != NULL) {
-        *output = strdup(PyString_AsString(obj));
+        output->value = strdup(PyString_AsString(obj));
         Py_DECREF(obj);
     } else {
-        *output = NULL;
+        output->value = NULL;
         raise_execution_error("Exception occurred transforming result object to text");
         res = -1;
     }
@@ -325,7 +383,7 @@ static rawdata *plc_pyobject_as_array_next (plcIterator *iter) {
         res->value = NULL;
     } else {
         res->isnull = 0;
-        meta->outputfunc(obj, &res->value, meta->type);
+        meta->outputfunc(obj, res, meta->type);
     }
     Py_XDECREF(obj);
 
@@ -353,7 +411,7 @@ static rawdata *plc_pyobject_as_array_next (plcIterator *iter) {
     return res;
 }
 
-static int plc_pyobject_as_array(PyObject *input, char **output, plcPyType *type) {
+static int plc_pyobject_as_array(PyObject *input, rawdata *output, plcPyType *type) {
     plcPyArrMeta    *meta;
     plcArrayMeta    *arrmeta;
     PyObject        *obj;
@@ -373,7 +431,7 @@ static int plc_pyobject_as_array(PyObject *input, char **output, plcPyType *type
         while (obj != NULL && PySequence_Check(obj) && !PyString_Check(obj)) {
             int len = PySequence_Length(obj);
             if (len < 0) {
-                *output = NULL;
+                output->value = NULL;
                 return -1;
             }
             dims[ndims] = len;
@@ -410,6 +468,7 @@ static int plc_pyobject_as_array(PyObject *input, char **output, plcPyType *type
 
         iter->meta = arrmeta;
         iter->payload = (char*)meta;
+        iter->packed = NULL;
 
         /* Initializing initial position */
         ptrs = (plcPyArrPointer*)pmalloc(ndims * sizeof(plcPyArrPointer));
@@ -426,20 +485,20 @@ static int plc_pyobject_as_array(PyObject *input, char **output, plcPyType *type
         iter->next = plc_pyobject_as_array_next;
         iter->cleanup = plc_pyobject_iter_free;
 
-        *output = (char*)iter;
+        output->value = (char*)iter;
     } else {
         raise_execution_error("Cannot convert non-sequence object to array");
-        *output = NULL;
+        output->value = NULL;
         res = -1;
     }
 
     return res;
 }
 
-static int plc_pyobject_as_udt(PyObject *input, char **output, plcPyType *type) {
+static int plc_pyobject_as_udt(PyObject *input, rawdata *output, plcPyType *type) {
     int res = 0;
 
-    *output = NULL;
+    output->value = NULL;
     if (!PyDict_Check(input)) {
         raise_execution_error("Only 'dict' object can be converted to UDT \"%s\"", type->typeName);
         res = -1;
@@ -463,17 +522,17 @@ static int plc_pyobject_as_udt(PyObject *input, char **output, plcPyType *type)
                 udt->data[i].value = NULL;
             } else {
                 udt->data[i].isnull = false;
-                res = type->subTypes[i].conv.outputfunc(value, &udt->data[i].value, &type->subTypes[i]);
+                res = type->subTypes[i].conv.outputfunc(value, &udt->data[i], &type->subTypes[i]);
             }
         }
 
-        *output = (char*)udt;
+        output->value = (char*)udt;
     }
 
     return res;
 }
 
-static int plc_pyobject_as_bytea(PyObject *input, char **output, plcPyType *type UNUSED) {
+static int plc_pyobject_as_bytea(PyObject *input, rawdata *output, plcPyType *type UNUSED) {
     PyObject *volatile plrv_so = NULL;
     int   len;
     char *res;
@@ -497,7 +556,7 @@ static int plc_pyobject_as_bytea(PyObject *input, char **output, plcPyType *type
             res = pmalloc(sz + 4);
             *((int*)res) = (int)sz;
             memcpy(res + 4, str, sz);
-            *output = res;
+            output->value = res;
             return 0;
         }
     #endif
@@ -513,11 +572,135 @@ static int plc_pyobject_as_bytea(PyObject *input, char **output, plcPyType *type
     *((int*)res) = len;
     memcpy(res + 4, PyBytes_AsString(plrv_so), len);
     Py_DECREF(plrv_so);
-    *output = res;
+    output->value = res;
+
+    return 0;
+}
+
+/*
+ * Decimal is split into base 10000 digits aligned at the decimal point. Other
+ * objects are converted to Decimal first, floats through their shortest
+ * representation to match the value the user sees
+ */
+static int plc_pyobject_as_numeric(PyObject *input, rawdata *output, plcPyType *type UNUSED) {
+    static const int pow10[] = {1, 10, 100, 1000};
+    PyObject   *decimal = plc_get_decimal();
+    PyObject   *value = NULL;
+    PyObject   *tuple = NULL;
+    PyObject   *digits;
+    PyObject   *pyexponent;
+    plcNumeric *num;
+    long        exponent;
+    int         ndec;
+    int         top;
+    int         weight;
+    int         ndigits;
+    int         i;
+
+    output->value = NULL;
+    if (decimal == NULL) {
+        return -1;
+    }
+
+    if (PyObject_IsInstance(input, decimal) == 1) {
+        value = input;
+        Py_INCREF(value);
+    } else if (PyFloat_Check(input)) {
+        PyObject *repr = PyObject_Repr(input);
+        if (repr != NULL) {
+            value = PyObject_CallFunctionObjArgs(decimal, repr, NULL);
+            Py_DECREF(repr);
+        }
+    } else {
+        value = PyObject_CallFunctionObjArgs(decimal, input, NULL);
+    }
+    if (value != NULL) {
+        tuple = PyObject_CallMethod(value, "as_tuple", NULL);
+        Py_DECREF(value);
+    }
+    if (tuple == NULL || !PyTuple_Check(tuple) || PyTuple_Size(tuple) != 3) {
+        Py_XDECREF(tuple);
+        raise_execution_error("Exception occurred transforming result object to numeric");
+        return -1;
+    }
+
+    digits     = PyTuple_GetItem(tuple, 1);
+    pyexponent = PyTuple_GetItem(tuple, 2);
+    ndec       = PyTuple_Size(digits);
+
+    /* NaN has a string in place of the exponent, so does the infinity */
+    if (!PyInt_Check(pyexponent) && !PyLong_Check(pyexponent)) {
+        if (PyString_Check(pyexponent) && strcmp(PyString_AsString(pyexponent), "F") == 0) {
+            Py_DECREF(tuple);
+            raise_execution_error("Infinity cannot be transformed to numeric");
+            return -1;
+        }
+        num = (plcNumeric*)pmalloc(PLC_NUMERIC_SIZE(0));
+        num->ndigits = 0;
+        num->weight  = 0;
+        num->sign    = PLC_NUMERIC_NAN;
+        num->dscale  = 0;
+        output->value = (char*)num;
+        Py_DECREF(tuple);
+        return 0;
+    }
+
+    /* Digit i has the power of 10 equal to top - i, display scale and
+     * weight have to fit into the numeric header */
+    exponent = PyInt_AsLong(pyexponent);
+    if (PyErr_Occurred() || exponent < -0x3fff || exponent > 0x7fff * 4 || ndec > 0x7fff * 4) {
+        Py_DECREF(tuple);
+        raise_execution_error("Value overflows numeric format");
+        return -1;
+    }
+    top     = (int)exponent + ndec - 1;
+    weight  = plc_floor_div4(top);
+    ndigits = weight - plc_floor_div4((int)exponent) + 1;
+    if (weight > 0x7fff || ndigits > 0x7fff) {
+        Py_DECREF(tuple);
+        raise_execution_error("Value overflows numeric format");
+        return -1;
+    }
+
+    num = (plcNumeric*)pmalloc(PLC_NUMERIC_SIZE(ndigits));
+    memset(num->digits, 0, ndigits * sizeof(unsigned short));
+    num->ndigits = ndigits;
+    num->weight  = weight;
+    num->sign    = PyInt_AsLong(PyTuple_GetItem(tuple, 0)) ? PLC_NUMERIC_NEG : PLC_NUMERIC_POS;
+    num->dscale  = exponent < 0 ? -exponent : 0;
+    for (i = 0; i < ndec; i++) {
+        int power = top - i;
+        int k     = plc_floor_div4(power);
+
+        num->digits[weight - k] += PyInt_AsLong(PyTuple_GetItem(digits, i)) * pow10[power - 4 * k];
+    }
+    Py_DECREF(tuple);
 
+    output->value = (char*)num;
     return 0;
 }
 
+static int plc_floor_div4(int p) {
+    return p >= 0 ? p / 4 : -((-p + 3) / 4);
+}
+
+/* decimal.Decimal, imported on the first use */
+static PyObject *plc_get_decimal() {
+    static PyObject *decimal = NULL;
+
+    if (decimal == NULL) {
+        PyObject *module = PyImport_ImportModule("decimal");
+        if (module != NULL) {
+            decimal = PyObject_GetAttrString(module, "Decimal");
+            Py_DECREF(module);
+        }
+        if (decimal == NULL) {
+            raise_execution_error("Cannot import decimal.Decimal");
+        }
+    }
+    return decimal;
+}
+
 static plcPyInputFunc plc_get_input_function(plcDatatype dt, bool isArrayElement) {
     plcPyInputFunc res = NULL;
     switch (dt) {
@@ -553,6 +736,13 @@ static plcPyInputFunc plc_get_input_function(plcDatatype dt, bool isArrayElement
                 res = plc_pyobject_from_bytea;
             }
             break;
+        case PLC_DATA_NUMERIC:
+            if (isArrayElement) {
+                res = plc_pyobject_from_numeric_ptr;
+            } else {
+                res = plc_pyobject_from_numeric;
+            }
+            break;
         case PLC_DATA_ARRAY:
             res = plc_pyobject_from_array;
             break;
@@ -598,6 +788,9 @@ static plcPyOutputFunc plc_get_output_function(plcDatatype dt) {
         case PLC_DATA_BYTEA:
             res = plc_pyobject_as_bytea;
             break;
+        case PLC_DATA_NUMERIC:
+            res = plc_pyobject_as_numeric;
+            break;
         case PLC_DATA_ARRAY:
             res = plc_pyobject_as_array;
             break;
@@ -644,6 +837,7 @@ plcPyFunction *plc_py_init_function(plcMsgCallreq *call) {
     res->retset = call->retset;
     res->args = (plcPyType*)malloc(res->nargs * sizeof(plcPyType));
     res->objectid = call->objectid;
+    res->pyfunc = NULL;
     res->pySD = PyDict_New();
 
     for (i = 0; i < res->nargs; i++) {
@@ -690,6 +884,7 @@ void plc_py_free_function(plcPyFunction *func) {
     for (i = 0; i < func->nargs; i++)
         plc_py_free_type(&func->args[i]);
     plc_py_free_type(&func->res);
+    Py_XDECREF(func->pyfunc);
     Py_DECREF(func->pySD);
     free(func->args);
     free(func->proc.src);
@@ -16,7 +16,7 @@
 
 typedef struct plcPyType plcPyType;
 typedef PyObject *(*plcPyInputFunc)(char*, plcPyType*);
-typedef int (*plcPyOutputFunc)(PyObject*, char**, plcPyType*);
+typedef int (*plcPyOutputFunc)(PyObject*, rawdata*, plcPyType*);
 
 /* Working with arrays in Python */
 
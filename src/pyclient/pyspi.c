@@ -31,12 +31,26 @@ static plcMsgResult *receive_from_backend() {
     switch (resp->msgtype) {
         case MT_CALLREQ:
             handle_call((plcMsgCallreq*)resp, conn);
-            free_callreq((plcMsgCallreq*)resp, false, false);
+            plcontainer_channel_release(resp);
+            return receive_from_backend();
+        case MT_CALLREQ_BATCH:
+            /* Batch sent ahead waits for the current call to return */
+            if (((plcMsgCallreqBatch*)resp)->ahead) {
+                queue_call(resp);
+            } else {
+                handle_call((plcMsgCallreq*)resp, conn);
+                plcontainer_channel_release(resp);
+            }
+            return receive_from_backend();
+        case MT_RESULT_NEXT:
+            handle_result_next((plcMsgResultNext*)resp, conn);
+            plcontainer_channel_release(resp);
             return receive_from_backend();
         case MT_RESULT:
             break;
         default:
             raise_execution_error("Client cannot process message type %c", resp->msgtype);
+            plcontainer_channel_release(resp);
             return NULL;
     }
     return (plcMsgResult*)resp;
@@ -85,7 +99,7 @@ PyObject *plpy_execute(PyObject *self UNUSED, PyObject *pyquery) {
     pyresult = PyList_New(result->res->rows);
     if (pyresult == NULL) {
         raise_execution_error("Cannot allocate new list object in Python");
-        free_result(resp, false);
+        plcontainer_channel_release((plcMessage*)resp);
         plc_free_result_conversions(result);
         return NULL;
     }
@@ -94,7 +108,7 @@ PyObject *plpy_execute(PyObject *self UNUSED, PyObject *pyquery) {
         if (result->args[j].conv.inputfunc == NULL) {
             raise_execution_error("Type %d is not yet supported by Python container",
                                   (int)result->args[j].type);
-            free_result(resp, false);
+            plcontainer_channel_release((plcMessage*)resp);
             plc_free_result_conversions(result);
             return NULL;
         }
@@ -104,13 +118,13 @@ PyObject *plpy_execute(PyObject *self UNUSED, PyObject *pyquery) {
         pydict = PyDict_New();
 
         for (j = 0; j < result->res->cols; j++) {
-            pyval = result->args[j].conv.inputfunc(result->res->data[i][j].value,
+            pyval = result->args[j].conv.inputfunc(plc_raw_value(&result->res->data[i][j]),
                                                    &result->args[j]);
 
             if (PyDict_SetItemString(pydict, result->res->names[j], pyval) != 0) {
                 raise_execution_error("Error setting result dictionary element",
                                       (int)result->res->types[j].type);
-                free_result(resp, false);
+                plcontainer_channel_release((plcMessage*)resp);
                 plc_free_result_conversions(result);
                 return NULL;
             }
@@ -119,13 +133,13 @@ PyObject *plpy_execute(PyObject *self UNUSED, PyObject *pyquery) {
         if (PyList_SetItem(pyresult, i, pydict) != 0) {
             raise_execution_error("Error setting result list element",
                                   (int)result->res->types[j].type);
-            free_result(resp, false);
+            plcontainer_channel_release((plcMessage*)resp);
             plc_free_result_conversions(result);
             return NULL;
         }
     }
 
-    free_result(resp, false);
+    plcontainer_channel_release((plcMessage*)resp);
     plc_free_result_conversions(result);
 
     return pyresult;
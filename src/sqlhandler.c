@@ -33,7 +33,8 @@ static plcMsgResult *create_sql_result() {
     result->exception_callback = NULL;
     resTypes        = palloc(result->cols * sizeof(plcTypeInfo));
     for (j = 0; j < result->cols; j++) {
-        fill_type_info(NULL, SPI_tuptable->tupdesc->attrs[j]->atttypid, &resTypes[j]);
+        fill_type_info(NULL, SPI_tuptable->tupdesc->attrs[j]->atttypid,
+                       SPI_tuptable->tupdesc->attrs[j]->atttypmod, &resTypes[j]);
         copy_type_info(&result->types[j], &resTypes[j]);
         result->names[j] = SPI_fname(SPI_tuptable->tupdesc, j + 1);
     }
@@ -57,7 +58,7 @@ static plcMsgResult *create_sql_result() {
                     result->data[i][j].value = NULL;
                 } else {
                     result->data[i][j].isnull = 0;
-                    result->data[i][j].value = resTypes[j].outfunc(origval, &resTypes[j]);
+                    resTypes[j].outfunc(origval, &resTypes[j], &result->data[i][j]);
                 }
             }
         }
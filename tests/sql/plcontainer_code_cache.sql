@@ -0,0 +1,30 @@
+-- Code cache of each role is kept in its own directory signed with its own key
+
+\set plc_superuser :USER
+
+CREATE ROLE plc_code_cache_role1 LOGIN;
+CREATE ROLE plc_code_cache_role2 LOGIN;
+
+CREATE TABLE plc_code_cache_dirs (rolname text, dir text) DISTRIBUTED RANDOMLY;
+GRANT ALL ON plc_code_cache_dirs TO PUBLIC;
+
+CREATE FUNCTION pycodecachedir() RETURNS text AS $$
+# container: plc_python_code_cache
+import os
+return os.environ.get('PLC_CODE_CACHE')
+$$ LANGUAGE plcontainer;
+
+\c - plc_code_cache_role1
+INSERT INTO plc_code_cache_dirs SELECT current_user, pycodecachedir();
+
+\c - plc_code_cache_role2
+INSERT INTO plc_code_cache_dirs SELECT current_user, pycodecachedir();
+
+\c - :plc_superuser
+SELECT count(*) AS roles, count(DISTINCT dir) AS dirs
+    FROM plc_code_cache_dirs WHERE dir LIKE '/code_cache/%';
+
+DROP FUNCTION pycodecachedir();
+DROP TABLE plc_code_cache_dirs;
+DROP ROLE plc_code_cache_role1;
+DROP ROLE plc_code_cache_role2;
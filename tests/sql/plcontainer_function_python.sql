@@ -42,7 +42,7 @@ $$ LANGUAGE plcontainer;
 
 CREATE OR REPLACE FUNCTION pynumeric(n numeric) RETURNS numeric AS $$
 # container: plc_python
-return n+3.0
+return n+3
 $$ LANGUAGE plcontainer;
 
 CREATE OR REPLACE FUNCTION pytimestamp(t timestamp) RETURNS timestamp AS $$
@@ -296,6 +296,16 @@ CREATE OR REPLACE FUNCTION pynested_call_three(a text) RETURNS text AS $$
 return a
 $$ LANGUAGE plcontainer ;
 
+CREATE OR REPLACE FUNCTION pyquery_int(i int4) RETURNS int4 AS $$
+# container: plc_python
+return plpy.execute('select %d + 1 as a' % i)[0]['a']
+$$ LANGUAGE plcontainer;
+
+CREATE OR REPLACE FUNCTION pynested_int(i int4) RETURNS int4 AS $$
+# container: plc_python
+return plpy.execute('select pyint(%d::int4) as a' % i)[0]['a'] + 1
+$$ LANGUAGE plcontainer;
+
 CREATE OR REPLACE FUNCTION py_plpy_get_record() RETURNS int AS $$
 # container: plc_python
 import sys
@@ -319,7 +329,7 @@ if (sys.version_info.major == 2):
     if r[0]['d'] != 3 or str(type(r[0]['d'])) != "<type 'long'>": return 5
     if r[0]['e'] != 4.0 or str(type(r[0]['e'])) != "<type 'float'>": return 6
     if r[0]['f'] != 5.0 or str(type(r[0]['f'])) != "<type 'float'>": return 7
-    if r[0]['g'] != 6.0 or str(type(r[0]['g'])) != "<type 'float'>": return 8
+    if r[0]['g'] != 6.0 or str(type(r[0]['g'])) != "<type 'decimal.Decimal'>": return 8
     if r[0]['h'] != 'foobar' or str(type(r[0]['h'])) != "<type 'str'>": return 9
     if r[0]['i'] != 'test' or str(type(r[0]['i'])) != "<type 'str'>": return 10
 # Python 3
@@ -330,7 +340,7 @@ else:
     if r[0]['d'] != 3 or str(type(r[0]['d'])) != "<class 'int'>": return 5
     if r[0]['e'] != 4.0 or str(type(r[0]['e'])) != "<class 'float'>": return 6
     if r[0]['f'] != 5.0 or str(type(r[0]['f'])) != "<class 'float'>": return 7
-    if r[0]['g'] != 6.0 or str(type(r[0]['g'])) != "<class 'float'>": return 8
+    if r[0]['g'] != 6.0 or str(type(r[0]['g'])) != "<class 'decimal.Decimal'>": return 8
     if r[0]['h'] != 'foobar' or str(type(r[0]['h'])) != "<class 'str'>": return 9
     if r[0]['i'].decode('UTF8') != 'test' or str(type(r[0]['i'])) != "<class 'bytes'>": return 10
 return 11
@@ -428,7 +438,7 @@ if (sys.version_info.major == 2):
     if r['d'] != 3 or str(type(r['d'])) != "<type 'long'>": return 5
     if r['e'] != 4.0 or str(type(r['e'])) != "<type 'float'>": return 6
     if r['f'] != 5.0 or str(type(r['f'])) != "<type 'float'>": return 7
-    if r['g'] != 6.0 or str(type(r['g'])) != "<type 'float'>": return 8
+    if r['g'] != 6.0 or str(type(r['g'])) != "<type 'decimal.Decimal'>": return 8
     if r['h'] != 'foobar' or str(type(r['h'])) != "<type 'str'>": return 9
 # Python 3
 else:
@@ -438,7 +448,7 @@ else:
     if r['d'] != 3 or str(type(r['d'])) != "<class 'int'>": return 5
     if r['e'] != 4.0 or str(type(r['e'])) != "<class 'float'>": return 6
     if r['f'] != 5.0 or str(type(r['f'])) != "<class 'float'>": return 7
-    if r['g'] != 6.0 or str(type(r['g'])) != "<class 'float'>": return 8
+    if r['g'] != 6.0 or str(type(r['g'])) != "<class 'decimal.Decimal'>": return 8
     if r['h'] != 'foobar' or str(type(r['h'])) != "<class 'str'>": return 9
 return 10
 $$ LANGUAGE plcontainer;
@@ -455,7 +465,7 @@ if (sys.version_info.major == 2):
     if len(r['d']) != 3 or r['d'] != [3,4,5] or str(type(r['d'][0])) != "<type 'long'>": return 5
     if len(r['e']) != 3 or r['e'] != [4.5,5.5,6.5] or str(type(r['e'][0])) != "<type 'float'>": return 6
     if len(r['f']) != 3 or r['f'] != [5.5,6.5,7.5] or str(type(r['f'][0])) != "<type 'float'>": return 7
-    if len(r['g']) != 3 or r['g'] != [6.5,7.5,8.5] or str(type(r['g'][0])) != "<type 'float'>": return 8
+    if len(r['g']) != 3 or r['g'] != [6.5,7.5,8.5] or str(type(r['g'][0])) != "<type 'decimal.Decimal'>": return 8
     if len(r['h']) != 3 or r['h'] != ['a','b','c'] or str(type(r['h'][0])) != "<type 'str'>": return 9
 # Python 3
 else:
@@ -465,7 +475,7 @@ else:
     if len(r['d']) != 3 or r['d'] != [3,4,5] or str(type(r['d'][0])) != "<class 'int'>": return 5
     if len(r['e']) != 3 or r['e'] != [4.5,5.5,6.5] or str(type(r['e'][0])) != "<class 'float'>": return 6
     if len(r['f']) != 3 or r['f'] != [5.5,6.5,7.5] or str(type(r['f'][0])) != "<class 'float'>": return 7
-    if len(r['g']) != 3 or r['g'] != [6.5,7.5,8.5] or str(type(r['g'][0])) != "<class 'float'>": return 8
+    if len(r['g']) != 3 or r['g'] != [6.5,7.5,8.5] or str(type(r['g'][0])) != "<class 'decimal.Decimal'>": return 8
     if len(r['h']) != 3 or r['h'] != ['a','b','c'] or str(type(r['h'][0])) != "<class 'str'>": return 9
 return 10
 $$ LANGUAGE plcontainer;
@@ -505,6 +515,16 @@ CREATE OR REPLACE FUNCTION pytestudtrecord2() RETURNS SETOF record AS $$
 return [{'a': 1, 'b': 2, 'c': 'foo'}, {'a': 3, 'b': 4, 'c': 'bar'}]
 $$ LANGUAGE plcontainer;
 
+CREATE OR REPLACE FUNCTION pyoutparams(x int, OUT a int, OUT b text) AS $$
+# container: plc_python
+return {'a': x + 1, 'b': 'foo' + str(x)}
+$$ LANGUAGE plcontainer;
+
+CREATE OR REPLACE FUNCTION pysetofoutparams(n int, OUT a int, OUT b text) RETURNS SETOF record AS $$
+# container: plc_python
+return [{'a': i, 'b': None if i == 1 else str(i)} for i in range(n)]
+$$ LANGUAGE plcontainer;
+
 CREATE OR REPLACE FUNCTION pybadint() RETURNS int AS $$
 # container: plc_python
 return 'foo'
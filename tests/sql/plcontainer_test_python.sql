@@ -58,6 +58,20 @@ select pyreturnsetoftextarr(7);
 select pyreturnsetofdate(8);
 select pyreturnsetofint8yield(9);
 select pyreturnsetofint8yield(0);
+-- Result set spanning several chunks and stopped before the end
+select count(*), sum(x) from pyreturnsetofint8yield(2500) x;
+set plcontainer.result_pipeline_depth = 0;
+select count(*), sum(x) from pyreturnsetofint8yield(2500) x;
+set plcontainer.result_pipeline_depth = 4;
+select count(*), sum(x) from pyreturnsetofint8yield(2500) x;
+reset plcontainer.result_pipeline_depth;
+select pyreturnsetofint8yield(100000) limit 3;
+select pyreturnsetofint8yield(2);
+-- Two result sets sent in chunks over one connection at the same time
+select count(*), sum(a), sum(b) from (select pyreturnsetofint8yield(2500) a, pyreturnsetofint8yield(2500) b) t;
+-- Error in the middle of the result set, container is usable afterwards
+select 1 / (pyreturnsetofint8yield(2500) - 1500);
+select pyreturnsetofint8yield(2);
 -- Test that container cannot access filesystem of the host
 select pywriteFile();
 \! ls -l /tmp/foo
@@ -106,6 +120,9 @@ select * from pytestudt13( (1,2,'a')::test_type3 );
 select pytestudt16();
 select * from pytestudtrecord1() as t(a int, b int, c varchar);
 select * from pytestudtrecord2() as t(a int, b int, c varchar);
+select * from pyoutparams(1);
+select * from pysetofoutparams(3);
+select (pyoutparams(x)).* from generate_series(1,2) x;
 select pyreturnsetofint8(2), pyreturnsetofint8(3);
 select pybadint();
 select pybadfloat8();
@@ -113,4 +130,24 @@ select pybadudt();
 select pybadudt2();
 select pybadarr();
 select pybadarr2();
-select pyinvalid_function();
\ No newline at end of file
+select pyinvalid_function();
+select pyint(i::int4) from generate_series(1,3) i;
+select hits >= 2 as hits, misses > 0 as misses, entries > 0 as entries, capacity from plcontainer_function_cache_stats();
+-- Nested call evicts the outer function, which is freed only after it returns
+set plcontainer.function_cache_size = 1;
+select pynested_int(1);
+select evictions > 0 as evictions, entries from plcontainer_function_cache_stats();
+reset plcontainer.function_cache_size;
+select length(pyconcat(repeat('abc', 10000), repeat('xyz', 10000)));
+select compressed > 0 as compressed, decompressed > 0 as decompressed, ratio > 1 as ratio from plcontainer_compression_stats();
+-- Function called for the query rows in batches, results in the order of the rows
+select count(*), sum(v) from plcontainer_call_batch('pyfloat(float8)', 'select x::float8 from generate_series(1, 5000) x') as t(v float8);
+select v from plcontainer_call_batch('pyint(int4)', 'select x from generate_series(1, 3) x') as t(v int4);
+set plcontainer.batch_size = 100;
+select count(*), sum(v) from plcontainer_call_batch('pyquery_int(int4)', 'select x from generate_series(1, 1000) x') as t(v int4);
+set plcontainer.result_pipeline_depth = 4;
+select count(*), sum(v) from plcontainer_call_batch('pyquery_int(int4)', 'select x from generate_series(1, 1000) x') as t(v int4);
+reset plcontainer.result_pipeline_depth;
+reset plcontainer.batch_size;
+select * from plcontainer_call_batch('pyreturnsetofint8(int)', 'select 1') as t(v int8);
+select * from plcontainer_call_batch('pyint(int4)', 'select 1') as t(v text);
\ No newline at end of file